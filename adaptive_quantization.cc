@@ -21,6 +21,7 @@
 
 #include "compiler_specific.h"
 #include "gauss_blur.h"
+#include "profiler.h"
 #include "status.h"
 
 namespace pik {
@@ -122,6 +123,7 @@ ImageF SubsampleWithMax(const ImageF& in, int factor) {
 }  // namespace
 
 ImageF AdaptiveQuantizationMap(const ImageF& img, size_t resolution) {
+  PROFILER_FUNC;
   static const int kSampleRate = 8;
   PIK_ASSERT(resolution % kSampleRate == 0);
   const size_t out_xsize = (img.xsize() + resolution - 1) / resolution;
@@ -0,0 +1,56 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ans_decode.h"
+
+#include "histogram_decode.h"
+#include "status.h"
+
+namespace pik {
+
+bool ANSSymbolReader::DecodeHistograms(const size_t num_histograms,
+                                       const size_t max_alphabet_size,
+                                       const uint8_t* symbol_lut,
+                                       size_t symbol_lut_size, BitReader* in) {
+  map_.resize(num_histograms << ANS_LOG_TAB_SIZE);
+  info_.resize(num_histograms << 8);
+  for (int c = 0; c < num_histograms; ++c) {
+    std::vector<int> counts;
+    if (!ReadHistogram(ANS_LOG_TAB_SIZE, &counts, in)) {
+      return PIK_FAILURE("Invalid histogram bitstream.");
+    }
+    if (counts.size() > max_alphabet_size) {
+      return PIK_FAILURE("Alphabet size is too long.");
+    }
+    int offset = 0;
+    for (int i = 0, pos = 0; i < counts.size(); ++i) {
+      int symbol = i;
+      if (symbol_lut != nullptr && symbol < symbol_lut_size) {
+        symbol = symbol_lut[symbol];
+      }
+      info_[(c << 8) + symbol].offset_ = offset;
+      info_[(c << 8) + symbol].freq_ = counts[i];
+      offset += counts[i];
+      if (offset > ANS_TAB_SIZE) {
+        return PIK_FAILURE("Invalid ANS histogram data.");
+      }
+      for (int j = 0; j < counts[i]; ++j, ++pos) {
+        map_[(c << ANS_LOG_TAB_SIZE) + pos] = symbol;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace pik
@@ -0,0 +1,77 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Library to decode the ANS population counts from the bit-stream and decode
+// symbols based on the respective distributions.
+
+#ifndef ANS_DECODE_H_
+#define ANS_DECODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "ans_params.h"
+#include "bit_reader.h"
+#include "compiler_specific.h"
+
+namespace pik {
+
+class ANSSymbolReader {
+ public:
+  // Reads "num_histograms" histograms, whose symbols are remapped by
+  // "symbol_lut" if it is not null. Returns false if the bitstream is invalid.
+  bool DecodeHistograms(size_t num_histograms, size_t max_alphabet_size,
+                        const uint8_t* symbol_lut, size_t symbol_lut_size,
+                        BitReader* in);
+
+  // Decodes the next symbol with histogram "histo_idx". The symbols of each
+  // block of kANSBufferSize are preceded by the 32-bit initial state.
+  int ReadSymbol(const int histo_idx, BitReader* const PIK_RESTRICT br) {
+    if (symbols_left_ == 0) {
+      state_ = br->ReadBits(16);
+      state_ = (state_ << 16) | br->ReadBits(16);
+      br->FillBitBuffer();
+      symbols_left_ = kANSBufferSize;
+    }
+    const uint32_t res = state_ & (ANS_TAB_SIZE - 1);
+    const uint8_t symbol = map_[(histo_idx << ANS_LOG_TAB_SIZE) + res];
+    const ANSSymbolInfo s = info_[(histo_idx << 8) + symbol];
+    state_ = s.freq_ * (state_ >> ANS_LOG_TAB_SIZE) + res - s.offset_;
+    --symbols_left_;
+    if (state_ < (1u << 16)) {
+      state_ = (state_ << 16) | br->PeekFixedBits<16>();
+      br->Advance(16);
+    }
+    return symbol;
+  }
+
+  // Returns true if the state after the last symbol of a block matches the
+  // initial state of the encoder.
+  bool CheckANSFinalState() { return state_ == (ANS_SIGNATURE << 16); }
+
+ private:
+  struct ANSSymbolInfo {
+    uint16_t offset_;
+    uint16_t freq_;
+  };
+  size_t symbols_left_ = 0;
+  uint32_t state_ = 0;
+  std::vector<uint8_t> map_;
+  std::vector<ANSSymbolInfo> info_;
+};
+
+}  // namespace pik
+
+#endif  // ANS_DECODE_H_
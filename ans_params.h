@@ -28,6 +28,10 @@ namespace pik {
 #define ANS_TAB_MASK (ANS_TAB_SIZE - 1)
 #define ANS_SIGNATURE 0x13    // Initial state, used as CRC.
 
+// Number of symbols per block of the bitstream. Each block starts with the
+// 32-bit initial state of the decoder.
+static const int kANSBufferSize = 1 << 16;
+
 }  // namespace pik
 
 #endif  // ANS_PARAMS_H_
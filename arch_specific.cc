@@ -29,9 +29,11 @@
 #endif
 
 #include <string.h>  // memcpy
+#include <chrono>  // NOLINT
 #include <string>
 
 #include "simd/simd.h"
+#include "tsc_timer.h"
 
 namespace pik {
 
@@ -141,6 +143,19 @@ double DetectNominalClockRate() {
   return 0.0;
 }
 
+// Returns the tsc_timer frequency measured against steady_clock, for CPUs
+// whose brand string does not include the clock rate (e.g. AMD and VMs).
+double MeasureTicksPerSecond() {
+  const auto time0 = std::chrono::steady_clock::now();
+  const uint64_t ticks0 = Start<uint64_t>();
+  std::chrono::duration<double> elapsed;
+  do {
+    elapsed = std::chrono::steady_clock::now() - time0;
+  } while (elapsed.count() < 0.02);
+  const uint64_t ticks = Stop<uint64_t>() - ticks0;
+  return ticks / elapsed.count();
+}
+
 }  // namespace
 
 double NominalClockRate() {
@@ -154,7 +169,10 @@ double InvariantTicksPerSecond() {
   static const double cycles_per_second = __ppc_get_timebase_freq();
   return cycles_per_second;
 #else
-  return NominalClockRate();
+  static const double cycles_per_second = NominalClockRate() > 0.0
+                                              ? NominalClockRate()
+                                              : MeasureTicksPerSecond();
+  return cycles_per_second;
 #endif
 }
 
@@ -67,7 +67,8 @@ double NominalClockRate();
 
 // Returns tsc_timer frequency, useful for converting ticks to seconds. This is
 // unaffected by CPU throttling ("invariant"). Thread-safe. Returns timebase
-// frequency on PPC and NominalClockRate on all other platforms.
+// frequency on PPC and NominalClockRate on all other platforms, or if the latter
+// is unknown, the frequency measured during the first call (20 ms).
 double InvariantTicksPerSecond();
 
 #if PIK_ARCH_X64
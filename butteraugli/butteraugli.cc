@@ -40,6 +40,10 @@
 #include <algorithm>
 #include <array>
 
+#include "cache_aligned.h"
+#include "convolve_target.h"
+#include "simd/dispatch.h"
+
 
 // Restricted pointers speed up Convolution(); MSVC uses a different keyword.
 #ifdef _MSC_VER
@@ -50,6 +54,7 @@
 #define PROFILER_ENABLED 0
 #endif
 #if PROFILER_ENABLED
+#include "profiler.h"
 #else
 #define PROFILER_FUNC
 #define PROFILER_ZONE(name)
@@ -58,32 +63,18 @@
 namespace pik {
 namespace butteraugli {
 
+// Forwards to pik::CacheAligned, so that butteraugli's images are counted by
+// its memory statistics and recycled by the allocator of PikEncoder.
+static_assert(CacheAligned::kCacheLineSize ==
+                  pik::CacheAligned::kCacheLineSize,
+              "Alignment mismatch");
+
 void *CacheAligned::Allocate(const size_t bytes) {
-  char *const allocated = static_cast<char *>(malloc(bytes + kCacheLineSize));
-  if (allocated == nullptr) {
-    return nullptr;
-  }
-  const uintptr_t misalignment =
-      reinterpret_cast<uintptr_t>(allocated) & (kCacheLineSize - 1);
-  // malloc is at least kPointerSize aligned, so we can store the "allocated"
-  // pointer immediately before the aligned memory.
-  assert(misalignment % kPointerSize == 0);
-  char *const aligned = allocated + kCacheLineSize - misalignment;
-  memcpy(aligned - kPointerSize, &allocated, kPointerSize);
-  return BUTTERAUGLI_ASSUME_ALIGNED(aligned, 64);
+  return BUTTERAUGLI_ASSUME_ALIGNED(pik::CacheAligned::Allocate(bytes), 64);
 }
 
 void CacheAligned::Free(void *aligned_pointer) {
-  if (aligned_pointer == nullptr) {
-    return;
-  }
-  char *const aligned = static_cast<char *>(aligned_pointer);
-  assert(reinterpret_cast<uintptr_t>(aligned) % kCacheLineSize == 0);
-  char *allocated;
-  memcpy(&allocated, aligned - kPointerSize, kPointerSize);
-  assert(allocated <= aligned - kPointerSize);
-  assert(allocated >= aligned - kCacheLineSize);
-  free(allocated);
+  pik::CacheAligned::Free(aligned_pointer);
 }
 
 static inline bool IsNan(const float x) {
@@ -143,10 +134,37 @@ inline float DotProduct(const float u[3], const float v[3]) {
   return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
 }
 
+// Standard deviations of the blurs computed by Diffmap. DiffmapSupport()
+// derives the reach of a pixel change from them.
+static constexpr float kSigmaOpsin = 1.44316781537;
+static constexpr float kSigmaLf = 7.41525493374;
+static constexpr float kSigmaHf = 0.5 * kSigmaLf;
+static constexpr float kSigmaUhf = 0.5 * kSigmaHf;
+static constexpr float kSigmaNoiseLevels = 10.8163829574;
+static constexpr float kSigmaBlueCorrelation = 8.48596332566;
+static constexpr float kSigmaMask0 = 2.32030744494;
+static constexpr float kSigmaMask1 = 7.55507439878;
+static constexpr float kSigmaDiffmap = 1.72547472444;
+// Offset of the farthest neighbor read by MaltaUnit.
+static constexpr int kMaltaRadius = 4;
+
+// Returns the number of taps on either side of the center of the kernel of
+// ComputeKernel(sigma).
+static constexpr int KernelRadius(float sigma) {
+  // Accuracy increases when the factor is increased.
+  return 2.25f * sigma < 1.0f ? 1 : static_cast<int>(2.25f * sigma);
+}
+
+// Radius of DoGBlur(sigma), whose wider kernel has twice the sigma.
+static constexpr int DoGRadius(float sigma) {
+  return KernelRadius(sigma * 2.0f);
+}
+
+static constexpr int MaxRadius(int a, int b) { return a < b ? b : a; }
+
 std::vector<float> ComputeKernel(float sigma) {
-  const float m = 2.25;  // Accuracy increases when m is increased.
   const float scaler = -1.0 / (2 * sigma * sigma);
-  const int diff = std::max<int>(1, m * fabs(sigma));
+  const int diff = KernelRadius(fabs(sigma));
   std::vector<float> kernel(2 * diff + 1);
   for (int i = -diff; i <= diff; ++i) {
     kernel[i + diff] = exp(scaler * i * i);
@@ -202,16 +220,13 @@ ImageF Convolution(const ImageF& in,
                          out.Row(x));
   }
   // middle
-  for (; x < border2; ++x) {
-    float* const BUTTERAUGLI_RESTRICT row_out = out.Row(x);
+  if (x < border2) {
     for (size_t y = 0; y < in.ysize(); ++y) {
-      const float* const BUTTERAUGLI_RESTRICT row_in = &in.Row(y)[x - offset];
-      float sum = 0.0f;
-      for (int j = 0; j < len; ++j) {
-        sum += row_in[j] * kernel[j];
-      }
-      row_out[y] = sum * scale_no_border;
+      dispatch::Run(ConvolveRowTransposed(), &in.Row(y)[x - offset],
+                    border2 - x, kernel.data(), len, scale_no_border,
+                    out.PixelsPerRow(), &out.Row(x)[y]);
     }
+    x = border2;
   }
   // right border
   for (; x < in.xsize(); ++x) {
@@ -303,9 +318,8 @@ ImageF BlurredBlueCorrelation(const std::vector<ImageF>& uhf,
       row_yy[x] = yval * yval;
     }
   }
-  const double kSigma = 8.48596332566;
-  ImageF yy_blurred = Blur(yy, kSigma, 0.0);
-  ImageF yb_blurred = Blur(yb, kSigma, 0.0);
+  ImageF yy_blurred = Blur(yy, kSigmaBlueCorrelation, 0.0);
+  ImageF yb_blurred = Blur(yb, kSigmaBlueCorrelation, 0.0);
   for (size_t y = 0; y < ysize; ++y) {
     const float* const BUTTERAUGLI_RESTRICT row_uhf_y = uhf[1].Row(y);
     const float* const BUTTERAUGLI_RESTRICT row_hf_y = hf[1].Row(y);
@@ -383,10 +397,9 @@ std::vector<ImageF> OpsinDynamicsImage(const std::vector<ImageF>& rgb) {
   PROFILER_FUNC;
   std::vector<ImageF> xyb(3);
   std::vector<ImageF> blurred(3);
-  const double kSigma = 1.44316781537;
   for (int i = 0; i < 3; ++i) {
     xyb[i] = ImageF(rgb[i].xsize(), rgb[i].ysize());
-    blurred[i] = Blur(rgb[i], kSigma, 0.0f);
+    blurred[i] = Blur(rgb[i], kSigmaOpsin, 0.0f);
   }
   for (size_t y = 0; y < rgb[0].ysize(); ++y) {
     const float* const BUTTERAUGLI_RESTRICT row_r = rgb[0].Row(y);
@@ -559,7 +572,6 @@ static void SeparateFrequencies(
   ps.uhf.resize(3);
   for (int i = 0; i < 3; ++i) {
     // Extract lf ...
-    static const double kSigmaLf = 7.41525493374;
     ps.lf[i] = DoGBlur(xyb[i], kSigmaLf, 0.0f);
     // ... and keep everything else in mf.
     ps.mf[i] = ImageF(xsize, ysize);
@@ -569,7 +581,6 @@ static void SeparateFrequencies(
       }
     }
     // Divide mf into mf and hf.
-    static const double kSigmaHf = 0.5 * kSigmaLf;
     ps.hf[i] = ImageF(xsize, ysize);
     for (size_t y = 0; y < ysize; ++y) {
       for (size_t x = 0; x < xsize; ++x) {
@@ -583,7 +594,6 @@ static void SeparateFrequencies(
       }
     }
     // Divide hf into hf and uhf.
-    static const double kSigmaUhf = 0.5 * kSigmaHf;
     ps.uhf[i] = ImageF(xsize, ysize);
     for (size_t y = 0; y < ysize; ++y) {
       for (size_t x = 0; x < xsize; ++x) {
@@ -889,11 +899,10 @@ ImageF CalculateDiffmap(const ImageF& diffmap_in) {
     }
   }
   {
-    static const double kSigma = 1.72547472444;
     static const double mul1 = 0.458794906198;
     static const float scale = 1.0f / (1.0f + mul1);
     static const double border_ratio = 1.0; // 2.01209066992;
-    ImageF blurred = Blur(diffmap, kSigma, border_ratio);
+    ImageF blurred = Blur(diffmap, kSigmaDiffmap, border_ratio);
     for (int y = 0; y < diffmap.ysize(); ++y) {
       const float* const BUTTERAUGLI_RESTRICT row_blurred = blurred.Row(y);
       float* const BUTTERAUGLI_RESTRICT row = diffmap.Row(y);
@@ -1024,15 +1033,14 @@ void ButteraugliComparator::DiffmapPsychoImage(const PsychoImage& pi1,
 
 
   static const double maxclamp = 72.6815019479;
-  static const double kSigmaHfX = 10.8163829574;
-  SameNoiseLevelsX(pi0_.hf[1], pi1.hf[1], kSigmaHfX, wmul[10], maxclamp,
-                   &block_diff_ac[1]);
-  SameNoiseLevelsY(pi0_.hf[1], pi1.hf[1], kSigmaHfX, wmul[10], maxclamp,
-                   &block_diff_ac[1]);
-  SameNoiseLevelsYP1(pi0_.hf[1], pi1.hf[1], kSigmaHfX, wmul[10], maxclamp,
-                     &block_diff_ac[1]);
-  SameNoiseLevelsYM1(pi0_.hf[1], pi1.hf[1], kSigmaHfX, wmul[10], maxclamp,
-                     &block_diff_ac[1]);
+  SameNoiseLevelsX(pi0_.hf[1], pi1.hf[1], kSigmaNoiseLevels, wmul[10],
+                   maxclamp, &block_diff_ac[1]);
+  SameNoiseLevelsY(pi0_.hf[1], pi1.hf[1], kSigmaNoiseLevels, wmul[10],
+                   maxclamp, &block_diff_ac[1]);
+  SameNoiseLevelsYP1(pi0_.hf[1], pi1.hf[1], kSigmaNoiseLevels, wmul[10],
+                     maxclamp, &block_diff_ac[1]);
+  SameNoiseLevelsYM1(pi0_.hf[1], pi1.hf[1], kSigmaNoiseLevels, wmul[10],
+                     maxclamp, &block_diff_ac[1]);
 
 
   static const double valn[9] = {
@@ -1467,6 +1475,20 @@ double ButteraugliScoreFromDiffmap(const ImageF& diffmap) {
   return retval;
 }
 
+int DiffmapSupport() {
+  // Each DoGBlur of SeparateFrequencies blurs the remainder of the previous
+  // one, so uhf and hf depend on the sum of their radii.
+  constexpr int kSeparate = KernelRadius(kSigmaOpsin) + DoGRadius(kSigmaLf) +
+                            DoGRadius(kSigmaHf) + DoGRadius(kSigmaUhf);
+  // SameNoiseLevels* and DiffPrecompute also read a neighboring pixel.
+  constexpr int kCompare = MaxRadius(
+      MaxRadius(kMaltaRadius, 1 + KernelRadius(kSigmaNoiseLevels)),
+      MaxRadius(KernelRadius(kSigmaBlueCorrelation),
+                1 + MaxRadius(KernelRadius(kSigmaMask0),
+                              KernelRadius(kSigmaMask1))));
+  return kSeparate + kCompare + KernelRadius(kSigmaDiffmap);
+}
+
 #include <stdio.h>
 
 // ===== Functions used by Mask only =====
@@ -1488,7 +1510,6 @@ static std::array<double, 512> MakeMask(
 }
 
 double MaskX(double delta) {
-  PROFILER_FUNC;
   static const double extmul = 2.52662693217;
   static const double extoff = 2.0577595478;
   static const double offset = 0.342502406734;
@@ -1500,7 +1521,6 @@ double MaskX(double delta) {
 }
 
 double MaskY(double delta) {
-  PROFILER_FUNC;
   static const double extmul = 0.965276993931;
   static const double extoff = -0.613819681771;
   static const double offset = 1.40903146071;
@@ -1512,7 +1532,6 @@ double MaskY(double delta) {
 }
 
 double MaskDcX(double delta) {
-  PROFILER_FUNC;
   static const double extmul = 10.8596436398;
   static const double extoff = 1.58374126704;
   static const double offset = 0.651968473749;
@@ -1524,7 +1543,6 @@ double MaskDcX(double delta) {
 }
 
 double MaskDcY(double delta) {
-  PROFILER_FUNC;
   static const double extmul = 0.00538280872633;
   static const double extoff = 59.04237604;
   static const double offset = 0.0474092064444;
@@ -1596,13 +1614,11 @@ void Mask(const std::vector<ImageF>& xyb0,
     1.0 / (muls[0] + muls[1]),
     1.0 / (muls[2] + muls[3]),
   };
-  static const double r0 = 2.32030744494;
-  static const double r1 = 7.55507439878;
   for (int i = 0; i < 2; ++i) {
     (*mask)[i] = ImageF(xsize, ysize);
     ImageF diff = DiffPrecompute(xyb0[i], xyb1[i]);
-    ImageF blurred1 = Blur(diff, r0, 0.0f);
-    ImageF blurred2 = Blur(diff, r1, 0.0f);
+    ImageF blurred1 = Blur(diff, kSigmaMask0, 0.0f);
+    ImageF blurred2 = Blur(diff, kSigmaMask1, 0.0f);
     for (size_t y = 0; y < ysize; ++y) {
       for (size_t x = 0; x < xsize; ++x) {
         const double val = normalizer[i] * (
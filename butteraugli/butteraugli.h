@@ -464,6 +464,10 @@ void ButteraugliDiffmap(const std::vector<ImageF> &rgb0,
 
 double ButteraugliScoreFromDiffmap(const ImageF& distmap);
 
+// Returns the maximum distance in pixels, along either axis, between a pixel
+// of the diffmap and the input pixels it depends on.
+int DiffmapSupport();
+
 // Generate rgb-representation of the distance between two images.
 void CreateHeatMapImage(const std::vector<float> &distmap,
                         double good_threshold, double bad_threshold,
@@ -15,6 +15,8 @@
 #include "butteraugli_comparator.h"
 
 #include <stddef.h>
+#include <string.h>
+#include <algorithm>
 #include <array>
 #include <memory>
 #include <vector>
@@ -22,6 +24,7 @@
 #include "compiler_specific.h"
 #include "gamma_correct.h"
 #include "opsin_inverse.h"
+#include "profiler.h"
 #include "simd/simd.h"
 #include "status.h"
 
@@ -29,27 +32,43 @@ namespace pik {
 namespace SIMD_NAMESPACE {
 namespace {
 
-// REQUIRES: xsize <= srgb.xsize(), ysize <= srgb.ysize()
+// Converts the pixels [x0, x0 + xsize) x [y0, y0 + ysize).
+// REQUIRES: x0 + xsize <= srgb.xsize(), y0 + ysize <= srgb.ysize()
 std::vector<butteraugli::ImageF> SrgbToLinearRgb(
-    const int xsize, const int ysize,
+    const int x0, const int y0, const int xsize, const int ysize,
     const Image3B& srgb) {
-  PIK_ASSERT(xsize <= srgb.xsize());
-  PIK_ASSERT(ysize <= srgb.ysize());
+  PIK_ASSERT(x0 + xsize <= srgb.xsize());
+  PIK_ASSERT(y0 + ysize <= srgb.ysize());
   const float* lut = Srgb8ToLinearTable();
   std::vector<butteraugli::ImageF> planes =
       butteraugli::CreatePlanes<float>(xsize, ysize, 3);
   for (size_t y = 0; y < ysize; ++y) {
-    auto row_in = srgb.Row(y);
+    auto row_in = srgb.Row(y0 + y);
     for (int c = 0; c < 3; ++c) {
+      const uint8_t* const PIK_RESTRICT row_in_c = row_in[c] + x0;
       float* const PIK_RESTRICT row_out = planes[c].Row(y);
       for (size_t x = 0; x < xsize; ++x) {
-        row_out[x] = lut[row_in[c][x]];
+        row_out[x] = lut[row_in_c[x]];
       }
     }
   }
   return planes;
 }
 
+std::vector<butteraugli::ImageF> CropPlanes(
+    const std::vector<butteraugli::ImageF>& planes,
+    const int x0, const int y0, const int xsize, const int ysize) {
+  std::vector<butteraugli::ImageF> out =
+      butteraugli::CreatePlanes<float>(xsize, ysize, planes.size());
+  for (size_t c = 0; c < planes.size(); ++c) {
+    for (size_t y = 0; y < ysize; ++y) {
+      memcpy(out[c].Row(y), planes[c].Row(y0 + y) + x0,
+             xsize * sizeof(float));
+    }
+  }
+  return out;
+}
+
 // REQUIRES: xsize <= srgb.xsize(), ysize <= srgb.ysize()
 std::vector<butteraugli::ImageF> OpsinToLinearRgb(
     const int xsize, const int ysize,
@@ -98,20 +117,59 @@ Image3F Image3FromButteraugliPlanes(
 ButteraugliComparator::ButteraugliComparator(const Image3B& srgb)
     : xsize_(srgb.xsize()),
       ysize_(srgb.ysize()),
-      comparator_(SIMD_NAMESPACE::SrgbToLinearRgb(xsize_, ysize_, srgb)),
+      rgb0_(SIMD_NAMESPACE::SrgbToLinearRgb(0, 0, xsize_, ysize_, srgb)),
+      comparator_(rgb0_),
       distance_(0.0),
       distmap_(xsize_, ysize_, 0) {}
 
 ButteraugliComparator::ButteraugliComparator(const Image3F& opsin)
     : xsize_(opsin.xsize()),
       ysize_(opsin.ysize()),
-      comparator_(SIMD_NAMESPACE::OpsinToLinearRgb(xsize_, ysize_, opsin)),
+      rgb0_(SIMD_NAMESPACE::OpsinToLinearRgb(xsize_, ysize_, opsin)),
+      comparator_(rgb0_),
       distance_(0.0),
       distmap_(xsize_, ysize_, 0) {}
 
 void ButteraugliComparator::Compare(const Image3B& srgb) {
-  comparator_.Diffmap(SIMD_NAMESPACE::SrgbToLinearRgb(xsize_, ysize_, srgb),
-                      distmap_);
+  PROFILER_ZONE("ButteraugliCompare");
+  comparator_.Diffmap(
+      SIMD_NAMESPACE::SrgbToLinearRgb(0, 0, xsize_, ysize_, srgb), distmap_);
+  distance_ = butteraugli::ButteraugliScoreFromDiffmap(distmap_);
+}
+
+void ButteraugliComparator::CompareRegion(const Image3B& srgb,
+                                          int x0, int y0,
+                                          int xsize, int ysize) {
+  PROFILER_ZONE("ButteraugliCompareRegion");
+  // Distance (in pixels) over which a change of the input influences the
+  // diffmap, and over which the cropped borders influence the window.
+  static const int kSupport = butteraugli::DiffmapSupport();
+  // Diffmap pixels that may have changed.
+  const int dx0 = std::max(0, x0 - kSupport);
+  const int dy0 = std::max(0, y0 - kSupport);
+  const int dx1 = std::min(xsize_, x0 + xsize + kSupport);
+  const int dy1 = std::min(ysize_, y0 + ysize + kSupport);
+  // Input pixels those depend on.
+  const int wx0 = std::max(0, dx0 - kSupport);
+  const int wy0 = std::max(0, dy0 - kSupport);
+  const int wx1 = std::min(xsize_, dx1 + kSupport);
+  const int wy1 = std::min(ysize_, dy1 + kSupport);
+  if (wx1 - wx0 == xsize_ && wy1 - wy0 == ysize_) {
+    Compare(srgb);
+    return;
+  }
+  const int wxsize = wx1 - wx0;
+  const int wysize = wy1 - wy0;
+  butteraugli::ButteraugliComparator comparator(
+      SIMD_NAMESPACE::CropPlanes(rgb0_, wx0, wy0, wxsize, wysize));
+  butteraugli::ImageF distmap;
+  comparator.Diffmap(
+      SIMD_NAMESPACE::SrgbToLinearRgb(wx0, wy0, wxsize, wysize, srgb),
+      distmap);
+  for (int y = dy0; y < dy1; ++y) {
+    memcpy(distmap_.Row(y) + dx0, distmap.Row(y - wy0) + (dx0 - wx0),
+           (dx1 - dx0) * sizeof(float));
+  }
   distance_ = butteraugli::ButteraugliScoreFromDiffmap(distmap_);
 }
 
@@ -29,6 +29,13 @@ class ButteraugliComparator {
 
   void Compare(const Image3B& srgb);
 
+  // Same as Compare(srgb), but assumes srgb only differs from the image of the
+  // previous Compare/CompareRegion call within the pixel rectangle
+  // [x0, x0 + xsize) x [y0, y0 + ysize). Only the part of the distance map
+  // that can depend on that rectangle is recomputed.
+  void CompareRegion(const Image3B& srgb, int x0, int y0, int xsize,
+                     int ysize);
+
   const butteraugli::ImageF& distmap() const { return distmap_; }
   float distance() const { return distance_; }
 
@@ -37,6 +44,8 @@ class ButteraugliComparator {
  private:
   const int xsize_;
   const int ysize_;
+  // Linear RGB planes of the original image, for comparing regions.
+  const std::vector<butteraugli::ImageF> rgb0_;
   butteraugli::ButteraugliComparator comparator_;
   float distance_;
   butteraugli::ImageF distmap_;
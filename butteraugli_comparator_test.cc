@@ -0,0 +1,141 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks that ButteraugliComparator::CompareRegion produces bit-identical
+// distance maps to a full Compare after random sets of 8x8 blocks change,
+// which the encoder's quantization search relies on.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "butteraugli/butteraugli.h"
+#include "butteraugli_comparator.h"
+#include "image.h"
+
+namespace pik {
+namespace {
+
+// Large enough that the window of a single block does not cover the image.
+constexpr int kXSize = 456;
+constexpr int kYSize = 416;
+constexpr int kBlockXSize = kXSize / 8;
+constexpr int kBlockYSize = kYSize / 8;
+
+struct BlockRect {
+  int x0;
+  int y0;
+  int xsize;
+  int ysize;
+};
+
+uint8_t Clamp(const int v) { return std::min(255, std::max(0, v)); }
+
+// Smooth gradients with noise, so that all frequency bands have content.
+Image3B RandomImage(std::mt19937* rng) {
+  std::uniform_int_distribution<int> noise(-12, 12);
+  Image3B img(kXSize, kYSize);
+  for (int y = 0; y < kYSize; ++y) {
+    for (int c = 0; c < 3; ++c) {
+      uint8_t* const PIK_RESTRICT row = img.PlaneRow(c, y);
+      for (int x = 0; x < kXSize; ++x) {
+        const double wave = std::sin(0.05 * (c + 1) * x + 0.03 * y);
+        row[x] = Clamp(128 + 80 * wave + noise(*rng));
+      }
+    }
+  }
+  return img;
+}
+
+// Adds noise of a random strength to the pixels of the block rectangle.
+void DistortBlocks(const BlockRect& r, std::mt19937* rng, Image3B* img) {
+  std::uniform_int_distribution<int> strength(1, 24);
+  const int amplitude = strength(*rng);
+  std::uniform_int_distribution<int> noise(-amplitude, amplitude);
+  for (int y = 8 * r.y0; y < 8 * (r.y0 + r.ysize); ++y) {
+    for (int c = 0; c < 3; ++c) {
+      uint8_t* const PIK_RESTRICT row = img->PlaneRow(c, y);
+      for (int x = 8 * r.x0; x < 8 * (r.x0 + r.xsize); ++x) {
+        row[x] = Clamp(row[x] + noise(*rng));
+      }
+    }
+  }
+}
+
+bool SameDistmaps(const butteraugli::ImageF& expected,
+                  const butteraugli::ImageF& actual, const int iteration) {
+  for (size_t y = 0; y < expected.ysize(); ++y) {
+    const float* const PIK_RESTRICT row_expected = expected.Row(y);
+    const float* const PIK_RESTRICT row_actual = actual.Row(y);
+    for (size_t x = 0; x < expected.xsize(); ++x) {
+      if (memcmp(&row_expected[x], &row_actual[x], sizeof(float)) != 0) {
+        printf("iteration %d: distmap(%zu, %zu) = %.9g, expected %.9g\n",
+               iteration, x, y, row_actual[x], row_expected[x]);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int RunTests() {
+  std::mt19937 rng(65537);
+  const Image3B original = RandomImage(&rng);
+  Image3B srgb = CopyImage3(original);
+  DistortBlocks({0, 0, kBlockXSize, kBlockYSize}, &rng, &srgb);
+
+  ButteraugliComparator incremental(original);
+  ButteraugliComparator full(original);
+  incremental.Compare(srgb);
+
+  std::uniform_int_distribution<int> num_rects(1, 4);
+  std::uniform_int_distribution<int> rect_size(1, 3);
+  for (int iteration = 0; iteration < 16; ++iteration) {
+    // Like the quantization search, change all blocks before comparing the
+    // (possibly overlapping) regions.
+    std::vector<BlockRect> rects(num_rects(rng));
+    for (BlockRect& r : rects) {
+      r.xsize = rect_size(rng);
+      r.ysize = rect_size(rng);
+      r.x0 = std::uniform_int_distribution<int>(0, kBlockXSize - r.xsize)(rng);
+      r.y0 = std::uniform_int_distribution<int>(0, kBlockYSize - r.ysize)(rng);
+      DistortBlocks(r, &rng, &srgb);
+    }
+    for (const BlockRect& r : rects) {
+      incremental.CompareRegion(srgb, 8 * r.x0, 8 * r.y0, 8 * r.xsize,
+                                8 * r.ysize);
+    }
+    full.Compare(srgb);
+    if (!SameDistmaps(full.distmap(), incremental.distmap(), iteration)) {
+      return 1;
+    }
+    if (incremental.distance() != full.distance()) {
+      printf("iteration %d: distance %.9g, expected %.9g\n", iteration,
+             incremental.distance(), full.distance());
+      return 1;
+    }
+  }
+  printf("Successfully compared regions within %d pixels of changes.\n",
+         butteraugli::DiffmapSupport());
+  return 0;
+}
+
+}  // namespace
+}  // namespace pik
+
+int main() { return pik::RunTests(); }
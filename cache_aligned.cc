@@ -0,0 +1,124 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cache_aligned.h"
+
+namespace pik {
+
+thread_local CacheAlignedAllocator* CacheAligned::allocator_ = nullptr;
+
+PoolAllocator::~PoolAllocator() {
+  ReleaseFreeBlocks();
+  for (void* memory : in_use_) {
+    CacheAligned::Detach(memory);
+  }
+}
+
+size_t PoolAllocator::SizeClass(const size_t bytes) {
+  // Multiples of "step" in (4 * step, 8 * step].
+  size_t step = CacheAligned::kCacheLineSize;
+  while (bytes > 8 * step) {
+    step *= 2;
+  }
+  return (bytes + step - 1) & ~(step - 1);
+}
+
+void* PoolAllocator::Allocate(const size_t bytes) {
+  const size_t size_class = SizeClass(bytes);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++num_allocations_;
+  void* memory;
+  std::vector<void*>& free_list = free_[size_class];
+  if (free_list.empty()) {
+    memory = malloc(size_class);
+    if (memory == nullptr) {
+      return nullptr;
+    }
+    bytes_allocated_ += size_class;
+    peak_bytes_allocated_ = std::max(peak_bytes_allocated_, bytes_allocated_);
+  } else {
+    memory = free_list.back();
+    free_list.pop_back();
+    retained_bytes_ -= size_class;
+    ++num_reused_;
+  }
+  in_use_.insert(memory);
+  bytes_in_use_ += size_class;
+  peak_bytes_in_use_ = std::max(peak_bytes_in_use_, bytes_in_use_);
+  return memory;
+}
+
+void PoolAllocator::Free(void* memory, const size_t bytes) {
+  const size_t size_class = SizeClass(bytes);
+  std::lock_guard<std::mutex> lock(mutex_);
+  in_use_.erase(memory);
+  bytes_in_use_ -= size_class;
+  free_[size_class].push_back(memory);
+  retained_bytes_ += size_class;
+}
+
+void PoolAllocator::ReleaseFreeBlocks() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& size_and_list : free_) {
+    for (void* memory : size_and_list.second) {
+      free(memory);
+    }
+    bytes_allocated_ -= size_and_list.first * size_and_list.second.size();
+  }
+  free_.clear();
+  retained_bytes_ = 0;
+}
+
+size_t PoolAllocator::NumAllocations() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_allocations_;
+}
+
+size_t PoolAllocator::NumReused() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_reused_;
+}
+
+size_t PoolAllocator::BytesAllocated() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_allocated_;
+}
+
+size_t PoolAllocator::PeakBytesAllocated() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return peak_bytes_allocated_;
+}
+
+size_t PoolAllocator::RetainedBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return retained_bytes_;
+}
+
+size_t PoolAllocator::BytesInUse() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_in_use_;
+}
+
+size_t PoolAllocator::PeakBytesInUse() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return peak_bytes_in_use_;
+}
+
+size_t PoolAllocator::ResetPeakBytesInUse() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  peak_bytes_in_use_ = bytes_in_use_;
+  return bytes_in_use_;
+}
+
+}  // namespace pik
@@ -21,7 +21,11 @@
 #include <string.h>  // memcpy
 #include <algorithm>
 #include <memory>
+#include <mutex>  // NOLINT
 #include <new>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "arch_specific.h"
 #include "compiler_specific.h"
@@ -30,25 +34,48 @@
 
 namespace pik {
 
+// Source of the memory that CacheAligned::Allocate aligns and hands out, e.g.
+// for the pixels of every Image. Must be thread-safe because the tasks of a
+// ThreadPool allocate concurrently.
+class CacheAlignedAllocator {
+ public:
+  virtual ~CacheAlignedAllocator() {}
+
+  // Returns "bytes" bytes with the alignment of malloc, or nullptr.
+  virtual void* Allocate(size_t bytes) = 0;
+
+  // Releases "memory" returned by Allocate(bytes).
+  virtual void Free(void* memory, size_t bytes) = 0;
+};
+
 // Functions that depend on the cache line size.
 class CacheAligned {
  public:
   static constexpr size_t kPointerSize = sizeof(void*);
   static constexpr size_t kCacheLineSize = 64;
+  // Allocator, size and pointer stored before each allocation.
+  static constexpr size_t kHeaderSize = 3 * kPointerSize;
+
+  // Returns the number of bytes the allocator provides for Allocate(bytes).
+  static size_t AllocatedBytes(const size_t bytes) {
+    return bytes + kCacheLineSize + kHeaderSize;
+  }
 
   static void* Allocate(const size_t bytes) {
     PIK_ASSERT(bytes < 1ULL << 63);
-    char* const allocated = static_cast<char*>(malloc(bytes + kCacheLineSize));
+    CacheAlignedAllocator* const allocator = allocator_;
+    char* const allocated = static_cast<char*>(
+        allocator == nullptr ? malloc(AllocatedBytes(bytes))
+                             : allocator->Allocate(AllocatedBytes(bytes)));
     if (allocated == nullptr) {
       return nullptr;
     }
-    const uintptr_t misalignment =
-        reinterpret_cast<uintptr_t>(allocated) & (kCacheLineSize - 1);
-    // malloc is at least kPointerSize aligned, so we can store the "allocated"
-    // pointer immediately before the aligned memory.
-    PIK_ASSERT(misalignment % kPointerSize == 0);
-    char* const aligned = allocated + kCacheLineSize - misalignment;
+    // The header (the allocator, the size and the "allocated" pointer) is
+    // stored immediately before the aligned memory.
+    char* const aligned = Aligned(allocated);
     memcpy(aligned - kPointerSize, &allocated, kPointerSize);
+    memcpy(aligned - 2 * kPointerSize, &bytes, sizeof(bytes));
+    memcpy(aligned - kHeaderSize, &allocator, kPointerSize);
     return aligned;
   }
 
@@ -62,9 +89,33 @@ class CacheAligned {
     PIK_ASSERT(reinterpret_cast<uintptr_t>(aligned) % kCacheLineSize == 0);
     char* allocated;
     memcpy(&allocated, aligned - kPointerSize, kPointerSize);
-    PIK_ASSERT(allocated <= aligned - kPointerSize);
-    PIK_ASSERT(allocated >= aligned - kCacheLineSize);
-    free(allocated);
+    PIK_ASSERT(allocated <= aligned - kHeaderSize);
+    PIK_ASSERT(allocated >= aligned - kHeaderSize - kCacheLineSize);
+    size_t bytes;
+    memcpy(&bytes, aligned - 2 * kPointerSize, sizeof(bytes));
+    CacheAlignedAllocator* allocator;
+    memcpy(&allocator, aligned - kHeaderSize, kPointerSize);
+    if (allocator == nullptr) {
+      free(allocated);
+    } else {
+      allocator->Free(allocated, AllocatedBytes(bytes));
+    }
+  }
+
+  // Causes the memory "allocated" (returned by an allocator and currently in
+  // use) to be released via free instead of the allocator. Called by
+  // allocators that are destroyed before all their memory has been freed.
+  static void Detach(void* allocated) {
+    const CacheAlignedAllocator* const allocator = nullptr;
+    memcpy(Aligned(static_cast<char*>(allocated)) - kHeaderSize, &allocator,
+           kPointerSize);
+  }
+
+  // Returns the allocator used by Allocate on the current thread; nullptr
+  // means malloc. See ScopedAllocator.
+  static CacheAlignedAllocator* CurrentAllocator() { return allocator_; }
+  static void SetAllocator(CacheAlignedAllocator* allocator) {
+    allocator_ = allocator;
   }
 
   // Overwrites "to_items" without loading it into cache (read-for-ownership).
@@ -72,21 +123,103 @@ class CacheAligned {
   template <typename T>
   static void StreamCacheLine(const T* PIK_RESTRICT from, T* PIK_RESTRICT to) {
     static_assert(16 % sizeof(T) == 0, "T must fit in a lane");
-    const SIMD_NAMESPACE::Part<T, 16 / sizeof(T), SIMD_TARGET> d;
+    // Lanes per 16-byte vector.
+    constexpr size_t N = 16 / sizeof(T);
+    const SIMD_NAMESPACE::Part<T, N, SIMD_TARGET> d;
     PIK_COMPILER_FENCE;
-    const auto v0 = load(d, from + 0);
-    const auto v1 = load(d, from + 1);
-    const auto v2 = load(d, from + 2);
-    const auto v3 = load(d, from + 3);
+    const auto v0 = load(d, from + 0 * N);
+    const auto v1 = load(d, from + 1 * N);
+    const auto v2 = load(d, from + 2 * N);
+    const auto v3 = load(d, from + 3 * N);
     // Fences prevent the compiler from reordering loads/stores, which may
     // interfere with write-combining.
     PIK_COMPILER_FENCE;
-    stream(to + 0, d, v0);
-    stream(to + 1, d, v1);
-    stream(to + 2, d, v2);
-    stream(to + 3, d, v3);
+    stream(v0, d, to + 0 * N);
+    stream(v1, d, to + 1 * N);
+    stream(v2, d, to + 2 * N);
+    stream(v3, d, to + 3 * N);
     PIK_COMPILER_FENCE;
   }
+
+ private:
+  static char* Aligned(char* allocated) {
+    const uintptr_t aligned_address =
+        (reinterpret_cast<uintptr_t>(allocated) + kHeaderSize +
+         kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+    return reinterpret_cast<char*>(aligned_address);
+  }
+
+  static thread_local CacheAlignedAllocator* allocator_;
+};
+
+// Makes Allocate on the current thread use "allocator" until destruction, as
+// well as the tasks it runs on a ThreadPool.
+class ScopedAllocator {
+ public:
+  explicit ScopedAllocator(CacheAlignedAllocator* allocator)
+      : previous_(CacheAligned::CurrentAllocator()) {
+    CacheAligned::SetAllocator(allocator);
+  }
+  ScopedAllocator(const ScopedAllocator&) = delete;
+  ScopedAllocator& operator=(const ScopedAllocator&) = delete;
+  ~ScopedAllocator() { CacheAligned::SetAllocator(previous_); }
+
+ private:
+  CacheAlignedAllocator* const previous_;
+};
+
+// Keeps freed memory in per-size-class free lists and reuses it for later
+// allocations of the same class, which avoids the page faults and malloc
+// overhead of repeatedly allocating large temporary images. Sizes are rounded
+// up to one of four classes per power of two, hence at most 25% is wasted.
+// Memory is only returned to the system by ReleaseFreeBlocks and the
+// destructor; memory still in use at that time (e.g. returned images) is
+// detached and later released via free.
+class PoolAllocator : public CacheAlignedAllocator {
+ public:
+  PoolAllocator() = default;
+  PoolAllocator(const PoolAllocator&) = delete;
+  PoolAllocator& operator=(const PoolAllocator&) = delete;
+  ~PoolAllocator() override;
+
+  void* Allocate(size_t bytes) override;
+  void Free(void* memory, size_t bytes) override;
+
+  // Frees the memory in the free lists.
+  void ReleaseFreeBlocks();
+
+  // Number of calls to Allocate, and how many of them reused freed memory.
+  size_t NumAllocations() const;
+  size_t NumReused() const;
+  // Bytes obtained from malloc that are in use or in the free lists, the
+  // maximum of that since construction, and the bytes in the free lists.
+  size_t BytesAllocated() const;
+  size_t PeakBytesAllocated() const;
+  size_t RetainedBytes() const;
+  // Bytes returned by Allocate (rounded up to the size class) and not yet
+  // freed, and the maximum of that since the last ResetPeakBytesInUse. The
+  // counters only cover this allocator, hence they measure a single encoder
+  // or decoder even if others are running at the same time.
+  size_t BytesInUse() const;
+  size_t PeakBytesInUse() const;
+  // Sets the peak to the current BytesInUse and returns the latter.
+  size_t ResetPeakBytesInUse();
+
+ private:
+  static size_t SizeClass(size_t bytes);
+
+  mutable std::mutex mutex_;
+  // Freed memory, indexed by size class.
+  std::unordered_map<size_t, std::vector<void*>> free_;
+  // Memory currently returned by Allocate and not yet freed.
+  std::unordered_set<void*> in_use_;
+  size_t num_allocations_ = 0;
+  size_t num_reused_ = 0;
+  size_t bytes_allocated_ = 0;
+  size_t peak_bytes_allocated_ = 0;
+  size_t retained_bytes_ = 0;
+  size_t bytes_in_use_ = 0;
+  size_t peak_bytes_in_use_ = 0;
 };
 
 template <typename T>
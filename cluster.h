@@ -30,6 +30,7 @@
 #include <vector>
 
 #include "fast_log.h"
+#include "profiler.h"
 
 namespace pik {
 
@@ -274,6 +275,7 @@ void ClusterHistograms(const std::vector<HistogramType>& in,
                        int max_histograms,
                        std::vector<HistogramType>* out,
                        std::vector<uint32_t>* histogram_symbols) {
+  PROFILER_FUNC;
   const int in_size = num_contexts * num_blocks;
   std::vector<int> cluster_size(in_size, 1);
   std::vector<float> bit_cost(in_size);
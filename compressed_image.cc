@@ -23,10 +23,14 @@
 #include "bit_reader.h"
 #include "compiler_specific.h"
 #include "dc_predictor.h"
+#include "dct.h"
+#include "dct_target.h"
 #include "dct_util.h"
 #include "gauss_blur.h"
 #include "opsin_codec.h"
 #include "opsin_params.h"
+#include "profiler.h"
+#include "simd/dispatch.h"
 #include "status.h"
 
 namespace pik {
@@ -40,19 +44,138 @@ int DivCeil(int a, int b) {
   return (a + b - 1) / b;
 }
 
+// Computes the coefficients 1, 8 and 9 of each block that are predicted from
+// the DC image.
+void Compute2x2ACFromDC(const Image3F& dc, Image3F* ac01, Image3F* ac10,
+                        Image3F* ac11) {
+  constexpr float kWeight0 = 0.027630534023046f;
+  constexpr float kWeight1 = 0.133676439523697f;
+  constexpr float kWeight2 = 0.035697385668755f;
+  constexpr float kKernel0[3] = { 1.0f, 0.0f, -1.0f };
+  constexpr float kKernel1[3] = { kWeight0, kWeight1, kWeight0 };
+  constexpr float kKernel2[3] = { kWeight2, 0.0f, -kWeight2 };
+  const std::vector<float> kernel0(kKernel0, kKernel0 + 3);
+  const std::vector<float> kernel1(kKernel1, kKernel1 + 3);
+  const std::vector<float> kernel2(kKernel2, kKernel2 + 3);
+  Image3F tmp0 = ConvolveXSampleAndTranspose(dc, kernel0, 1);
+  Image3F tmp1 = ConvolveXSampleAndTranspose(dc, kernel1, 1);
+  *ac01 = ConvolveXSampleAndTranspose(tmp1, kernel0, 1);
+  *ac10 = ConvolveXSampleAndTranspose(tmp0, kernel1, 1);
+  *ac11 = ConvolveXSampleAndTranspose(tmp0, kernel2, 1);
+}
+
+// Returns rows [y0, y0 + ysize) of "coeffs".
+template <typename T>
+Image3<T> CopyBlockRows(const Image3<T>& coeffs, const int y0,
+                        const int ysize) {
+  Image3<T> rows(coeffs.xsize(), ysize);
+  for (int c = 0; c < 3; ++c) {
+    for (int y = 0; y < ysize; ++y) {
+      memcpy(rows.PlaneRow(c, y), coeffs.ConstPlaneRow(c, y0 + y),
+             coeffs.xsize() * sizeof(coeffs.ConstPlaneRow(c, 0)[0]));
+    }
+  }
+  return rows;
+}
+
+// Inverse of CopyBlockRows.
+void PasteBlockRows(const QuantizedCoeffs& rows, const int y0,
+                    QuantizedCoeffs* coeffs) {
+  for (int c = 0; c < 3; ++c) {
+    for (int y = 0; y < rows.ysize(); ++y) {
+      memcpy(coeffs->PlaneRow(c, y0 + y), rows.ConstPlaneRow(c, y),
+             rows.xsize() * sizeof(rows.ConstPlaneRow(c, 0)[0]));
+    }
+  }
+}
+
+// Reads the data written by EncodeQuantizerAndDC. The (still predicted) DC
+// coefficients are stored "stride" apart in the rows of "coeffs", which must
+// be "stride" times the number of blocks per row wide.
+bool DecodeQuantizerAndDC(BitReader* br, const int stride, int* ytob,
+                          Quantizer* quantizer, Image3W* coeffs) {
+  *ytob = br->ReadBits(8);
+  if (!quantizer->Decode(br)) {
+    return PIK_FAILURE("quantizer Decode failed.");
+  }
+  if (!DecodeImage(br, stride, coeffs)) {
+    return PIK_FAILURE("DecodeImage failed.");
+  }
+  return true;
+}
+
+// Decodes the AC coefficients of all tile groups; the first group starts at
+// data + pos.
+bool DecodeTileGroups(const uint8_t* data, const size_t data_size,
+                      size_t pos, const TileGroups& tiles, const int ac_by0,
+                      const int ac_by1, ThreadPool* pool,
+                      QuantizedCoeffs* qcoeffs, size_t* compressed_size) {
+  if (tiles.block_rows == 0) {
+    return PIK_FAILURE("Invalid tile group size.");
+  }
+  const int block_rows = std::min<uint32_t>(tiles.block_rows,
+                                            qcoeffs->ysize());
+  const int num_groups = DivCeil(qcoeffs->ysize(), block_rows);
+  if (tiles.sizes.size() != num_groups) {
+    return PIK_FAILURE("Invalid number of tile groups.");
+  }
+  std::vector<size_t> offsets(num_groups);
+  for (int i = 0; i < num_groups; ++i) {
+    if (tiles.sizes[i] == 0 || tiles.sizes[i] % 4 != 0) {
+      return PIK_FAILURE("Invalid tile group size.");
+    }
+    offsets[i] = pos;
+    pos += tiles.sizes[i];
+    if (pos > data_size) {
+      return PIK_FAILURE("Truncated tile group.");
+    }
+  }
+  // Groups outside [ac_by0, ac_by1) are skipped. Clamping first prevents
+  // DivCeil from overflowing for the default ac_by1 = INT_MAX.
+  const int by0 = std::max(0, ac_by0);
+  const int by1 = std::min<int>(ac_by1, qcoeffs->ysize());
+  const int first_group = by0 / block_rows;
+  const int end_group = std::max(first_group, DivCeil(by1, block_rows));
+  // Not vector<bool> because tasks write their flags concurrently.
+  std::vector<uint8_t> ok(num_groups, 1);
+  RunOnPool(pool, first_group, end_group, [&](const int group,
+                                               const int thread) {
+    const int y0 = group * block_rows;
+    const int ysize = std::min<int>(block_rows, qcoeffs->ysize() - y0);
+    // Contains the DC, which DecodeAC leaves unchanged.
+    QuantizedCoeffs rows = CopyBlockRows(*qcoeffs, y0, ysize);
+    BitReader br(data + offsets[group], tiles.sizes[group]);
+    ok[group] = DecodeAC(&br, &rows) && br.Position() == tiles.sizes[group];
+    PasteBlockRows(rows, y0, qcoeffs);
+  });
+  for (int i = 0; i < num_groups; ++i) {
+    if (!ok[i]) {
+      return PIK_FAILURE("DecodeAC failed.");
+    }
+  }
+  *compressed_size = pos;
+  return true;
+}
+
 }  // namespace
 
 Image3F AlignImage(const Image3F& in, const size_t N) {
+  Image3F out;
+  AlignImage(in, N, &out);
+  return out;
+}
+
+void AlignImage(const Image3F& in, const size_t N, Image3F* out) {
   const size_t block_xsize = DivCeil(in.xsize(), N);
   const size_t block_ysize = DivCeil(in.ysize(), N);
   const size_t xsize = N * block_xsize;
   const size_t ysize = N * block_ysize;
-  Image3F out(xsize, ysize);
+  EnsureSize(xsize, ysize, out);
   int y = 0;
   for (; y < in.ysize(); ++y) {
     for (int c = 0; c < 3; ++c) {
       const float* const PIK_RESTRICT row_in = &in.Row(y)[c][0];
-      float* const PIK_RESTRICT row_out = &out.Row(y)[c][0];
+      float* const PIK_RESTRICT row_out = &out->Row(y)[c][0];
       memcpy(row_out, row_in, in.xsize() * sizeof(row_in[0]));
       const int lastcol = in.xsize() - 1;
       const float lastval = row_out[lastcol];
@@ -64,12 +187,11 @@ Image3F AlignImage(const Image3F& in, const size_t N) {
   const int lastrow = in.ysize() - 1;
   for (; y < ysize; ++y) {
     for (int c = 0; c < 3; ++c) {
-      const float* const PIK_RESTRICT row_in = out.ConstPlaneRow(c, lastrow);
-      float* const PIK_RESTRICT row_out = out.PlaneRow(c, y);
+      const float* const PIK_RESTRICT row_in = out->ConstPlaneRow(c, lastrow);
+      float* const PIK_RESTRICT row_out = out->PlaneRow(c, y);
       memcpy(row_out, row_in, xsize * sizeof(row_out[0]));
     }
   }
-  return out;
 }
 
 void CenterOpsinValues(Image3F* img) {
@@ -94,20 +216,8 @@ void YToBTransform(const float factor, Image3F* opsin) {
 
 void Adjust2x2ACFromDC(const Image3F& dc, const int direction,
                        Image3F* coeffs) {
-  constexpr float kWeight0 = 0.027630534023046f;
-  constexpr float kWeight1 = 0.133676439523697f;
-  constexpr float kWeight2 = 0.035697385668755f;
-  constexpr float kKernel0[3] = { 1.0f, 0.0f, -1.0f };
-  constexpr float kKernel1[3] = { kWeight0, kWeight1, kWeight0 };
-  constexpr float kKernel2[3] = { kWeight2, 0.0f, -kWeight2 };
-  const std::vector<float> kernel0(kKernel0, kKernel0 + 3);
-  const std::vector<float> kernel1(kKernel1, kKernel1 + 3);
-  const std::vector<float> kernel2(kKernel2, kKernel2 + 3);
-  Image3F tmp0 = ConvolveXSampleAndTranspose(dc, kernel0, 1);
-  Image3F tmp1 = ConvolveXSampleAndTranspose(dc, kernel1, 1);
-  Image3F ac01 = ConvolveXSampleAndTranspose(tmp1, kernel0, 1);
-  Image3F ac10 = ConvolveXSampleAndTranspose(tmp0, kernel1, 1);
-  Image3F ac11 = ConvolveXSampleAndTranspose(tmp0, kernel2, 1);
+  Image3F ac01, ac10, ac11;
+  Compute2x2ACFromDC(dc, &ac01, &ac10, &ac11);
   for (int by = 0; by < dc.ysize(); ++by) {
     auto row01 = ac01.ConstRow(by);
     auto row10 = ac10.ConstRow(by);
@@ -123,75 +233,393 @@ void Adjust2x2ACFromDC(const Image3F& dc, const int direction,
   }
 }
 
-QuantizedCoeffs ComputeCoefficients(const Image3F& opsin,
-                                    const Quantizer& quantizer) {
-  Image3F coeffs = TransposedScaledDCT(opsin);
-  QuantizedCoeffs qcoeffs = QuantizeCoeffs(coeffs, quantizer);
-  Image3F dcoeffs = DequantizeCoeffs(qcoeffs, quantizer);
-  Adjust2x2ACFromDC(DCImage(dcoeffs), -1, &coeffs);
-  qcoeffs = QuantizeCoeffs(coeffs, quantizer);
-  dcoeffs = DequantizeCoeffs(qcoeffs, quantizer);
+namespace {
+
+// Runs the quantization-dependent part of ComputeCoefficients on the output of
+// TransposedScaledDCT, which is modified in-place.
+QuantizedCoeffs QuantizeWithPrediction(const Quantizer& quantizer,
+                                       ThreadPool* pool, Image3F* coeffs) {
+  PROFILER_FUNC;
+  QuantizedCoeffs qcoeffs = QuantizeCoeffs(*coeffs, quantizer, pool);
+  Image3F dcoeffs = DequantizeCoeffs(qcoeffs, quantizer, pool);
+  Adjust2x2ACFromDC(DCImage(dcoeffs), -1, coeffs);
+  qcoeffs = QuantizeCoeffs(*coeffs, quantizer, pool);
+  dcoeffs = DequantizeCoeffs(qcoeffs, quantizer, pool);
   Adjust2x2ACFromDC(DCImage(dcoeffs), 1, &dcoeffs);
   Image3F pred = GetPixelSpaceImageFrom2x2Corners(dcoeffs);
   pred = UpSample4x4BlurDCT(pred, 1.5f);
-  SubtractFrom(pred, &coeffs);
-  return QuantizeCoeffs(coeffs, quantizer);
+  SubtractFrom(pred, coeffs);
+  return QuantizeCoeffs(*coeffs, quantizer, pool);
 }
 
-std::string EncodeToBitstream(const QuantizedCoeffs& qcoeffs,
-                              const Quantizer& quantizer,
-                              int ytob,
-                              bool fast_mode,
-                              PikInfo* info) {
+}  // namespace
+
+EncoderSearchState::EncoderSearchState(const Image3F& opsin,
+                                       ThreadPool* pool)
+    : EncoderSearchState(opsin, pool, &own_coeffs_) {}
+
+EncoderSearchState::EncoderSearchState(const Image3F& opsin,
+                                       ThreadPool* pool, Image3F* coeffs)
+    : coeffs_(*coeffs), pool_(pool) {
+  TransposedScaledDCT(opsin, pool, coeffs);
+}
+
+QuantizedCoeffs EncoderSearchState::ComputeCoefficients(
+    const Quantizer& quantizer) const {
+  Image3F coeffs = CopyImage3(coeffs_);
+  return QuantizeWithPrediction(quantizer, pool_, &coeffs);
+}
+
+QuantizedCoeffs EncoderSearchState::ComputeCoefficients(
+    const Quantizer& quantizer, const float ytob_factor) const {
+  Image3F coeffs = CopyImage3(coeffs_);
+  YToBTransform(ytob_factor, &coeffs);
+  return QuantizeWithPrediction(quantizer, pool_, &coeffs);
+}
+
+void EncoderSearchState::ApplyYToB(const float ytob_factor) {
+  YToBTransform(ytob_factor, &coeffs_);
+}
+
+Image3F EncoderSearchState::ReconOpsinImageCrop(const Quantizer& quantizer,
+                                                int bx0, int by0,
+                                                int bxsize, int bysize) const {
+  // Each block of the reconstruction depends on the coefficients of blocks at
+  // most two blocks away (2x2 AC adjustment and the 4x4 upsampling blur, once
+  // in the encoder and once in the decoder). The extra block ensures the
+  // mirrored borders of the crop do not reach the requested blocks.
+  static const int kHalo = 4;
+  const int x0 = std::max(0, bx0 - kHalo);
+  const int y0 = std::max(0, by0 - kHalo);
+  const int x1 = std::min<int>(block_xsize(), bx0 + bxsize + kHalo);
+  const int y1 = std::min<int>(block_ysize(), by0 + bysize + kHalo);
+  const Quantizer crop_quantizer = quantizer.Crop(x0, y0, x1 - x0, y1 - y0);
+  Image3F coeffs((x1 - x0) * kBlockSize, y1 - y0);
+  for (int by = y0; by < y1; ++by) {
+    for (int c = 0; c < 3; ++c) {
+      memcpy(coeffs.PlaneRow(c, by - y0),
+             &coeffs_.ConstPlaneRow(c, by)[x0 * kBlockSize],
+             coeffs.xsize() * sizeof(float));
+    }
+  }
+  const QuantizedCoeffs qcoeffs =
+      QuantizeWithPrediction(crop_quantizer, pool_, &coeffs);
+  const Image3F recon = ReconOpsinImage(qcoeffs, crop_quantizer, pool_);
+  Image3F out(bxsize * kBlockEdge, bysize * kBlockEdge);
+  const int xoff = (bx0 - x0) * kBlockEdge;
+  const int yoff = (by0 - y0) * kBlockEdge;
+  for (int y = 0; y < out.ysize(); ++y) {
+    for (int c = 0; c < 3; ++c) {
+      memcpy(out.PlaneRow(c, y), &recon.ConstPlaneRow(c, yoff + y)[xoff],
+             out.xsize() * sizeof(float));
+    }
+  }
+  return out;
+}
+
+QuantizedCoeffs ComputeCoefficients(const Image3F& opsin,
+                                    const Quantizer& quantizer,
+                                    ThreadPool* pool) {
+  return EncoderSearchState(opsin, pool).ComputeCoefficients(quantizer);
+}
+
+namespace {
+
+// Returns the part of the bitstream preceding the AC coefficients; "dc_code"
+// is the encoded output of PredictDC.
+std::string EncodeQuantizerAndDC(const std::string& dc_code,
+                                 const Quantizer& quantizer, int ytob,
+                                 PikInfo* info) {
   PIK_CHECK(ytob >= 0);
   PIK_CHECK(ytob < 256);
   std::string ytob_code = std::string(1, ytob);
   PikImageSizeInfo* quant_info = info ? &info->layers[0] : nullptr;
+  std::string quant_code = quantizer.Encode(quant_info);
+  return ytob_code + quant_code + dc_code;
+}
+
+std::string EncodeTileGroup(const QuantizedCoeffs& rows, bool fast_mode,
+                            PikInfo* info) {
+  PikImageSizeInfo* ac_info = info ? &info->layers[2] : nullptr;
+  // Each group starts at a multiple of four bytes, as required by BitReader.
+  return PadTo4Bytes(fast_mode ?
+                     EncodeACFast(rows, ac_info) :
+                     EncodeAC(rows, ac_info));
+}
+
+}  // namespace
+
+std::string EncodeToBitstream(const QuantizedCoeffs& qcoeffs,
+                              const Quantizer& quantizer,
+                              int ytob,
+                              bool fast_mode,
+                              PikInfo* info,
+                              TileGroups* tiles) {
+  PROFILER_FUNC;
   PikImageSizeInfo* dc_info = info ? &info->layers[1] : nullptr;
   PikImageSizeInfo* ac_info = info ? &info->layers[2] : nullptr;
-  std::string quant_code = quantizer.Encode(quant_info);
   std::string dc_code = EncodeImage(PredictDC(qcoeffs), 1, dc_info);
-  std::string ac_code = fast_mode ?
-      EncodeACFast(qcoeffs, ac_info) :
-      EncodeAC(qcoeffs, ac_info);
-  return PadTo4Bytes(ytob_code + quant_code + dc_code + ac_code);
+  std::string output = EncodeQuantizerAndDC(dc_code, quantizer, ytob, info);
+  if (tiles == nullptr) {
+    std::string ac_code = fast_mode ?
+        EncodeACFast(qcoeffs, ac_info) :
+        EncodeAC(qcoeffs, ac_info);
+    return PadTo4Bytes(output + ac_code);
+  }
+  PIK_CHECK(tiles->block_rows > 0);
+  output = PadTo4Bytes(output);
+  tiles->sizes.clear();
+  for (int y0 = 0; y0 < qcoeffs.ysize(); y0 += tiles->block_rows) {
+    const int ysize = std::min<int>(tiles->block_rows, qcoeffs.ysize() - y0);
+    std::string ac_code =
+        EncodeTileGroup(CopyBlockRows(qcoeffs, y0, ysize), fast_mode, info);
+    tiles->sizes.push_back(ac_code.size());
+    output += ac_code;
+  }
+  return output;
+}
+
+TileGroupEncoder::TileGroupEncoder(const Quantizer& quantizer, int ytob,
+                                   bool fast_mode, int block_rows,
+                                   ThreadPool* pool)
+    : quantizer_(quantizer), ytob_(ytob), fast_mode_(fast_mode),
+      block_rows_(block_rows), pool_(pool),
+      dc_(quantizer.quant_img_ac().xsize(), quantizer.quant_img_ac().ysize()) {
+  PIK_CHECK(block_rows > 0);
+}
+
+void TileGroupEncoder::NextGroupRows(int* y0, int* y1) const {
+  PIK_CHECK(!Done());
+  *y0 = std::max(0, next_y_ - kHalo);
+  *y1 = std::min<int>(dc_.ysize(), next_y_ + block_rows_ + kHalo);
+}
+
+void TileGroupEncoder::AddNextGroup(const Image3F& opsin, PikInfo* info) {
+  PROFILER_FUNC;
+  int y0, y1;
+  NextGroupRows(&y0, &y1);
+  PIK_CHECK(opsin.xsize() == dc_.xsize() * kBlockEdge);
+  PIK_CHECK(opsin.ysize() == (y1 - y0) * kBlockEdge);
+  const QuantizedCoeffs qcoeffs = ComputeCoefficients(
+      opsin, quantizer_.Crop(0, y0, dc_.xsize(), y1 - y0), pool_);
+  const int ysize = std::min<int>(block_rows_, dc_.ysize() - next_y_);
+  const QuantizedCoeffs rows = CopyBlockRows(qcoeffs, next_y_ - y0, ysize);
+  for (int y = 0; y < ysize; ++y) {
+    for (int c = 0; c < 3; ++c) {
+      const int16_t* const PIK_RESTRICT row_in = rows.ConstPlaneRow(c, y);
+      int16_t* const PIK_RESTRICT row_dc = dc_.PlaneRow(c, next_y_ + y);
+      for (int bx = 0; bx < dc_.xsize(); ++bx) {
+        row_dc[bx] = row_in[bx * kBlockSize];
+      }
+    }
+  }
+  std::string ac_code = EncodeTileGroup(rows, fast_mode_, info);
+  group_sizes_.push_back(ac_code.size());
+  ac_code_ += ac_code;
+  next_y_ += ysize;
+}
+
+std::string TileGroupEncoder::Finish(PikInfo* info, TileGroups* tiles) {
+  PROFILER_FUNC;
+  PIK_CHECK(Done());
+  PikImageSizeInfo* dc_info = info ? &info->layers[1] : nullptr;
+  std::string dc_code = EncodeImage(PredictDC(dc_, 1), 1, dc_info);
+  tiles->block_rows = block_rows_;
+  tiles->sizes = group_sizes_;
+  return PadTo4Bytes(EncodeQuantizerAndDC(dc_code, quantizer_, ytob_, info)) +
+      ac_code_;
+}
+
+size_t EstimateEncodedSize(const QuantizedCoeffs& qcoeffs,
+                           const Quantizer& quantizer) {
+  return 1 + quantizer.EncodedSize() +
+      EncodedImageSize(PredictDC(qcoeffs), 1) + EncodedACSize(qcoeffs);
 }
 
 bool DecodeFromBitstream(const uint8_t* data, const size_t data_size,
                          const size_t xsize, const size_t ysize,
+                         const TileGroups* tiles,
+                         ThreadPool* pool,
                          int* ytob,
                          Quantizer* quantizer,
                          QuantizedCoeffs* qcoeffs,
-                         size_t* compressed_size) {
+                         size_t* compressed_size,
+                         const int ac_by0, const int ac_by1) {
+  PROFILER_FUNC;
   if (data_size == 0) {
     return PIK_FAILURE("Empty compressed data.");
   }
-  *qcoeffs = Image3W(DivCeil(xsize, kBlockEdge) * kBlockSize,
-                     DivCeil(ysize, kBlockEdge));
+  // All coefficients (except the AC of skipped tile groups) are overwritten,
+  // hence the storage can be reused.
+  EnsureSize(DivCeil(xsize, kBlockEdge) * kBlockSize,
+             DivCeil(ysize, kBlockEdge), qcoeffs);
   BitReader br(data, data_size & ~3);
-  *ytob = br.ReadBits(8);
-  if (!quantizer->Decode(&br)) {
-    return PIK_FAILURE("quantizer Decode failed.");
+  if (!DecodeQuantizerAndDC(&br, kBlockSize, ytob, quantizer, qcoeffs)) {
+    return false;
   }
-  if (!DecodeImage(&br, kBlockSize, qcoeffs)) {
-    return PIK_FAILURE("DecodeImage failed.");
+  if (tiles == nullptr) {
+    if (!DecodeAC(&br, qcoeffs)) {
+      return PIK_FAILURE("DecodeAC failed.");
+    }
+    *compressed_size = br.Position();
+  } else if (!DecodeTileGroups(data, data_size & ~3, br.Position(), *tiles,
+                               ac_by0, ac_by1, pool, qcoeffs,
+                               compressed_size)) {
+    return false;
   }
-  if (!DecodeAC(&br, qcoeffs)) {
-    return PIK_FAILURE("DecodeAC failed.");
+  UnpredictDC(qcoeffs);
+  return true;
+}
+
+bool DecodeDCFromBitstream(const uint8_t* data, const size_t data_size,
+                           const size_t xsize, const size_t ysize,
+                           int* ytob, Quantizer* quantizer, Image3W* dc,
+                           size_t* compressed_size) {
+  if (data_size == 0) {
+    return PIK_FAILURE("Empty compressed data.");
+  }
+  *dc = Image3W(DivCeil(xsize, kBlockEdge), DivCeil(ysize, kBlockEdge));
+  BitReader br(data, data_size & ~3);
+  if (!DecodeQuantizerAndDC(&br, 1, ytob, quantizer, dc)) {
+    return false;
   }
   *compressed_size = br.Position();
-  UnpredictDC(qcoeffs);
+  UnpredictDC(dc, 1);
   return true;
 }
 
+Image3F ReconOpsinDCImage(const Image3W& dc, const Quantizer& quantizer) {
+  Image3F out(dc.xsize(), dc.ysize());
+  for (int by = 0; by < dc.ysize(); ++by) {
+    auto row_in = dc.ConstRow(by);
+    auto row_out = out.Row(by);
+    for (int bx = 0; bx < dc.xsize(); ++bx) {
+      for (int c = 0; c < 3; ++c) {
+        row_out[c][bx] = quantizer.DequantizeCoeff(bx, by, c, 0,
+                                                   row_in[c][bx]);
+      }
+    }
+  }
+  return out;
+}
+
+QuantizedCoeffs CopyBlocks(const QuantizedCoeffs& qcoeffs, const int bx0,
+                           const int by0, const int bxsize, const int bysize) {
+  QuantizedCoeffs out(bxsize * kBlockSize, bysize);
+  for (int by = 0; by < bysize; ++by) {
+    for (int c = 0; c < 3; ++c) {
+      memcpy(out.PlaneRow(c, by),
+             &qcoeffs.ConstPlaneRow(c, by0 + by)[bx0 * kBlockSize],
+             out.xsize() * sizeof(out.PlaneRow(c, 0)[0]));
+    }
+  }
+  return out;
+}
+
 Image3F ReconOpsinImage(const QuantizedCoeffs& qcoeffs,
-                        const Quantizer& quantizer) {
-  Image3F dcoeffs = DequantizeCoeffs(qcoeffs, quantizer);
+                        const Quantizer& quantizer,
+                        ThreadPool* pool) {
+  Image3F dcoeffs = DequantizeCoeffs(qcoeffs, quantizer, pool);
   Adjust2x2ACFromDC(DCImage(dcoeffs), 1, &dcoeffs);
   Image3F pred = GetPixelSpaceImageFrom2x2Corners(dcoeffs);
   pred = UpSample4x4BlurDCT(pred, 1.5f);
   AddTo(pred, &dcoeffs);
-  return TransposedScaledIDCT(dcoeffs);
+  return TransposedScaledIDCT(dcoeffs, pool);
+}
+
+OpsinReconstructor::OpsinReconstructor(const QuantizedCoeffs& qcoeffs,
+                                       const Quantizer& quantizer,
+                                       const int downsampling)
+    : qcoeffs_(qcoeffs),
+      quantizer_(quantizer),
+      block_dim_(kBlockEdge / downsampling) {
+  PROFILER_ZONE("OpsinReconstructor");
+  PIK_CHECK(downsampling == 1 || downsampling == 2 || downsampling == 4);
+  const int block_xsize = qcoeffs.xsize() / kBlockSize;
+  const int block_ysize = qcoeffs.ysize();
+  Image3F dc(block_xsize, block_ysize);
+  for (int by = 0; by < block_ysize; ++by) {
+    auto row_in = qcoeffs.ConstRow(by);
+    auto row_out = dc.Row(by);
+    for (int bx = 0; bx < block_xsize; ++bx) {
+      for (int c = 0; c < 3; ++c) {
+        row_out[c][bx] = quantizer.DequantizeCoeff(
+            bx, by, c, 0, row_in[c][bx * kBlockSize]);
+      }
+    }
+  }
+  Compute2x2ACFromDC(dc, &ac01_, &ac10_, &ac11_);
+  // The input of UpSample4x4BlurDCT, see ReconOpsinImage.
+  pixel_dc_ = Image3F(block_xsize * 2, block_ysize * 2);
+  for (int by = 0; by < block_ysize; ++by) {
+    auto row_in = qcoeffs.ConstRow(by);
+    auto row_dc = dc.ConstRow(by);
+    auto row01 = ac01_.ConstRow(by);
+    auto row10 = ac10_.ConstRow(by);
+    auto row11 = ac11_.ConstRow(by);
+    auto row_out0 = pixel_dc_.Row(2 * by + 0);
+    auto row_out1 = pixel_dc_.Row(2 * by + 1);
+    for (int bx = 0; bx < block_xsize; ++bx) {
+      for (int c = 0; c < 3; ++c) {
+        const int16_t* PIK_RESTRICT block = &row_in[c][bx * kBlockSize];
+        float pixels[4];
+        PixelSpaceFrom2x2Corners(
+            row_dc[c][bx],
+            quantizer.DequantizeCoeff(bx, by, c, 1, block[1]) + row01[c][bx],
+            quantizer.DequantizeCoeff(bx, by, c, 8, block[8]) + row10[c][bx],
+            quantizer.DequantizeCoeff(bx, by, c, 9, block[9]) + row11[c][bx],
+            pixels);
+        row_out0[c][2 * bx + 0] = pixels[0];
+        row_out0[c][2 * bx + 1] = pixels[1];
+        row_out1[c][2 * bx + 0] = pixels[2];
+        row_out1[c][2 * bx + 1] = pixels[3];
+      }
+    }
+  }
+}
+
+void OpsinReconstructor::BlockRow(const int by,
+                                  UpSample4x4BlurDCTRows* upsample,
+                                  ImageF* blocks, Image3F* rows) const {
+  PROFILER_ZONE("ReconstructBlockRow");
+  upsample->SetBlockRow(by);
+  const int bxs = block_xsize();
+  auto row_in = qcoeffs_.ConstRow(by);
+  auto row01 = ac01_.ConstRow(by);
+  auto row10 = ac10_.ConstRow(by);
+  auto row11 = ac11_.ConstRow(by);
+  float* PIK_RESTRICT coeffs = blocks->Row(0);
+  float* PIK_RESTRICT pred = blocks->Row(1);
+  // The kernels process the whole block row, so that they are dispatched
+  // once per row and channel rather than once per block.
+  for (int c = 0; c < 3; ++c) {
+    quantizer_.DequantizeBlocks(0, by, c, bxs, row_in[c], coeffs);
+    upsample->BlockRow(c, pred);
+    for (int bx = 0; bx < bxs; ++bx) {
+      float* PIK_RESTRICT block = &coeffs[bx * kBlockSize];
+      const float* PIK_RESTRICT block_pred = &pred[bx * kBlockSize];
+      block[1] += row01[c][bx];
+      block[8] += row10[c][bx];
+      block[9] += row11[c][bx];
+      for (int k = 0; k < kBlockSize; ++k) {
+        block[k] += block_pred[k];
+      }
+    }
+    if (block_dim_ == kBlockEdge) {
+      dispatch::Run(TransposedScaledIDCTBlocks(), coeffs, bxs,
+                    rows->plane(c).PixelsPerRow(), rows->PlaneRow(c, 0));
+      continue;
+    }
+    for (int bx = 0; bx < bxs; ++bx) {
+      // The prediction is no longer needed.
+      ComputeTransposedScaledBlockIDCTFloatReduced(&coeffs[bx * kBlockSize],
+                                                   block_dim_, pred);
+      for (int iy = 0; iy < block_dim_; ++iy) {
+        memcpy(&rows->PlaneRow(c, iy)[bx * block_dim_],
+               &pred[iy * block_dim_], block_dim_ * sizeof(pred[0]));
+      }
+    }
+  }
 }
 
 }  // namespace pik
@@ -17,15 +17,22 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <limits>
 #include <string>
+#include <vector>
 
+#include "dct_util.h"
+#include "header.h"
 #include "image.h"
 #include "pik_info.h"
 #include "quantizer.h"
+#include "thread_pool.h"
 
 namespace pik {
 
 Image3F AlignImage(const Image3F& in, const size_t N);
+// Same, but reuses the storage of "*out" if it already has the aligned size.
+void AlignImage(const Image3F& in, const size_t N, Image3F* out);
 
 void CenterOpsinValues(Image3F* img);
 
@@ -34,23 +41,228 @@ void YToBTransform(const float factor, Image3F* opsin);
 typedef Image3W QuantizedCoeffs;
 
 QuantizedCoeffs ComputeCoefficients(const Image3F& opsin,
-                                    const Quantizer& quantizer);
+                                    const Quantizer& quantizer,
+                                    ThreadPool* pool = nullptr);
 
+// Quantization-independent encoder state. The forward DCT of the opsin image
+// only depends on the (aligned, centered and YToB-transformed) input, so the
+// quantization search computes it once and re-quantizes the cached
+// coefficients for every candidate quantizer.
+class EncoderSearchState {
+ public:
+  // REQUIRES: opsin.xsize() and opsin.ysize() are multiples of 8.
+  // If "pool" is not null, it is used by all subsequent member functions.
+  explicit EncoderSearchState(const Image3F& opsin,
+                              ThreadPool* pool = nullptr);
+
+  // Same, but the coefficients are stored in "*coeffs", whose storage is
+  // reused if it already has the right size. "*coeffs" must outlive this
+  // object.
+  EncoderSearchState(const Image3F& opsin, ThreadPool* pool, Image3F* coeffs);
+
+  EncoderSearchState(const EncoderSearchState&) = delete;
+  EncoderSearchState& operator=(const EncoderSearchState&) = delete;
+
+  // Same result as ComputeCoefficients(opsin, quantizer).
+  QuantizedCoeffs ComputeCoefficients(const Quantizer& quantizer) const;
+
+  // Same result as ComputeCoefficients(opsin, quantizer) after
+  // YToBTransform(ytob_factor, &opsin), up to rounding. The transform is
+  // linear and thus commutes with the DCT, so it is applied to the cached
+  // coefficients instead of recomputing them.
+  QuantizedCoeffs ComputeCoefficients(const Quantizer& quantizer,
+                                      float ytob_factor) const;
+
+  // Applies YToBTransform(ytob_factor, ...) to the cached coefficients, so
+  // that subsequent results are those of the transformed opsin image, up to
+  // rounding, without recomputing the DCT.
+  void ApplyYToB(float ytob_factor);
+
+  // Returns the blocks [bx0, bx0 + bxsize) x [by0, by0 + bysize) of
+  // ReconOpsinImage(ComputeCoefficients(quantizer), quantizer), computed only
+  // from the blocks they depend on. Used to update the reconstruction after
+  // the quantization of a few blocks changed.
+  Image3F ReconOpsinImageCrop(const Quantizer& quantizer, int bx0, int by0,
+                              int bxsize, int bysize) const;
+
+  size_t block_xsize() const { return coeffs_.xsize() / 64; }
+  size_t block_ysize() const { return coeffs_.ysize(); }
+
+ private:
+  // Storage of coeffs_ unless the caller provided it.
+  Image3F own_coeffs_;
+  // Output of TransposedScaledDCT(opsin).
+  Image3F& coeffs_;
+  ThreadPool* pool_;
+};
+
+// If "tiles" is not null, the AC coefficients of each group of
+// tiles->block_rows block rows are encoded into a separate stream and the
+// stream sizes are stored in tiles->sizes.
 std::string EncodeToBitstream(const QuantizedCoeffs& qcoeffs,
                               const Quantizer& quantizer,
                               int ytob,
                               bool fast_mode,
-                              PikInfo* info);
+                              PikInfo* info,
+                              TileGroups* tiles = nullptr);
+
+// Produces the same output as EncodeToBitstream(ComputeCoefficients(opsin,
+// quantizer), quantizer, ytob, fast_mode, info, tiles) with tile groups of
+// "block_rows" block rows from the opsin image of one group (plus halo) at a
+// time. Only the DC coefficients and the encoded AC groups are kept, so the
+// memory usage is proportional to the group height rather than the image
+// height.
+class TileGroupEncoder {
+ public:
+  // Coefficients of a block depend on the blocks at most this far away, see
+  // EncoderSearchState::ReconOpsinImageCrop.
+  static const int kHalo = 4;
+
+  // "quantizer" must outlive this object.
+  TileGroupEncoder(const Quantizer& quantizer, int ytob, bool fast_mode,
+                   int block_rows, ThreadPool* pool = nullptr);
+
+  bool Done() const { return next_y_ == dc_.ysize(); }
+
+  // Returns the block rows [*y0, *y1) covered by the opsin image passed to the
+  // next AddNextGroup, i.e. the next group plus kHalo rows on each side.
+  // REQUIRES: !Done().
+  void NextGroupRows(int* y0, int* y1) const;
+
+  // "opsin" contains the block rows returned by NextGroupRows of the aligned,
+  // centered and YToB-transformed opsin image.
+  void AddNextGroup(const Image3F& opsin, PikInfo* info);
 
+  // Returns the bitstream and stores the group sizes in "tiles".
+  // REQUIRES: Done().
+  std::string Finish(PikInfo* info, TileGroups* tiles);
+
+ private:
+  const Quantizer& quantizer_;
+  const int ytob_;
+  const bool fast_mode_;
+  const int block_rows_;
+  ThreadPool* pool_;
+  // First block row of the next group.
+  int next_y_ = 0;
+  // Quantized DC coefficient of each block.
+  Image3W dc_;
+  std::vector<uint32_t> group_sizes_;
+  std::string ac_code_;
+};
+
+// Returns an estimate of EncodeToBitstream(qcoeffs, quantizer, ...).size()
+// computed from the symbol histograms alone, i.e. without entropy coding and
+// without allocating the bitstream. Intended for comparing encoder candidates.
+size_t EstimateEncodedSize(const QuantizedCoeffs& qcoeffs,
+                           const Quantizer& quantizer);
+
+// "tiles" must be non-null iff the bitstream was encoded with tiles. The tile
+// groups are decoded in parallel if "pool" is not null. Tile groups that do
+// not overlap the block rows [ac_by0, ac_by1) are skipped, i.e. their blocks
+// only receive the DC coefficients. Their AC coefficients are unspecified
+// (e.g. those of the previous image if "qcoeffs" is reused), hence these
+// blocks must not be reconstructed.
 bool DecodeFromBitstream(const uint8_t* data, const size_t data_size,
                          const size_t xsize, const size_t ysize,
+                         const TileGroups* tiles,
+                         ThreadPool* pool,
                          int* ytob,
                          Quantizer* quantizer,
                          QuantizedCoeffs* qcoeffs,
-                         size_t* compressed_size);
+                         size_t* compressed_size,
+                         int ac_by0 = 0,
+                         int ac_by1 = std::numeric_limits<int>::max());
+
+// Decodes only the part of the bitstream preceding the AC coefficients. "dc"
+// receives the quantized DC coefficient of each block, i.e. one value per
+// block instead of 64. "compressed_size" is the size of the decoded part.
+bool DecodeDCFromBitstream(const uint8_t* data, const size_t data_size,
+                           const size_t xsize, const size_t ysize,
+                           int* ytob, Quantizer* quantizer, Image3W* dc,
+                           size_t* compressed_size);
+
+// Returns the dequantized output of DecodeDCFromBitstream, i.e. the average of
+// each block of the centered opsin image before YToBTransform.
+Image3F ReconOpsinDCImage(const Image3W& dc, const Quantizer& quantizer);
+
+// Returns the blocks [bx0, bx0 + bxsize) x [by0, by0 + bysize) of "qcoeffs".
+QuantizedCoeffs CopyBlocks(const QuantizedCoeffs& qcoeffs, int bx0, int by0,
+                           int bxsize, int bysize);
 
 Image3F ReconOpsinImage(const QuantizedCoeffs& qcoeffs,
-                        const Quantizer& quantizer);
+                        const Quantizer& quantizer,
+                        ThreadPool* pool = nullptr);
+
+// Computes ReconOpsinImage(qcoeffs, quantizer) one block row at a time. The
+// dequantization, prediction and IDCT of each block are fused, so the
+// coefficients only pass through a per-block buffer instead of several
+// image-sized temporaries. Only the DC-level inputs of the prediction are
+// computed up front. The result is bit-identical to ReconOpsinImage.
+//
+// With "downsampling" 2 or 4, each block is instead reconstructed at 1/2 or
+// 1/4 resolution by ComputeTransposedScaledBlockIDCTFloatReduced, i.e. the
+// average of each 2x2 or 4x4 pixels of ReconOpsinImage without the
+// coefficients of the frequencies that cannot be represented.
+class OpsinReconstructor {
+ public:
+  // Blocks only depend on the coefficients of blocks at most this far away
+  // (2x2 AC adjustment and the 4x4 upsampling blur). Reconstructing the
+  // CopyBlocks of a region extended by kHalo blocks on each side (where
+  // available) hence yields the same blocks in the interior of the region,
+  // because the mirrored borders of the copy only affect the extra blocks.
+  static const int kHalo = 2;
+
+  // "qcoeffs" and "quantizer" must outlive this object.
+  OpsinReconstructor(const QuantizedCoeffs& qcoeffs,
+                     const Quantizer& quantizer, int downsampling = 1);
+
+  int block_xsize() const { return qcoeffs_.xsize() / 64; }
+  int block_ysize() const { return qcoeffs_.ysize(); }
+  // Number of output pixels per block edge.
+  int block_dim() const { return block_dim_; }
+
+  // Calls func(by, &rows) for each block row "by" in [by0, by1), possibly
+  // concurrently, where "rows" is an Image3F with the block_dim() pixel rows
+  // of the block row. "func" may modify "rows".
+  template <class Func>
+  void Run(const int by0, const int by1, ThreadPool* pool,
+           const Func& func) const {
+    const int num_threads = pool == nullptr ? 1 : pool->NumThreads();
+    std::vector<UpSample4x4BlurDCTRows> upsample;
+    std::vector<ImageF> blocks;
+    std::vector<Image3F> rows;
+    upsample.reserve(num_threads);
+    blocks.reserve(num_threads);
+    rows.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+      upsample.emplace_back(pixel_dc_, 1.5f);
+      blocks.emplace_back(block_xsize() * 64, 2);
+      rows.emplace_back(block_xsize() * block_dim_, block_dim_);
+    }
+    RunOnPool(pool, by0, by1, [&](const int by, const int thread) {
+      BlockRow(by, &upsample[thread], &blocks[thread], &rows[thread]);
+      func(by, &rows[thread]);
+    });
+  }
+
+ private:
+  // Reconstructs block row "by" into "rows". The two rows of "blocks" hold
+  // the coefficients and the prediction of one channel of the block row.
+  void BlockRow(int by, UpSample4x4BlurDCTRows* upsample, ImageF* blocks,
+                Image3F* rows) const;
+
+  const QuantizedCoeffs& qcoeffs_;
+  const Quantizer& quantizer_;
+  const int block_dim_;
+  // Predicted coefficients 1, 8 and 9 of each block.
+  Image3F ac01_;
+  Image3F ac10_;
+  Image3F ac11_;
+  // 2x2 pixels per block computed from the DC and the adjusted coefficients
+  // 1, 8 and 9, from which the remaining coefficients are predicted.
+  Image3F pixel_dc_;
+};
 
 }  // namespace pik
 
@@ -0,0 +1,56 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// WARNING: this translation unit is compiled with different flags. To prevent
+// ODR violations, all functions defined here or in dependent headers must be
+// inlined and/or within namespace SIMD_NAMESPACE.
+
+#include "convolve_target.h"
+
+#include "simd/simd.h"
+
+namespace pik {
+
+template <>
+void ConvolveRowTransposed::operator()<SIMD_TARGET>(
+    const float* PIK_RESTRICT row_in, const size_t xsize,
+    const float* PIK_RESTRICT kernel, const size_t len, const float scale,
+    const size_t stride, float* PIK_RESTRICT to) {
+  using namespace SIMD_NAMESPACE;
+  const Full<float, SIMD_TARGET> d;
+  const auto vscale = set1(d, scale);
+  size_t x = 0;
+  // Each lane computes one output, hence the order of the additions is the
+  // same as in the scalar loop below.
+  for (; x + d.N <= xsize; x += d.N) {
+    auto sum = setzero(d);
+    for (size_t j = 0; j < len; ++j) {
+      sum = sum + load_unaligned(d, row_in + x + j) * set1(d, kernel[j]);
+    }
+    SIMD_ALIGN float lanes[d.N];
+    store(sum * vscale, d, lanes);
+    for (size_t i = 0; i < d.N; ++i) {
+      to[(x + i) * stride] = lanes[i];
+    }
+  }
+  for (; x < xsize; ++x) {
+    float sum = 0.0f;
+    for (size_t j = 0; j < len; ++j) {
+      sum += row_in[x + j] * kernel[j];
+    }
+    to[x * stride] = sum * scale;
+  }
+}
+
+}  // namespace pik
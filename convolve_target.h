@@ -0,0 +1,45 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CONVOLVE_TARGET_H_
+#define CONVOLVE_TARGET_H_
+
+// Convolution kernel compiled once per instruction set (see Makefile) and
+// selected at runtime via dispatch::Run. It produces the same result on every
+// instruction set, which is also that of summing the products in order.
+
+#include <stddef.h>
+
+#include "compiler_specific.h"
+
+namespace pik {
+
+// Convolves the row "row_in" with the "len" weights of "kernel" and writes the
+// result transposed, i.e. "to"[x * "stride"] is "scale" times the sum of
+// "row_in"[x + j] * "kernel"[j] over j in [0, "len") for each x in
+// [0, "xsize"). The products are accumulated in order of increasing j, hence
+// the result is that of the scalar loop. Reads "row_in"[0, xsize + len - 1).
+//
+// Usage: dispatch::Run(ConvolveRowTransposed(), row_in, xsize, kernel, len,
+//                      scale, stride, to);
+struct ConvolveRowTransposed {
+  template <class Target>
+  void operator()(const float* PIK_RESTRICT row_in, size_t xsize,
+                  const float* PIK_RESTRICT kernel, size_t len, float scale,
+                  size_t stride, float* PIK_RESTRICT to);
+};
+
+}  // namespace pik
+
+#endif  // CONVOLVE_TARGET_H_
@@ -21,6 +21,7 @@
 #include "padded_bytes.h"
 #include "pik.h"
 #include "pik_info.h"
+#include "profiler.h"
 #include "simd/dispatch.h"
 
 namespace pik {
@@ -28,13 +29,10 @@ namespace {
 
 // main() function, within namespace for convenience.
 int Compress(const char* pathname_in, const float butteraugli_distance,
-             const char* pathname_out, const bool fast_mode) {
-#if SIMD_ENABLE_AVX2
-  if ((dispatch::SupportedTargets() & SIMD_AVX2) == 0) {
-    fprintf(stderr, "Cannot continue because CPU lacks AVX2/FMA support.\n");
-    return 1;
-  }
-#elif SIMD_ENABLE_SSE4
+             const char* pathname_out, const bool fast_mode,
+             const int num_threads, const int tile_group_rows,
+             const bool stripes) {
+#if SIMD_ENABLE_SSE4
   if ((dispatch::SupportedTargets() & SIMD_SSE4) == 0) {
     fprintf(stderr, "Cannot continue because CPU lacks SSE4 support.\n");
     return 1;
@@ -57,6 +55,9 @@ int Compress(const char* pathname_in, const float butteraugli_distance,
   CompressParams params;
   params.butteraugli_distance = butteraugli_distance;
   params.alpha_channel = in.HasAlpha();
+  params.num_threads = num_threads;
+  params.tile_group_rows = tile_group_rows;
+  params.stripes = stripes;
   if (fast_mode) {
     params.fast_mode = true;
     params.butteraugli_distance = -1;
@@ -69,6 +70,10 @@ int Compress(const char* pathname_in, const float butteraugli_distance,
   }
 
   printf("Compressed to %zu bytes\n", compressed.size());
+  printf("Peak memory: %zu bytes\n", aux_out.peak_memory_bytes);
+  printf("Allocations: %zu\n", aux_out.num_allocations);
+  // All zones have been exited because the thread pool no longer exists.
+  PROFILER_PRINT_RESULTS();
 
   FILE* f = fopen(pathname_out, "wb");
   if (f == nullptr) {
@@ -88,15 +93,24 @@ int Compress(const char* pathname_in, const float butteraugli_distance,
 }  // namespace
 }  // namespace pik
 
+// Block rows per tile group for --tiled.
+static const int kTileGroupRows = 16;
+
 void PrintArgHelp(int argc, char** argv) {
   fprintf(stderr,
-      "Usage: %s in.png out.pik [--distance <maxError>] [--fast]\n"
+      "Usage: %s in.png out.pik [--distance <maxError>] [--fast]"
+      " [--num_threads <N>] [--tiled] [--stripes]\n"
       " --distance: Maximum butteraugli distance, smaller value means higher"
       " quality.\n"
       "             Good default: 1.0. Supported range: 0.5 .. 3.0.\n"
       " --fast: Use fast encoding, ignores distance.\n"
+      " --num_threads: Number of threads to use, default 1.\n"
+      " --tiled: Store the image in independently decodable groups of %d"
+      " pixel rows, which allows multithreaded decoding.\n"
+      " --stripes: Implies --tiled and --fast. Encodes one group at a time,"
+      " which bounds the memory usage for large images.\n"
       " --help: Show this help.\n",
-      argv[0]);
+      argv[0], 8 * kTileGroupRows);
 }
 
 void ExitWithArgError(int argc, char** argv) {
@@ -106,7 +120,10 @@ void ExitWithArgError(int argc, char** argv) {
 
 int main(int argc, char** argv) {
   bool fast_mode = false;
+  int tile_group_rows = 0;
+  bool stripes = false;
   const char* arg_maxError = nullptr;
+  const char* arg_num_threads = nullptr;
   const char* arg_in = nullptr;
   const char* arg_out = nullptr;
   for (int i = 1; i < argc; i++) {
@@ -114,12 +131,24 @@ int main(int argc, char** argv) {
       std::string arg = argv[i];
       if (arg == "--fast") {
         fast_mode = true;
+      } else if (arg == "--tiled") {
+        tile_group_rows = kTileGroupRows;
+      } else if (arg == "--stripes") {
+        stripes = true;
+        fast_mode = true;
+        tile_group_rows = kTileGroupRows;
       } else if (arg == "--distance") {
         if (i + 1 >= argc) {
           printf("Must give a distance value\n");
           ExitWithArgError(argc, argv);
         }
         arg_maxError = argv[++i];
+      } else if (arg == "--num_threads") {
+        if (i + 1 >= argc) {
+          printf("Must give a number of threads\n");
+          ExitWithArgError(argc, argv);
+        }
+        arg_num_threads = argv[++i];
       } else if (arg == "--help") {
         PrintArgHelp(argc, argv);
         return 0;
@@ -146,9 +175,19 @@ int main(int argc, char** argv) {
     }
   }
 
+  int num_threads = 1;
+  if (arg_num_threads) {
+    num_threads = strtol(arg_num_threads, nullptr, 10);
+    if (num_threads < 1) {
+      fprintf(stderr, "Invalid number of threads '%s'.\n", arg_num_threads);
+      return 1;
+    }
+  }
+
   if (!arg_in || !arg_out) {
     ExitWithArgError(argc, argv);
   }
 
-  return pik::Compress(arg_in, butteraugli_distance, arg_out, fast_mode);
+  return pik::Compress(arg_in, butteraugli_distance, arg_out, fast_mode,
+                       num_threads, tile_group_rows, stripes);
 }
@@ -14,6 +14,8 @@
 
 #include "dct.h"
 
+#include <cmath>
+
 #include "arch_specific.h"
 #include "compiler_specific.h"
 #include "simd/simd.h"
@@ -419,6 +421,78 @@ void ComputeTransposedScaledBlockIDCTFloat(float block[64]) {
   ColumnIDCT(block);
 }
 
+namespace {
+
+// The one-dimensional basis functions of ComputeTransposedScaledBlockIDCTFloat,
+// cos((2 x + 1) u pi / 16) / cos(u pi / 16), averaged over "n" groups of
+// w = 8 / n pixels. The average of a group is the value at its center, i.e.
+// the "n"-point IDCT basis, times sin(w u pi / 16) / (w sin(u pi / 16)).
+struct ReducedIDCTBasis {
+  explicit ReducedIDCTBasis(const int n) {
+    const int w = 8 / n;
+    for (int u = 0; u < n; ++u) {
+      const double average =
+          u == 0 ? 1.0 : std::sin(w * u * M_PI / 16) /
+                             (w * std::sin(u * M_PI / 16));
+      for (int i = 0; i < n; ++i) {
+        basis[u * n + i] = std::cos((2 * i + 1) * u * M_PI / (2 * n)) /
+                           std::cos(u * M_PI / 16) * average;
+      }
+    }
+  }
+  float basis[64];
+};
+
+template <int N>
+void ReducedIDCT(const float* PIK_RESTRICT block,
+                 const float* PIK_RESTRICT basis, float* PIK_RESTRICT out) {
+  // Coefficient 8 * kx + ky has horizontal frequency kx and vertical
+  // frequency ky, see ComputeTransposedScaledBlockIDCTFloat.
+  float tmp[N * N];
+  for (int kx = 0; kx < N; ++kx) {
+    for (int y = 0; y < N; ++y) {
+      float sum = 0.0f;
+      for (int ky = 0; ky < N; ++ky) {
+        sum += block[8 * kx + ky] * basis[ky * N + y];
+      }
+      tmp[kx * N + y] = sum;
+    }
+  }
+  for (int y = 0; y < N; ++y) {
+    for (int x = 0; x < N; ++x) {
+      float sum = 0.0f;
+      for (int kx = 0; kx < N; ++kx) {
+        sum += tmp[kx * N + y] * basis[kx * N + x];
+      }
+      out[y * N + x] = sum;
+    }
+  }
+}
+
+}  // namespace
+
+void ComputeTransposedScaledBlockIDCTFloatReduced(const float block[64],
+                                                  const int n,
+                                                  float* PIK_RESTRICT out) {
+  static const ReducedIDCTBasis kBasis2(2);
+  static const ReducedIDCTBasis kBasis4(4);
+  static const ReducedIDCTBasis kBasis8(8);
+  switch (n) {
+    case 1:
+      out[0] = block[0];
+      break;
+    case 2:
+      ReducedIDCT<2>(block, kBasis2.basis, out);
+      break;
+    case 4:
+      ReducedIDCT<4>(block, kBasis4.basis, out);
+      break;
+    default:
+      ReducedIDCT<8>(block, kBasis8.basis, out);
+      break;
+  }
+}
+
 void ComputeBlockDCTFloat(float block[64]) {
   ComputeTransposedScaledBlockDCTFloat(block);
   TransposeBlock(block);
@@ -15,6 +15,8 @@
 #ifndef DCT_H_
 #define DCT_H_
 
+#include "compiler_specific.h"
+
 namespace pik {
 
 // Computes the in-place 8x8 DCT of block.
@@ -58,6 +60,15 @@ void ComputeTransposedScaledBlockDCTFloat(float block[64]);
 // Requires that block is 32-bytes aligned.
 void ComputeTransposedScaledBlockIDCTFloat(float block[64]);
 
+// Computes the n x n pixels (n = 1, 2, 4 or 8) of the block reconstructed by
+// ComputeTransposedScaledBlockIDCTFloat(block) downsampled by a factor of
+// 8 / n with an n-point IDCT of the n x n lowest frequency coefficients. The
+// result is the average of each group of (8 / n) x (8 / n) pixels of the
+// full IDCT without the remaining coefficients. The output is stored in
+// row-major order in "out".
+void ComputeTransposedScaledBlockIDCTFloatReduced(const float block[64], int n,
+                                                  float* PIK_RESTRICT out);
+
 }  // namespace pik
 
 #endif  // DCT_H_
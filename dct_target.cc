@@ -0,0 +1,320 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// WARNING: this translation unit is compiled with different flags. To prevent
+// ODR violations, all functions defined here or in dependent headers must be
+// inlined and/or within namespace SIMD_NAMESPACE.
+
+#include "dct_target.h"
+
+#include "simd/simd.h"
+
+namespace pik {
+namespace SIMD_NAMESPACE {
+namespace {
+
+// Same as ColumnDCT of dct.cc on the vectors "v" holding the eight rows of
+// (some columns of) a block. Multiplications and additions are separate
+// instructions, so that targets with FMA produce the same result.
+struct ColumnDCT {
+  template <class D>
+  SIMD_INLINE void operator()(const D d, typename D::V v[8]) const {
+    const auto c1 = set1(d, 0.707106781186548f);
+    const auto c2 = set1(d, 0.382683432365090f);
+    const auto c3 = set1(d, 1.30656296487638f);
+    const auto c4 = set1(d, 0.541196100146197f);
+    const auto t00 = v[0] + v[7];
+    const auto t01 = v[0] - v[7];
+    const auto t02 = v[3] + v[4];
+    const auto t03 = v[3] - v[4];
+    const auto t04 = v[2] + v[5];
+    const auto t05 = v[2] - v[5];
+    const auto t06 = v[1] + v[6];
+    const auto t07 = v[1] - v[6];
+    const auto t08 = t00 + t02;
+    const auto t09 = t00 - t02;
+    const auto t10 = t06 + t04;
+    const auto t11 = t06 - t04;
+    const auto t12 = t07 + t05;
+    const auto t13 = t01 + t07;
+    const auto t14 = t05 + t03;
+    const auto t15 = t11 + t09;
+    const auto t16 = t13 - t14;
+    const auto t17 = c1 * t15;
+    const auto t18 = c1 * t12;
+    const auto t19 = c2 * t16;
+    const auto t20 = t01 + t18;
+    const auto t21 = t01 - t18;
+    const auto t22 = c3 * t13 - t19;
+    const auto t23 = c4 * t14 - t19;
+    v[0] = t08 + t10;
+    v[1] = t20 + t22;
+    v[2] = t09 + t17;
+    v[3] = t21 - t23;
+    v[4] = t08 - t10;
+    v[5] = t21 + t23;
+    v[6] = t09 - t17;
+    v[7] = t20 - t22;
+  }
+};
+
+// Same as ColumnIDCT of dct.cc, see ColumnDCT above.
+struct ColumnIDCT {
+  template <class D>
+  SIMD_INLINE void operator()(const D d, typename D::V v[8]) const {
+    const auto c1 = set1(d, 1.41421356237310f);
+    const auto c2 = set1(d, 0.76536686473018f);
+    const auto c3 = set1(d, 2.61312592975275f);
+    const auto c4 = set1(d, 1.08239220029239f);
+    const auto t00 = v[0] + v[4];
+    const auto t01 = v[0] - v[4];
+    const auto t02 = v[2] + v[6];
+    const auto t03 = v[2] - v[6];
+    const auto t04 = v[1] + v[7];
+    const auto t05 = v[1] - v[7];
+    const auto t06 = v[5] + v[3];
+    const auto t07 = v[5] - v[3];
+    const auto t08 = t04 + t06;
+    const auto t09 = t04 - t06;
+    const auto t10 = t00 + t02;
+    const auto t11 = t00 - t02;
+    const auto t12 = t05 + t07;
+    const auto t13 = c2 * t12;
+    const auto t14 = c1 * t03 - t02;
+    const auto t15 = t01 + t14;
+    const auto t16 = t01 - t14;
+    const auto t17 = c3 * t05 - t13;
+    const auto t18 = c4 * t07 + t13;
+    const auto t19 = t17 - t08;
+    const auto t20 = c1 * t09 - t19;
+    const auto t21 = t18 - t20;
+    v[0] = t10 + t08;
+    v[1] = t15 + t19;
+    v[2] = t16 + t20;
+    v[3] = t11 + t21;
+    v[4] = t11 - t21;
+    v[5] = t16 - t20;
+    v[6] = t15 - t19;
+    v[7] = t10 - t08;
+  }
+};
+
+// Transposes the 4x4 matrix whose rows are "v".
+template <class V>
+SIMD_INLINE void Transpose4x4(V v[4]) {
+  const auto q0 = interleave_lo(v[0], v[2]);
+  const auto q1 = interleave_lo(v[1], v[3]);
+  const auto q2 = interleave_hi(v[0], v[2]);
+  const auto q3 = interleave_hi(v[1], v[3]);
+  v[0] = interleave_lo(q0, q1);
+  v[1] = interleave_hi(q0, q1);
+  v[2] = interleave_lo(q2, q3);
+  v[3] = interleave_hi(q2, q3);
+}
+
+// Transposes the 8x8 matrix whose rows are the 8-lane vectors "v", as in
+// TransposeBlock of dct.cc.
+template <class V>
+SIMD_INLINE void Transpose8x8(V v[8]) {
+  const auto q0 = interleave_lo(v[0], v[2]);
+  const auto q1 = interleave_lo(v[1], v[3]);
+  const auto q2 = interleave_hi(v[0], v[2]);
+  const auto q3 = interleave_hi(v[1], v[3]);
+  const auto q4 = interleave_lo(v[4], v[6]);
+  const auto q5 = interleave_lo(v[5], v[7]);
+  const auto q6 = interleave_hi(v[4], v[6]);
+  const auto q7 = interleave_hi(v[5], v[7]);
+  const auto r0 = interleave_lo(q0, q1);
+  const auto r1 = interleave_hi(q0, q1);
+  const auto r2 = interleave_lo(q2, q3);
+  const auto r3 = interleave_hi(q2, q3);
+  const auto r4 = interleave_lo(q4, q5);
+  const auto r5 = interleave_hi(q4, q5);
+  const auto r6 = interleave_lo(q6, q7);
+  const auto r7 = interleave_hi(q6, q7);
+  v[0] = concat_lo_lo(r4, r0);
+  v[1] = concat_lo_lo(r5, r1);
+  v[2] = concat_lo_lo(r6, r2);
+  v[3] = concat_lo_lo(r7, r3);
+  v[4] = concat_hi_hi(r4, r0);
+  v[5] = concat_hi_hi(r5, r1);
+  v[6] = concat_hi_hi(r6, r2);
+  v[7] = concat_hi_hi(r7, r3);
+}
+
+template <size_t kLanes>
+struct LanesTag {};
+
+// An 8x8 block held in vectors of "kLanes" floats, which the compiler can keep
+// in registers: v[i][j] holds columns [j * kLanes, (j + 1) * kLanes) of row i.
+template <class Target, size_t kLanes = Full<float, Target>::N>
+struct Block {
+  using D = Part<float, kLanes, Target>;
+  static constexpr size_t kParts = 8 / kLanes;
+
+  // Loads the rows, which are "stride" floats apart.
+  SIMD_INLINE void Load(const float* PIK_RESTRICT from, const size_t stride) {
+    for (int i = 0; i < 8; ++i) {
+      for (size_t j = 0; j < kParts; ++j) {
+        v[i][j] = load(d, from + i * stride + j * kLanes);
+      }
+    }
+  }
+
+  SIMD_INLINE void Store(const size_t stride, float* PIK_RESTRICT to) const {
+    for (int i = 0; i < 8; ++i) {
+      for (size_t j = 0; j < kParts; ++j) {
+        store(v[i][j], d, to + i * stride + j * kLanes);
+      }
+    }
+  }
+
+  SIMD_INLINE void Multiply(const float factor) {
+    const auto vfactor = set1(d, factor);
+    for (int i = 0; i < 8; ++i) {
+      for (size_t j = 0; j < kParts; ++j) {
+        v[i][j] = v[i][j] * vfactor;
+      }
+    }
+  }
+
+  // Calls "column(d, vectors)" for the eight rows of each part.
+  template <class Column>
+  SIMD_INLINE void Columns(const Column& column) {
+    for (size_t j = 0; j < kParts; ++j) {
+      typename D::V rows[8];
+      for (int i = 0; i < 8; ++i) rows[i] = v[i][j];
+      column(d, rows);
+      for (int i = 0; i < 8; ++i) v[i][j] = rows[i];
+    }
+  }
+
+  SIMD_INLINE void Transpose() { Transpose(LanesTag<kLanes>()); }
+
+  // Column pass, transpose, column pass as in the ComputeTransposedScaled*
+  // functions of dct.cc.
+  template <class Column>
+  SIMD_INLINE void TransposedScaledTransform(const Column& column) {
+    Columns(column);
+    Transpose();
+    Columns(column);
+  }
+
+  D d;
+  typename D::V v[8][kParts];
+
+ private:
+  // Scalars: a change of indices.
+  SIMD_INLINE void Transpose(LanesTag<1>) {
+    for (int i = 0; i < 8; ++i) {
+      for (int j = i + 1; j < 8; ++j) {
+        const auto tmp = v[i][j];
+        v[i][j] = v[j][i];
+        v[j][i] = tmp;
+      }
+    }
+  }
+
+  // Transposes the four 4x4 quadrants and swaps the off-diagonal ones.
+  SIMD_INLINE void Transpose(LanesTag<4>) {
+    typename D::V quadrants[2][2][4];
+    for (int qi = 0; qi < 2; ++qi) {
+      for (int qj = 0; qj < 2; ++qj) {
+        for (int k = 0; k < 4; ++k) {
+          quadrants[qi][qj][k] = v[4 * qj + k][qi];
+        }
+        Transpose4x4(quadrants[qi][qj]);
+      }
+    }
+    for (int qi = 0; qi < 2; ++qi) {
+      for (int qj = 0; qj < 2; ++qj) {
+        for (int k = 0; k < 4; ++k) {
+          v[4 * qi + k][qj] = quadrants[qi][qj][k];
+        }
+      }
+    }
+  }
+
+  SIMD_INLINE void Transpose(LanesTag<8>) {
+    typename D::V rows[8];
+    for (int i = 0; i < 8; ++i) rows[i] = v[i][0];
+    Transpose8x8(rows);
+    for (int i = 0; i < 8; ++i) v[i][0] = rows[i];
+  }
+};
+
+}  // namespace
+}  // namespace SIMD_NAMESPACE
+
+template <>
+void TransposedScaledDCTBlocks::operator()<SIMD_TARGET>(
+    const float* PIK_RESTRICT from, const size_t num_blocks,
+    const size_t stride, const float scale, float* PIK_RESTRICT to) {
+  for (size_t i = 0; i < num_blocks; ++i) {
+    SIMD_NAMESPACE::Block<SIMD_TARGET> block;
+    block.Load(from + 8 * i, stride);
+    // Exact for powers of two, hence the same as scaling the output.
+    block.Multiply(scale);
+    block.TransposedScaledTransform(SIMD_NAMESPACE::ColumnDCT());
+    block.Store(8, to + 64 * i);
+  }
+}
+
+template <>
+void TransposedScaledIDCTBlocks::operator()<SIMD_TARGET>(
+    const float* PIK_RESTRICT from, const size_t num_blocks,
+    const size_t stride, float* PIK_RESTRICT to) {
+  for (size_t i = 0; i < num_blocks; ++i) {
+    SIMD_NAMESPACE::Block<SIMD_TARGET> block;
+    block.Load(from + 64 * i, 8);
+    block.TransposedScaledTransform(SIMD_NAMESPACE::ColumnIDCT());
+    block.Store(stride, to + 8 * i);
+  }
+}
+
+template <>
+void UpSample4x4BlurDCTBlocks::operator()<SIMD_TARGET>(
+    const float* PIK_RESTRICT row0, const float* PIK_RESTRICT row1,
+    const float* PIK_RESTRICT row2, const float* PIK_RESTRICT row3,
+    const size_t num_blocks, const float w0[4], const float w1[4],
+    const float w2[4], float* PIK_RESTRICT to) {
+  using Block = SIMD_NAMESPACE::Block<SIMD_TARGET>;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    Block block;
+    const auto d = block.d;
+    for (size_t j = 0; j < Block::kParts; ++j) {
+      const size_t x = 8 * i + j * d.N;
+      const auto val0 = load(d, row0 + x);
+      const auto val1 = load(d, row1 + x);
+      const auto val2 = load(d, row2 + x);
+      const auto val3 = load(d, row3 + x);
+      for (int iy = 0; iy < 4; ++iy) {
+        const auto vw0 = set1(d, w0[iy]);
+        const auto vw1 = set1(d, w1[iy]);
+        const auto vw2 = set1(d, w2[iy]);
+        block.v[iy][j] = val0 * vw0 + val1 * vw1 + val2 * vw2;
+        block.v[iy + 4][j] = val1 * vw0 + val2 * vw1 + val3 * vw2;
+      }
+    }
+    block.TransposedScaledTransform(SIMD_NAMESPACE::ColumnDCT());
+    float* PIK_RESTRICT coeffs = to + 64 * i;
+    block.Store(8, coeffs);
+    coeffs[0] = 0.0f;
+    coeffs[1] = 0.0f;
+    coeffs[8] = 0.0f;
+    coeffs[9] = 0.0f;
+  }
+}
+
+}  // namespace pik
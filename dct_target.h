@@ -0,0 +1,68 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DCT_TARGET_H_
+#define DCT_TARGET_H_
+
+// DCT kernels compiled once per instruction set (see Makefile) and selected at
+// runtime via dispatch::Run, e.g. dispatch::Run(TransposedScaledIDCTBlocks(),
+// from, num_blocks, stride, to). All of them produce the same result on every
+// instruction set.
+
+#include <stddef.h>
+
+#include "compiler_specific.h"
+
+namespace pik {
+
+// Computes ComputeTransposedScaledBlockDCTFloat() of "num_blocks" horizontally
+// adjacent 8x8 blocks whose rows start at "from" and are "stride" floats apart,
+// multiplied by "scale" (a power of two), and writes the 64 coefficients of
+// each block consecutively to "to". Requires that "from", "to" and the rows
+// are 32-bytes aligned.
+struct TransposedScaledDCTBlocks {
+  template <class Target>
+  void operator()(const float* PIK_RESTRICT from, size_t num_blocks,
+                  size_t stride, float scale, float* PIK_RESTRICT to);
+};
+
+// Computes ComputeTransposedScaledBlockIDCTFloat() of "num_blocks" consecutive
+// blocks of 64 coefficients starting at "from" and writes the 8x8 pixels of
+// each block side by side into 8 rows starting at "to" that are "stride" floats
+// apart. Requires that "from" and the rows are 32-bytes aligned.
+struct TransposedScaledIDCTBlocks {
+  template <class Target>
+  void operator()(const float* PIK_RESTRICT from, size_t num_blocks,
+                  size_t stride, float* PIK_RESTRICT to);
+};
+
+// Vertically upsamples and blurs the four horizontally upsampled and blurred
+// rows "row0" to "row3" into "num_blocks" 8x8 blocks, see UpSample4x4BlurDCT,
+// and writes their ComputeTransposedScaledBlockDCTFloat() to "to" with
+// coefficients 0, 1, 8 and 9 set to zero. "w0" to "w2" are the weights of the
+// three source rows of each output row. Requires that the rows and "to" are
+// 32-bytes aligned.
+struct UpSample4x4BlurDCTBlocks {
+  template <class Target>
+  void operator()(const float* PIK_RESTRICT row0,
+                  const float* PIK_RESTRICT row1,
+                  const float* PIK_RESTRICT row2,
+                  const float* PIK_RESTRICT row3, size_t num_blocks,
+                  const float w0[4], const float w1[4], const float w2[4],
+                  float* PIK_RESTRICT to);
+};
+
+}  // namespace pik
+
+#endif  // DCT_TARGET_H_
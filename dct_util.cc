@@ -1,57 +1,48 @@
 #include "dct_util.h"
 
 #include "dct.h"
+#include "dct_target.h"
 #include "gauss_blur.h"
+#include "profiler.h"
+#include "simd/dispatch.h"
 #include "simd/simd.h"
 #include "status.h"
 
 namespace pik {
 
-Image3F TransposedScaledIDCT(const Image3F& coeffs) {
+Image3F TransposedScaledIDCT(const Image3F& coeffs, ThreadPool* pool) {
+  PROFILER_FUNC;
   PIK_ASSERT(coeffs.xsize() % 64 == 0);
   Image3F img(coeffs.xsize() / 8, coeffs.ysize() * 8);
-  alignas(32) float block[64];
-  for (int y = 0; y < coeffs.ysize(); ++y) {
-    const int yoff = y * 8;
-    auto row_in = coeffs.Row(y);
-    for (int x = 0; x < coeffs.xsize(); x += 64) {
-      const int xoff = x / 8;
-      for (int c = 0; c < 3; ++c) {
-        memcpy(block, &row_in[c][x], sizeof(block));
-        ComputeTransposedScaledBlockIDCTFloat(block);
-        for (int iy = 0; iy < 8; ++iy) {
-          float* const PIK_RESTRICT row_out = &img.Row(yoff + iy)[c][xoff];
-          memcpy(row_out, &block[iy * 8], 8 * sizeof(block[0]));
-        }
-      }
+  RunOnPool(pool, 0, coeffs.ysize(), [&](const int y, const int thread) {
+    for (int c = 0; c < 3; ++c) {
+      dispatch::Run(TransposedScaledIDCTBlocks(), coeffs.ConstPlaneRow(c, y),
+                    coeffs.xsize() / 64, img.plane(c).PixelsPerRow(),
+                    img.PlaneRow(c, y * 8));
     }
-  }
+  });
   return img;
 }
 
-Image3F TransposedScaledDCT(const Image3F& img) {
+Image3F TransposedScaledDCT(const Image3F& img, ThreadPool* pool) {
+  Image3F coeffs;
+  TransposedScaledDCT(img, pool, &coeffs);
+  return coeffs;
+}
+
+void TransposedScaledDCT(const Image3F& img, ThreadPool* pool,
+                         Image3F* coeffs) {
+  PROFILER_FUNC;
   PIK_ASSERT(img.xsize() % 8 == 0);
   PIK_ASSERT(img.ysize() % 8 == 0);
-  Image3F coeffs(img.xsize() * 8, img.ysize() / 8);
-  alignas(32) float block[64];
-  for (int y = 0; y < coeffs.ysize(); ++y) {
-    const int yoff = y * 8;
-    auto row_out = coeffs.Row(y);
-    for (int x = 0; x < coeffs.xsize(); x += 64) {
-      const int xoff = x / 8;
-      for (int c = 0; c < 3; ++c) {
-        for (int iy = 0; iy < 8; ++iy) {
-          const float* const PIK_RESTRICT row_in = &img.Row(yoff + iy)[c][xoff];
-          memcpy(&block[iy * 8], row_in, 8 * sizeof(block[0]));
-        }
-        ComputeTransposedScaledBlockDCTFloat(block);
-        const float kScale = 1.0f / 64.0f;
-        for (int k = 0; k < 64; ++k) block[k] *= kScale;
-        memcpy(&row_out[c][x], block, sizeof(block));
-      }
+  EnsureSize(img.xsize() * 8, img.ysize() / 8, coeffs);
+  RunOnPool(pool, 0, coeffs->ysize(), [&](const int y, const int thread) {
+    for (int c = 0; c < 3; ++c) {
+      dispatch::Run(TransposedScaledDCTBlocks(), img.ConstPlaneRow(c, y * 8),
+                    coeffs->xsize() / 64, img.plane(c).PixelsPerRow(),
+                    1.0f / 64.0f, coeffs->PlaneRow(c, y));
     }
-  }
-  return coeffs;
+  });
 }
 
 Image3F DCImage(const Image3F& coeffs) {
@@ -93,25 +84,36 @@ Image3F KeepOnly2x2Corners(const Image3F& coeffs) {
   return copy;
 }
 
+void PixelSpaceFrom2x2Corners(const float c0, const float c1, const float c8,
+                              const float c9, float out[4]) {
+  const float kScale01 = 0.113265930794111f / (kIDCTScales[0] * kIDCTScales[1]);
+  const float kScale11 = 0.102633368629251f / (kIDCTScales[1] * kIDCTScales[1]);
+  const float a00 = c0;
+  const float a01 = c8 * kScale01;
+  const float a10 = c1 * kScale01;
+  const float a11 = c9 * kScale11;
+  out[0] = a00 + a01 + a10 + a11;
+  out[1] = a00 - a01 + a10 - a11;
+  out[2] = a00 + a01 - a10 - a11;
+  out[3] = a00 - a01 - a10 + a11;
+}
+
 Image3F GetPixelSpaceImageFrom2x2Corners(const Image3F& coeffs) {
   PIK_ASSERT(coeffs.xsize() % 64 == 0);
   const int block_xsize = coeffs.xsize() / 64;
   const int block_ysize = coeffs.ysize();
   Image3F out(block_xsize * 2, block_ysize * 2);
-  const float kScale01 = 0.113265930794111f / (kIDCTScales[0] * kIDCTScales[1]);
-  const float kScale11 = 0.102633368629251f / (kIDCTScales[1] * kIDCTScales[1]);
   for (int by = 0; by < block_ysize; ++by) {
     for (int bx = 0; bx < block_xsize; ++bx) {
       for (int c = 0; c < 3; ++c) {
         const float* block = &coeffs.Row(by)[c][bx * 64];
-        const float a00 = block[0];
-        const float a01 = block[8] * kScale01;
-        const float a10 = block[1] * kScale01;
-        const float a11 = block[9] * kScale11;
-        out.Row(2 * by + 0)[c][2 * bx + 0] = a00 + a01 + a10 + a11;
-        out.Row(2 * by + 0)[c][2 * bx + 1] = a00 - a01 + a10 - a11;
-        out.Row(2 * by + 1)[c][2 * bx + 0] = a00 + a01 - a10 - a11;
-        out.Row(2 * by + 1)[c][2 * bx + 1] = a00 - a01 - a10 + a11;
+        float pixels[4];
+        PixelSpaceFrom2x2Corners(block[0], block[1], block[8], block[9],
+                                 pixels);
+        out.Row(2 * by + 0)[c][2 * bx + 0] = pixels[0];
+        out.Row(2 * by + 0)[c][2 * bx + 1] = pixels[1];
+        out.Row(2 * by + 1)[c][2 * bx + 0] = pixels[2];
+        out.Row(2 * by + 1)[c][2 * bx + 1] = pixels[3];
       }
     }
   }
@@ -227,16 +229,14 @@ Image3F UpSample8x8BlurDCT(const Image3F& img, const float sigma) {
   return out;
 }
 
-Image3F UpSample4x4BlurDCT(const Image3F& img, const float sigma) {
-  const int xs = img.xsize();
-  const int ys = img.ysize();
-  const int bxs = xs / 2;
-  const int bys = ys / 2;
-  float w0[4] = { 0.0f };
-  float w1[4] = { 0.0f };
-  float w2[4] = { 0.0f };
+namespace {
+
+// Weights of the three source pixels of each of the 4 upsampled pixels.
+void UpSample4x4Weights(const float sigma, float w0[4], float w1[4],
+                        float w2[4]) {
   std::vector<float> kernel = GaussianKernel(4, sigma);
   for (int k = 0; k < 4; ++k) {
+    w0[k] = w1[k] = w2[k] = 0.0f;
     const int split0 = 4 - k;
     const int split1 = 8 - k;
     for (int j = 0; j < split0; ++j) {
@@ -252,67 +252,95 @@ Image3F UpSample4x4BlurDCT(const Image3F& img, const float sigma) {
     w1[k] *= 0.125f;
     w2[k] *= 0.125f;
   }
+}
+
+// Upsamples and blurs one row of "xs" pixels horizontally.
+void UpSample4x4BlurRow(const float* PIK_RESTRICT row_in, const int xs,
+                        const float w0[4], const float w1[4],
+                        const float w2[4], float* PIK_RESTRICT row_out) {
+  std::vector<float> row_tmp(xs + 2);
+  memcpy(&row_tmp[1], row_in, xs * sizeof(row_in[0]));
+  row_tmp[0] = row_tmp[1 + std::min(1, xs - 1)];
+  row_tmp[xs + 1] = row_tmp[1 + std::max(0, xs - 2)];
+  for (int x = 0; x < xs; ++x) {
+    const float v0 = row_tmp[x];
+    const float v1 = row_tmp[x + 1];
+    const float v2 = row_tmp[x + 2];
+    const int offset = x * 4;
+    for (int ix = 0; ix < 4; ++ix) {
+      row_out[offset + ix] = v0 * w0[ix] + v1 * w1[ix] + v2 * w2[ix];
+    }
+  }
+}
+
+// Rows of the horizontally blurred image used by block row "by" of "bys".
+void UpSample4x4SourceRows(const int by, const int bys, int rows[4]) {
+  rows[0] = by == 0 ? 1 : 2 * by - 1;
+  rows[1] = 2 * by;
+  rows[2] = 2 * by + 1;
+  rows[3] = by + 1 < bys ? 2 * by + 2 : 2 * by;
+}
+
+}  // namespace
+
+Image3F UpSample4x4BlurDCT(const Image3F& img, const float sigma) {
+  const int xs = img.xsize();
+  const int ys = img.ysize();
+  const int bxs = xs / 2;
+  const int bys = ys / 2;
+  float w0[4];
+  float w1[4];
+  float w2[4];
+  UpSample4x4Weights(sigma, w0, w1, w2);
   Image3F blur_x(xs * 4, ys);
   for (int y = 0; y < ys; ++y) {
-    auto row = img.Row(y);
     for (int c = 0; c < 3; ++c) {
-      std::vector<float> row_tmp(xs + 2);
-      memcpy(&row_tmp[1], row[c], xs * sizeof(row[c][0]));
-      row_tmp[0] = row_tmp[1 + std::min(1, xs - 1)];
-      row_tmp[xs + 1] = row_tmp[1 + std::max(0, xs - 2)];
-      float* const PIK_RESTRICT row_out = blur_x.Row(y)[c];
-      for (int x = 0; x < xs; ++x) {
-        const float v0 = row_tmp[x];
-        const float v1 = row_tmp[x + 1];
-        const float v2 = row_tmp[x + 2];
-        const int offset = x * 4;
-        for (int ix = 0; ix < 4; ++ix) {
-          row_out[offset + ix] = v0 * w0[ix] + v1 * w1[ix] + v2 * w2[ix];
-        }
-      }
+      UpSample4x4BlurRow(img.PlaneRow(c, y), xs, w0, w1, w2,
+                         blur_x.PlaneRow(c, y));
     }
   }
   Image3F out(bxs * 64, bys);
   for (int by = 0; by < bys; ++by) {
     auto row = out.Row(by);
-    const int by0 = by == 0 ? 1 : 2 * by - 1;
-    const int by1 = 2 * by;
-    const int by2 = 2 * by + 1;
-    const int by3 = by + 1 < bys ? 2 * by + 2 : 2 * by;
-    auto row0 = blur_x.ConstRow(by0);
-    auto row1 = blur_x.ConstRow(by1);
-    auto row2 = blur_x.ConstRow(by2);
-    auto row3 = blur_x.ConstRow(by3);
-    for (int bx = 0; bx < bxs; ++bx) {
-      for (int c = 0; c < 3; ++c) {
-        float* const PIK_RESTRICT block = &row[c][bx * 64];
-        using namespace SIMD_NAMESPACE;
-        const Full<float, SIMD_TARGET> d;
-        for (int ix = 0; ix < 8; ix += d.N) {
-          const auto val0 = load(d, &row0[c][bx * 8 + ix]);
-          const auto val1 = load(d, &row1[c][bx * 8 + ix]);
-          const auto val2 = load(d, &row2[c][bx * 8 + ix]);
-          const auto val3 = load(d, &row3[c][bx * 8 + ix]);
-          for (int iy = 0; iy < 4; ++iy) {
-            const auto vala = (val0 * set1(d, w0[iy]) + val1 * set1(d, w1[iy]) +
-                               val2 * set1(d, w2[iy]));
-            const auto valb = (val1 * set1(d, w0[iy]) + val2 * set1(d, w1[iy]) +
-                               val3 * set1(d, w2[iy]));
-            store(vala, d, &block[iy * 8 + ix]);
-            store(valb, d, &block[iy * 8 + 32 + ix]);
-          }
-        }
-        ComputeTransposedScaledBlockDCTFloat(block);
-        block[0] = 0.0f;
-        block[1] = 0.0f;
-        block[8] = 0.0f;
-        block[9] = 0.0f;
-      }
+    int src[4];
+    UpSample4x4SourceRows(by, bys, src);
+    auto row0 = blur_x.ConstRow(src[0]);
+    auto row1 = blur_x.ConstRow(src[1]);
+    auto row2 = blur_x.ConstRow(src[2]);
+    auto row3 = blur_x.ConstRow(src[3]);
+    for (int c = 0; c < 3; ++c) {
+      dispatch::Run(UpSample4x4BlurDCTBlocks(), row0[c], row1[c], row2[c],
+                    row3[c], bxs, w0, w1, w2, row[c]);
     }
   }
   return out;
 }
 
+UpSample4x4BlurDCTRows::UpSample4x4BlurDCTRows(const Image3F& img,
+                                               const float sigma)
+    : img_(img), blur_x_(img.xsize() * 4, 4) {
+  UpSample4x4Weights(sigma, w0_, w1_, w2_);
+}
+
+void UpSample4x4BlurDCTRows::SetBlockRow(const int by) {
+  int src[4];
+  UpSample4x4SourceRows(by, img_.ysize() / 2, src);
+  for (int i = 0; i < 4; ++i) {
+    for (int c = 0; c < 3; ++c) {
+      UpSample4x4BlurRow(img_.PlaneRow(c, src[i]), img_.xsize(), w0_, w1_,
+                         w2_, blur_x_.PlaneRow(c, i));
+    }
+  }
+}
+
+void UpSample4x4BlurDCTRows::BlockRow(const int c,
+                                      float* PIK_RESTRICT blocks) const {
+  dispatch::Run(UpSample4x4BlurDCTBlocks(), blur_x_.PlaneRow(c, 0),
+                blur_x_.PlaneRow(c, 1), blur_x_.PlaneRow(c, 2),
+                blur_x_.PlaneRow(c, 3), img_.xsize() / 2, w0_, w1_, w2_,
+                blocks);
+}
+
 template <int N>
 Image3F UpSampleBlur(const Image3F& img, const float sigma) {
   const int xs = img.xsize();
@@ -1,7 +1,9 @@
 #ifndef DCT_UTIL_H_
 #define DCT_UTIL_H_
 
+#include "compiler_specific.h"
 #include "image.h"
+#include "thread_pool.h"
 
 namespace pik {
 
@@ -9,14 +11,20 @@ namespace pik {
 // ComputeTransposedScaledBlockIDCTFloat() from the corresponding 64x1 block of
 // the coefficient image.
 // REQUIRES: coeffs.xsize() == 64*N, coeffs.ysize() == M
-Image3F TransposedScaledIDCT(const Image3F& coeffs);
+// Block rows are transformed in parallel if "pool" is not null.
+Image3F TransposedScaledIDCT(const Image3F& coeffs,
+                             ThreadPool* pool = nullptr);
 
 // Returns a 64*N x M image where each 64x1 block is produced with
 // ComputeTransposedScaledBlockDCTFloat() from the corresponding 8x8 block of
 // the image. Note that the whole coefficient image is scaled by 1/64
 // afterwards, so that this is exactly the inverse of TransposedScaledIDCT().
 // REQUIRES: coeffs.xsize() == 8*N, coeffs.ysize() == 8*M
-Image3F TransposedScaledDCT(const Image3F& img);
+// Block rows are transformed in parallel if "pool" is not null.
+Image3F TransposedScaledDCT(const Image3F& img, ThreadPool* pool = nullptr);
+// Same, but reuses the storage of "*coeffs" if it already has the output size.
+void TransposedScaledDCT(const Image3F& img, ThreadPool* pool,
+                         Image3F* coeffs);
 
 // Returns an N x M image by taking the DC coefficient from each 64x1 block.
 // REQUIRES: coeffs.xsize() == 64*N, coeffs.ysize() == M
@@ -34,6 +42,12 @@ Image3F KeepOnly2x2Corners(const Image3F& coeffs);
 // REQUIRES: coeffs.xsize() == 64*N, coeffs.ysize() == M
 Image3F GetPixelSpaceImageFrom2x2Corners(const Image3F& coeffs);
 
+// Stores the 2x2 pixel-space values (in row-major order) of a block with the
+// coefficients c0, c1, c8 and c9 in "out", as GetPixelSpaceImageFrom2x2Corners
+// does for each block.
+void PixelSpaceFrom2x2Corners(float c0, float c1, float c8, float c9,
+                              float out[4]);
+
 // Puts back the top 2x2 corner of each 8x8 block of *coeffs from the
 // transformed pixel space image img.
 // REQUIRES: coeffs->xsize() == 64*N, coeffs->ysize() == M
@@ -54,6 +68,33 @@ Image3F UpSample8x8BlurDCT(const Image3F& img, const float sigma);
 //  4) Zero out the top 2x2 corner of each DCT block
 Image3F UpSample4x4BlurDCT(const Image3F& img, const float sigma);
 
+// Computes UpSample4x4BlurDCT(img, sigma) one block at a time with the same
+// result, e.g. for fusing it with other per-block operations. Only the few
+// rows of temporaries required for one block row are allocated, hence each
+// thread should use its own instance.
+class UpSample4x4BlurDCTRows {
+ public:
+  // "img" must outlive this object.
+  UpSample4x4BlurDCTRows(const Image3F& img, float sigma);
+
+  // Prepares the computation of the blocks in block row "by".
+  void SetBlockRow(int by);
+
+  // Stores the 64 coefficients of each block of channel "c" of the current
+  // block row consecutively in "blocks", which must be aligned to the SIMD
+  // vector size.
+  void BlockRow(int c, float* PIK_RESTRICT blocks) const;
+
+ private:
+  const Image3F& img_;
+  float w0_[4];
+  float w1_[4];
+  float w2_[4];
+  // The rows of the horizontally upsampled and blurred image used by the
+  // current block row.
+  Image3F blur_x_;
+};
+
 // Returns an image that is defined by the following transformations:
 //  1) Upsample image 8x8 with nearest-neighbor
 //  2) Blur with a Gaussian kernel of radius 8 and given sigma
@@ -14,7 +14,10 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <chrono>  // NOLINT
 
 #include "gamma_correct.h"
 #include "image.h"
@@ -23,6 +26,7 @@
 #include "padded_bytes.h"
 #include "pik.h"
 #include "pik_info.h"
+#include "profiler.h"
 
 namespace pik {
 namespace {
@@ -55,13 +59,9 @@ bool LoadFile(const char* pathname, PaddedBytes* compressed) {
 }
 
 template<typename ComponentType>
-int Decompress(const char* pathname_in, const char* pathname_out) {
-#if SIMD_ENABLE_AVX2
-  if ((dispatch::SupportedTargets() & SIMD_AVX2) == 0) {
-    fprintf(stderr, "Cannot continue because CPU lacks AVX2/FMA support.\n");
-    return 1;
-  }
-#elif SIMD_ENABLE_SSE4
+int Decompress(const char* pathname_in, const char* pathname_out,
+               const DecompressParams& params, const int num_reps) {
+#if SIMD_ENABLE_SSE4
   if ((dispatch::SupportedTargets() & SIMD_SSE4) == 0) {
     fprintf(stderr, "Cannot continue because CPU lacks SSE4 support.\n");
     return 1;
@@ -73,14 +73,29 @@ int Decompress(const char* pathname_in, const char* pathname_out) {
     return 1;
   }
 
-  DecompressParams params;
   MetaImage<ComponentType> image;
   PikInfo info;
-  if (!PikToPixels(params, compressed, &image, &info)) {
-    fprintf(stderr, "Failed to decompress.\n");
-    return 1;
+  // The fastest of several repetitions is the least disturbed by other
+  // processes and cold caches.
+  double min_seconds = 1E30;
+  for (int rep = 0; rep < num_reps; ++rep) {
+    const auto start = std::chrono::steady_clock::now();
+    if (!PikToPixels(params, compressed, &image, &info)) {
+      fprintf(stderr, "Failed to decompress.\n");
+      return 1;
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    min_seconds = std::min(min_seconds, elapsed.count());
   }
   printf("Decompressed %zu x %zu pixels.\n", image.xsize(), image.ysize());
+  // All zones have been exited because the thread pool no longer exists.
+  PROFILER_PRINT_RESULTS();
+  if (num_reps > 1) {
+    const double megapixels = image.xsize() * image.ysize() * 1E-6;
+    printf("%.2f MP/s (fastest of %d repetitions)\n",
+           megapixels / min_seconds, num_reps);
+  }
 
   if (!WriteImage(ImageFormatPNG(), image, pathname_out)) {
     fprintf(stderr, "Failed to write %s.\n", pathname_out);
@@ -98,11 +113,32 @@ int main(int argc, char** argv) {
   const char* file_out = 0;
   bool arg_error = false;
   bool sixteen_bit = false;
+  pik::DecompressParams params;
+  int num_reps = 1;
 
   for (int i = 1; i < argc; i++) {
     if (argv[i][0] == '-') {
       if (strcmp(argv[i], "--16bit") == 0) {
         sixteen_bit = true;
+      } else if (strcmp(argv[i], "--num_threads") == 0 && i + 1 < argc) {
+        params.num_threads = strtol(argv[++i], nullptr, 10);
+        if (params.num_threads < 1) {
+          arg_error = true;
+          break;
+        }
+      } else if (strcmp(argv[i], "--downsampling") == 0 && i + 1 < argc) {
+        params.downsampling = strtol(argv[++i], nullptr, 10);
+      } else if (strcmp(argv[i], "--crop") == 0 && i + 4 < argc) {
+        params.crop_x0 = strtoul(argv[++i], nullptr, 10);
+        params.crop_y0 = strtoul(argv[++i], nullptr, 10);
+        params.crop_xsize = strtoul(argv[++i], nullptr, 10);
+        params.crop_ysize = strtoul(argv[++i], nullptr, 10);
+      } else if (strcmp(argv[i], "--num_reps") == 0 && i + 1 < argc) {
+        num_reps = strtol(argv[++i], nullptr, 10);
+        if (num_reps < 1) {
+          arg_error = true;
+          break;
+        }
       } else {
         arg_error = true;
         break;
@@ -121,16 +157,24 @@ int main(int argc, char** argv) {
 
   if (!file_in || !file_out || arg_error) {
     fprintf(stderr,
-        "Usage: %s [--16bit] in.pik out.png\n"
+        "Usage: %s [--16bit] [--num_threads <N>] [--num_reps <N>] "
+        "[--downsampling <N>] [--crop <x0> <y0> <xsize> <ysize>] in.pik "
+        "out.png\n"
         "    out.png will have 8 bit per color channel by default,\n"
         "    16 bit per channel if --16bit is set\n"
+        "    --num_threads: Number of threads to use, default 1\n"
+        "    --num_reps: Decode N times and print the speed in megapixels\n"
+        "    per second of the fastest repetition, default 1\n"
+        "    --downsampling: 2 or 4 decode at reduced resolution, 8 only\n"
+        "    decodes a 1:8 preview from the DC coefficients, default 1\n"
+        "    --crop: Only decode the given rectangle\n"
         , argv[0]);
     return 1;
   }
 
   if (sixteen_bit) {
-    return pik::Decompress<uint16_t>(file_in, file_out);
+    return pik::Decompress<uint16_t>(file_in, file_out, params, num_reps);
   } else {
-    return pik::Decompress<uint8_t>(file_in, file_out);
+    return pik::Decompress<uint8_t>(file_in, file_out, params, num_reps);
   }
 }
@@ -18,7 +18,9 @@
 #include <algorithm>
 
 #include "compiler_specific.h"
+#include "convolve_target.h"
 #include "gamma_correct.h"
+#include "simd/dispatch.h"
 
 namespace pik {
 
@@ -50,6 +52,12 @@ ImageF ConvolveXSampleAndTranspose(const ImageF& in,
   const float* const kernelp = &kernel[r];
   for (int y = 0; y < in.ysize(); ++y) {
     ExtrapolateBorders(in.Row(y), rowp, in.xsize(), r);
+    if (res == 1) {
+      dispatch::Run(ConvolveRowTransposed(), &rowp[-r], in.xsize(),
+                    kernel.data(), kernel.size(), 1.0f, out.PixelsPerRow(),
+                    &out.Row(0)[y]);
+      continue;
+    }
     for (int x = offset, ox = 0; x < in.xsize(); x += res, ++ox) {
       float sum = 0.0f;
       for (int i = -r; i <= r; ++i) {
@@ -104,17 +104,49 @@ class U32Coder {
   }
 };
 
-// Reads fields (uint32_t or Bytes) from a BitSource.
+// Number of bytes that FieldReader may read beyond its "end".
+constexpr size_t kFieldReaderSlack = 16;
+
+// Reads fields (uint32_t, std::vector<uint32_t> or Bytes) from a BitSource.
+// Stops reading once the fields extend beyond "end", which must be followed
+// by kFieldReaderSlack readable bytes. The values are then unspecified and
+// OK() returns false.
 class FieldReader {
  public:
-  FieldReader(BitSource* source) : source_(source) {}
+  FieldReader(BitSource* source, const uint8_t* end)
+      : source_(source), end_(end) {}
+
   void operator()(const uint32_t selector_bits,
                   uint32_t* const PIK_RESTRICT value) {
-    *value = U32Coder::Load(selector_bits, source_);
+    *value = CheckBounds() ? U32Coder::Load(selector_bits, source_) : 0;
+  }
+
+  void operator()(const uint32_t selector_bits,
+                  std::vector<uint32_t>* const PIK_RESTRICT values) {
+    values->clear();
+    if (!CheckBounds()) return;
+    const uint32_t num_values = U32Coder::Load(kU32Selectors, source_);
+    // Each value occupies at least two bits. Checking this before resizing
+    // prevents corrupt streams from requesting huge allocations.
+    if (!CheckBounds() || num_values / 4 > BytesRemaining()) {
+      ok_ = false;
+      return;
+    }
+    values->resize(num_values);
+    for (uint32_t& value : *values) {
+      if (!CheckBounds()) return;
+      value = U32Coder::Load(selector_bits, source_);
+    }
   }
 
   void operator()(Bytes* const PIK_RESTRICT value) {
+    value->clear();
+    if (!CheckBounds()) return;
     const uint32_t num_bytes = U32Coder::Load(kU32Selectors, source_);
+    if (!CheckBounds() || num_bytes > BytesRemaining()) {
+      ok_ = false;
+      return;
+    }
     value->resize(num_bytes);
 
     // Read four bytes at a time, reducing the relative cost of CanRead32.
@@ -136,8 +168,23 @@ class FieldReader {
     }
   }
 
+  // Returns false if any field extended beyond "end".
+  bool OK() { return CheckBounds(); }
+
  private:
+  // Returns false if the fields read so far extend beyond "end". BitSource
+  // reads at most 8 bytes ahead of Finalize(), and one U32Coder::Load up to
+  // 8 more, hence checking before each Load suffices to stay within the slack.
+  bool CheckBounds() {
+    ok_ &= source_->Finalize() <= end_;
+    return ok_;
+  }
+
+  size_t BytesRemaining() const { return end_ - source_->Finalize(); }
+
   BitSource* const source_;
+  const uint8_t* const end_;
+  bool ok_ = true;
 };
 
 // Establishes an upper bound on the compressed size, using the actual
@@ -149,6 +196,12 @@ class FieldMaxSize {
     max_bits_ += U32Coder::MaxCompressedBits();
   }
 
+  void operator()(const uint32_t selector_bits,
+                  const std::vector<uint32_t>* const PIK_RESTRICT values) {
+    max_bits_ += U32Coder::MaxCompressedBits();  // num_values
+    max_bits_ += values->size() * U32Coder::MaxCompressedBits();
+  }
+
   void operator()(const Bytes* const PIK_RESTRICT value) {
     max_bits_ += U32Coder::MaxCompressedBits();  // num_bytes
     max_bits_ += value->size() * 8;
@@ -170,6 +223,14 @@ class FieldWriter {
     ok_ &= U32Coder::Store(*value, selector_bits, sink_);
   }
 
+  void operator()(const uint32_t selector_bits,
+                  const std::vector<uint32_t>* const PIK_RESTRICT values) {
+    ok_ &= U32Coder::Store(values->size(), kU32Selectors, sink_);
+    for (const uint32_t value : *values) {
+      ok_ &= U32Coder::Store(value, selector_bits, sink_);
+    }
+  }
+
   void operator()(const Bytes* const PIK_RESTRICT value) {
     ok_ &= U32Coder::Store(value->size(), kU32Selectors, sink_);
 
@@ -253,7 +314,9 @@ const uint8_t* LoadHeader(const uint8_t* from,
     return nullptr;
   }
 
-  FieldReader reader(&source);
+  // The header only has uint32_t fields and PaddedBytes guarantees
+  // MaxCompressedHeaderSize readable bytes, so no bounds checks are needed.
+  FieldReader reader(&source, from + MaxCompressedHeaderSize());
   header->VisitFields(&reader);
   return source.Finalize();
 }
@@ -306,7 +369,7 @@ class SectionBits {
     return true;
   }
 
-  void Load(BitSource* source) { bits_ = U32Coder::Load(kSelectors, source); }
+  void Load(FieldReader* reader) { (*reader)(kSelectors, &bits_); }
   bool Store(BitSink* sink) const {
     return U32Coder::Store(bits_, kSelectors, sink);
   }
@@ -330,10 +393,10 @@ class SectionSizes {
     sizes_[idx_section] = size;
   }
 
-  void Load(const SectionBits& bits, BitSource* source) {
+  void Load(const SectionBits& bits, FieldReader* reader) {
     std::fill(sizes_.begin(), sizes_.end(), 0);
-    bits.Foreach([this, source](const int idx) {
-      sizes_[idx] = U32Coder::Load(kSelectors, source);
+    bits.Foreach([this, reader](const int idx) {
+      (*reader)(kSelectors, &sizes_[idx]);
     });
   }
 
@@ -351,49 +414,99 @@ class SectionSizes {
   std::array<uint32_t, SectionBits::kMaxSections> sizes_;  // [bytes]
 };
 
-// Reads sections (and bits/sizes) from BitSource.
+// Returns a copy of the "size" bytes at "from", followed by kFieldReaderSlack
+// zero bytes, so that FieldReader does not read beyond the input.
+Bytes PaddedCopy(const uint8_t* from, const size_t size) {
+  Bytes copy(size + kFieldReaderSlack, 0);
+  memcpy(copy.data(), from, size);
+  return copy;
+}
+
+// Reads sections (and bits/sizes) from the bytes before "end". Any section
+// extending beyond "end" or not matching its stored size is an error.
 class SectionReader {
  public:
-  explicit SectionReader(BitSource* const PIK_RESTRICT source) {
-    section_bits_.Load(source);
-    section_sizes_.Load(section_bits_, source);
+  SectionReader(const uint8_t* from, const uint8_t* end) : end_(end) {
+    // Upper bound on the size of SectionBits and SectionSizes.
+    const size_t max_bits =
+        (1 + SectionBits::kMaxSections) * U32Coder::MaxCompressedBits();
+    const size_t size = std::min<size_t>((max_bits + 7) / 8, end - from);
+    const Bytes copy = PaddedCopy(from, size);
+    BitSource source(copy.data());
+    FieldReader reader(&source, copy.data() + size);
+    section_bits_.Load(&reader);
+    section_sizes_.Load(section_bits_, &reader);
+    ok_ = reader.OK();
 
     // Sections are byte-aligned to simplify skipping over them.
-    section_bytes_ = source->Finalize();
+    section_bytes_ = from + (source.Finalize() - copy.data());
   }
 
   template <class T>
   void operator()(std::unique_ptr<T>* const PIK_RESTRICT ptr) {
     ++idx_section_;
-    if (!section_bits_.TestAndReset(idx_section_)) {
+    if (!ok_ || !section_bits_.TestAndReset(idx_section_)) {
+      return;
+    }
+
+    const uint32_t size = section_sizes_.Get(idx_section_);
+    if (size > end_ - section_bytes_) {
+      ok_ = PIK_FAILURE("Truncated section.");
       return;
     }
+    const Bytes copy = PaddedCopy(section_bytes_, size);
+    section_bytes_ += size;
 
-    // Load from byte-aligned storage.
-    BitSource source(section_bytes_);
-    section_bytes_ += section_sizes_.Get(idx_section_);
+    BitSource source(copy.data());
     ptr->reset(new T);
-    FieldReader reader(&source);
+    FieldReader reader(&source, copy.data() + size);
     (*ptr)->VisitFields(&reader);
-    const uint8_t* const PIK_RESTRICT end = source.Finalize();
-    PIK_CHECK(section_bytes_ == end);
+    if (!reader.OK() || source.Finalize() != copy.data() + size) {
+      ptr->reset();
+      ok_ = PIK_FAILURE("Section size mismatch.");
+    }
   }
 
-  // Returns end pointer.
+  // Returns end pointer or nullptr on failure.
   const uint8_t* const PIK_RESTRICT Finalize() {
     // Skip any remaining/unknown sections.
-    section_bits_.Foreach(
-        [this](const int idx) { section_bytes_ += section_sizes_.Get(idx); });
+    section_bits_.Foreach([this](const int idx) {
+      const uint32_t size = section_sizes_.Get(idx);
+      if (size > end_ - section_bytes_) {
+        ok_ = false;
+        return;
+      }
+      section_bytes_ += size;
+    });
+    if (!ok_) {
+      PIK_NOTIFY_ERROR("Invalid sections.");
+      return nullptr;
+    }
     return section_bytes_;
   }
 
  private:
+  const uint8_t* const PIK_RESTRICT end_;
   // A bit is cleared after loading/skipping that section.
   SectionBits section_bits_;
   SectionSizes section_sizes_;
   int idx_section_ = -1;
   // Points to the start of the current section.
   const uint8_t* PIK_RESTRICT section_bytes_;
+  bool ok_ = true;
+};
+
+class SectionPresence {
+ public:
+  template <class T>
+  void operator()(const std::unique_ptr<T>* const PIK_RESTRICT ptr) {
+    any_present_ |= *ptr != nullptr;
+  }
+
+  bool AnyPresent() const { return any_present_; }
+
+ private:
+  bool any_present_ = false;
 };
 
 class SectionMaxSize {
@@ -407,13 +520,19 @@ class SectionMaxSize {
       FieldMaxSize max_size;
       (*ptr)->VisitFields(&max_size);
       max_bytes_ += max_size.MaxBytes();
+      ++num_present_;
     }
   }
 
-  size_t MaxBytes() const { return max_bytes_; }
+  // Includes the SectionBits and SectionSizes stored before the sections.
+  size_t MaxBytes() const {
+    const size_t max_bits = (1 + num_present_) * U32Coder::MaxCompressedBits();
+    return max_bytes_ + (max_bits + 7) / 8;
+  }
 
  private:
   int idx_section_ = -1;
+  size_t num_present_ = 0;
   size_t max_bytes_ = 0;
 };
 
@@ -467,6 +586,16 @@ class SectionWriter {
   bool ok_ = true;
 };
 
+bool HasSections(const Sections& sections_const) {
+  // VisitSections requires a non-const pointer, but we do not actually
+  // modify the underlying memory.
+  Sections* const PIK_RESTRICT sections =
+      const_cast<Sections*>(&sections_const);
+  SectionPresence presence;
+  sections->VisitSections(&presence);
+  return presence.AnyPresent();
+}
+
 size_t MaxCompressedSectionsSize(const Sections& sections_const) {
   // VisitSections requires a non-const pointer, but we do not actually
   // modify the underlying memory.
@@ -478,9 +607,13 @@ size_t MaxCompressedSectionsSize(const Sections& sections_const) {
 }
 
 const uint8_t* const PIK_RESTRICT
-LoadSections(BitSource* const PIK_RESTRICT source,
+LoadSections(const uint8_t* from, const uint8_t* end,
              Sections* const PIK_RESTRICT sections) {
-  SectionReader reader(source);
+  if (from > end) {
+    PIK_NOTIFY_ERROR("Truncated sections.");
+    return nullptr;
+  }
+  SectionReader reader(from, end);
   sections->VisitSections(&reader);
   return reader.Finalize();
 }
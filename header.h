@@ -46,6 +46,9 @@ struct Header {
     // other components are premultiplied.
     kAlpha = 1,
 
+    // Sections (see below) follow the header. Files without this flag are
+    // identical to those written before sections were introduced.
+    kSections = 2,
 
     // Any non-alpha plane(s) are compressed without loss.
     kWebPLossless = 4,
@@ -55,8 +58,8 @@ struct Header {
   };
 
   // For loading/storing fields from/to the compressed stream. Accepts Bytes,
-  // uint32_t preceded by U32Coder's selector_bits, or uint64_t with U32Coder's
-  // for the low and high 32 bits.
+  // uint32_t or std::vector<uint32_t> preceded by U32Coder's selector_bits, or
+  // uint64_t with U32Coder's for the low and high 32 bits.
   template <class Visitor>
   void VisitFields(Visitor* const PIK_RESTRICT visitor) {
     // Almost all camera images are less than 8K * 8K. We also allow the
@@ -116,25 +119,50 @@ struct EXIF {
   Bytes metadata;
 };
 
+// Independently decodable groups of AC coefficients, which allows decoding
+// the groups in parallel. If this section is absent, the AC coefficients are
+// stored in a single stream.
+struct TileGroups {
+  template <class Visitor>
+  void VisitFields(Visitor* const PIK_RESTRICT visitor) {
+    (*visitor)(0x20100804, &block_rows);
+    (*visitor)(0x20181410, &sizes);
+  }
+
+  // Number of block rows per group; the last group may have fewer.
+  uint32_t block_rows = 0;
+  // Size [bytes] of each group, in top to bottom order. The groups are stored
+  // consecutively, so their byte offsets are the prefix sums of the sizes.
+  std::vector<uint32_t> sizes;
+};
+
 struct Sections {
   template <class Visitor>
   void VisitSections(Visitor* const PIK_RESTRICT visitor) {
     // Sections are read/written in this order, so do not rearrange.
     (*visitor)(&icc);
     (*visitor)(&exif);
+    (*visitor)(&tile_groups);
     // Add new sections before this comment.
   }
 
   // Valid/present if non-null.
   std::unique_ptr<ICC> icc;
   std::unique_ptr<EXIF> exif;
+  std::unique_ptr<TileGroups> tile_groups;
 };
 
+// Returns whether any section is present, i.e. "sections" must be stored and
+// Header::kSections set.
+bool HasSections(const Sections& sections);
+
 // Returns an upper bound on the number of bytes needed to store "sections".
 size_t MaxCompressedSectionsSize(const Sections& sections);
 
+// Loads the sections starting at "from" without reading beyond "end".
+// Returns their end or nullptr if they are invalid or truncated.
 const uint8_t* const PIK_RESTRICT
-LoadSections(SIMD_NAMESPACE::BitSource* const PIK_RESTRICT source,
+LoadSections(const uint8_t* from, const uint8_t* end,
              Sections* const PIK_RESTRICT sections);
 
 // "max_bytes" is the return value of MaxCompressedSectionsSize.
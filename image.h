@@ -241,6 +241,20 @@ Image<T> CopyImage(const Image<T>& image) {
   return copy;
 }
 
+// Returns the rectangle [x0, x0 + xsize) x [y0, y0 + ysize) of "image".
+template <typename T>
+Image<T> CopyRect(const Image<T>& image, const size_t x0, const size_t y0,
+                  const size_t xsize, const size_t ysize) {
+  PIK_ASSERT(x0 + xsize <= image.xsize() && y0 + ysize <= image.ysize());
+  Image<T> copy(xsize, ysize);
+  for (size_t y = 0; y < ysize; ++y) {
+    const T* const PIK_RESTRICT row = image.Row(y0 + y) + x0;
+    T* const PIK_RESTRICT row_copy = copy.Row(y);
+    memcpy(row_copy, row, xsize * sizeof(T));
+  }
+  return copy;
+}
+
 template <typename T>
 bool SamePixels(const Image<T>& image1, const Image<T>& image2) {
   const size_t xsize = image1.xsize();
@@ -470,6 +484,21 @@ void CropToMultipleOf(const size_t x_multiple, const size_t y_multiple,
   }
 }
 
+// Reallocates "*image" unless it already has the given size, in which case
+// its storage is reused and its contents are left unchanged.
+template <class Image>
+void EnsureSize(const size_t xsize, const size_t ysize, Image* image) {
+  if (image->xsize() != xsize || image->ysize() != ysize) {
+    *image = Image(xsize, ysize);
+  }
+}
+
+// Returns the number of bytes occupied by the rows, including padding.
+template <typename T>
+size_t ImageBytes(const Image<T>& image) {
+  return image.bytes_per_row() * image.ysize();
+}
+
 // Computes the minimum and maximum pixel value.
 template <typename T>
 void ImageMinMax(const Image<T>& image, T* const PIK_RESTRICT min,
@@ -652,6 +681,12 @@ class Image3 {
   Plane planes_[kNumPlanes];
 };
 
+template <typename T>
+size_t ImageBytes(const Image3<T>& image) {
+  return ImageBytes(image.plane(0)) + ImageBytes(image.plane(1)) +
+         ImageBytes(image.plane(2));
+}
+
 using Image3B = Image3<uint8_t>;
 // TODO(janwas): rename to ImageS (short/signed)
 using Image3W = Image3<int16_t>;
@@ -737,6 +772,14 @@ Image3<T> CopyImage3(const Image3<T>& image3) {
                    CopyImage(image3.plane(2)));
 }
 
+template <typename T>
+Image3<T> CopyRect(const Image3<T>& image3, const size_t x0, const size_t y0,
+                   const size_t xsize, const size_t ysize) {
+  return Image3<T>(CopyRect(image3.plane(0), x0, y0, xsize, ysize),
+                   CopyRect(image3.plane(1), x0, y0, xsize, ysize),
+                   CopyRect(image3.plane(2), x0, y0, xsize, ysize));
+}
+
 template <typename T>
 bool SamePixels(const Image3<T>& image1, const Image3<T>& image2) {
   const size_t xsize = image1.xsize();
@@ -23,6 +23,7 @@
 #include <utility>
 #include <vector>
 
+#include "ans_decode.h"
 #include "ans_params.h"
 #include "bit_reader.h"
 #include "compiler_specific.h"
@@ -33,13 +34,12 @@
 #include "histogram_decode.h"
 #include "huffman_decode.h"
 #include "huffman_encode.h"
+#include "profiler.h"
 #include "status.h"
 #include "write_bits.h"
 
 namespace pik {
 
-static const int kANSBufferSize = 1 << 16;
-
 static inline int SymbolFromSignedInt(int diff) {
   return diff >= 0 ? 2 * diff : -2 * diff - 1;
 }
@@ -48,44 +48,50 @@ static inline int SignedIntFromSymbol(int symbol) {
   return symbol % 2 == 0 ? symbol / 2 : (-symbol - 1) / 2;
 }
 
-void PredictDCBlock(size_t x, size_t y, size_t xsize, size_t row_stride,
+void PredictDCBlock(size_t x, size_t y, size_t xsize, size_t block_size,
+                    size_t row_stride,
                     std::array<const int16_t* PIK_RESTRICT, 3> row_in,
                     std::array<int16_t* PIK_RESTRICT, 3> row_out) {
-  const int x_in = x * 64;
+  const int x_in = x * block_size;
+  const intptr_t neg_col_stride = -static_cast<intptr_t>(block_size);
   int16_t pred = MinCostPredict(&row_in[1][x_in], x, y, xsize,
-                                -64, -row_stride, false, 0);
+                                neg_col_stride, -row_stride, false, 0);
   row_out[1][x] = row_in[1][x_in] - pred;
   int uv_predictor = GetUVPredictor(&row_in[1][x_in], x, y, xsize,
-                                    -64, -row_stride);
+                                    neg_col_stride, -row_stride);
   for (int c = 0; c < 3; c += 2) {
     int16_t pred = MinCostPredict(&row_in[c][x_in], x, y, xsize,
-                                  -64, -row_stride, true, uv_predictor);
+                                  neg_col_stride, -row_stride, true,
+                                  uv_predictor);
     row_out[c][x] = row_in[c][x_in] - pred;
   }
 }
 
-Image3W PredictDC(const Image3W& coeffs) {
-  Image3W out(coeffs.xsize() / 64, coeffs.ysize());
+Image3W PredictDC(const Image3W& coeffs, const size_t block_size) {
+  Image3W out(coeffs.xsize() / block_size, coeffs.ysize());
   const size_t row_stride = coeffs.plane(0).bytes_per_row() / sizeof(int16_t);
   for (int y = 0; y < out.ysize(); y++) {
     auto row_in = coeffs.Row(y);
     auto row_out = out.Row(y);
     for (int x = 0; x < out.xsize(); x++) {
-      PredictDCBlock(x, y, out.xsize(), row_stride, row_in, row_out);
+      PredictDCBlock(x, y, out.xsize(), block_size, row_stride, row_in,
+                     row_out);
     }
   }
   return out;
 }
 
-void UnpredictDC(Image3W* coeffs) {
-  ImageW dc_y(coeffs->xsize() / 64, coeffs->ysize());
-  ImageW dc_xz(coeffs->xsize() / 64 * 2, coeffs->ysize());
+void UnpredictDC(Image3W* coeffs, const size_t block_size) {
+  PROFILER_FUNC;
+  ImageW dc_y(coeffs->xsize() / block_size, coeffs->ysize());
+  ImageW dc_xz(coeffs->xsize() / block_size * 2, coeffs->ysize());
 
   for (int y = 0; y < coeffs->ysize(); y++) {
     auto row = coeffs->Row(y);
     auto row_y = dc_y.Row(y);
     auto row_xz = dc_xz.Row(y);
-    for (int x = 0, block_x = 0; x < coeffs->xsize(); x += 64, block_x++) {
+    for (int x = 0, block_x = 0; x < coeffs->xsize();
+         x += block_size, block_x++) {
       row_y[block_x] = row[1][x];
 
       row_xz[2 * block_x] = row[0][x];
@@ -93,8 +99,8 @@ void UnpredictDC(Image3W* coeffs) {
     }
   }
 
-  ImageW dc_y_out(coeffs->xsize() / 64, coeffs->ysize());
-  ImageW dc_xz_out(coeffs->xsize() / 64 * 2, coeffs->ysize());
+  ImageW dc_y_out(coeffs->xsize() / block_size, coeffs->ysize());
+  ImageW dc_xz_out(coeffs->xsize() / block_size * 2, coeffs->ysize());
 
   ExpandY(dc_y, &dc_y_out);
   ExpandUV(dc_y_out, dc_xz, &dc_xz_out);
@@ -103,7 +109,8 @@ void UnpredictDC(Image3W* coeffs) {
     auto row_y = dc_y_out.Row(y);
     auto row_xz = dc_xz_out.Row(y);
     auto row_out = coeffs->Row(y);
-    for (int x = 0, block_x = 0; x < coeffs->xsize(); x += 64, block_x++) {
+    for (int x = 0, block_x = 0; x < coeffs->xsize();
+         x += block_size, block_x++) {
       row_out[1][x] = row_y[block_x];
 
       row_out[0][x] = row_xz[2 * block_x];
@@ -348,12 +355,14 @@ size_t EncodedImageSizeInternal(const Image3W& img,
 
 std::string EncodeImage(const Image3W& img, int stride,
                         PikImageSizeInfo* info) {
+  PROFILER_FUNC;
   CoeffProcessor processor(stride);
   return EncodeImageInternal<ANSEncodingData, ANSSymbolWriter>()(
       img, &processor, info);
 }
 
 std::string EncodeAC(const Image3W& coeffs, PikImageSizeInfo* info) {
+  PROFILER_FUNC;
   ACBlockProcessor processor;
   int order[192];
   ComputeCoeffOrder(coeffs, order);
@@ -368,6 +377,7 @@ PIK_INLINE uint32_t MakeToken(const uint32_t context, const uint32_t symbol,
 }
 
 std::string EncodeACFast(const Image3W& coeffs, PikImageSizeInfo* info) {
+  PROFILER_FUNC;
   // Build static context map.
   static const int kNumContexts = 408;
   static const int kStaticZdensContextMap[120] = {
@@ -533,6 +543,9 @@ size_t EncodedImageSize(const Image3W& img, int stride) {
 
 size_t EncodedACSize(const Image3W& coeffs) {
   ACBlockProcessor processor;
+  int order[192];
+  ComputeCoeffOrder(coeffs, order);
+  processor.SetCoeffOrder(order);
   return EncodedImageSizeInternal(coeffs, &processor);
 }
 
@@ -642,74 +655,6 @@ class HuffmanSymbolReader {
   }
 };
 
-class ANSSymbolReader {
- public:
-  bool DecodeHistograms(const size_t num_histograms,
-                        const size_t max_alphabet_size,
-                        const uint8_t* symbol_lut, size_t symbol_lut_size,
-                        BitReader* in) {
-    map_.resize(num_histograms << ANS_LOG_TAB_SIZE);
-    info_.resize(num_histograms << 8);
-    for (int c = 0; c < num_histograms; ++c) {
-      std::vector<int> counts;
-      if (!ReadHistogram(ANS_LOG_TAB_SIZE, &counts, in)) {
-        return PIK_FAILURE("Invalid histogram bitstream.");
-      }
-      if (counts.size() > max_alphabet_size) {
-        return PIK_FAILURE("Alphabet size is too long.");
-      }
-      int offset = 0;
-      for (int i = 0, pos = 0; i < counts.size(); ++i) {
-        int symbol = i;
-        if (symbol_lut != nullptr && symbol < symbol_lut_size) {
-          symbol = symbol_lut[symbol];
-        }
-        info_[(c << 8) + symbol].offset_ = offset;
-        info_[(c << 8) + symbol].freq_ = counts[i];
-        offset += counts[i];
-        if (offset > ANS_TAB_SIZE) {
-          return PIK_FAILURE("Invalid ANS histogram data.");
-        }
-        for (int j = 0; j < counts[i]; ++j, ++pos) {
-          map_[(c << ANS_LOG_TAB_SIZE) + pos] = symbol;
-        }
-      }
-    }
-    return true;
-  }
-
-  int ReadSymbol(const int histo_idx, BitReader* const PIK_RESTRICT br) {
-    if (symbols_left_ == 0) {
-      state_ = br->ReadBits(16);
-      state_ = (state_ << 16) | br->ReadBits(16);
-      br->FillBitBuffer();
-      symbols_left_ = kANSBufferSize;
-    }
-    const uint32_t res = state_ & (ANS_TAB_SIZE - 1);
-    const uint8_t symbol = map_[(histo_idx << ANS_LOG_TAB_SIZE) + res];
-    const ANSSymbolInfo s = info_[(histo_idx << 8) + symbol];
-    state_ = s.freq_ * (state_ >> ANS_LOG_TAB_SIZE) + res - s.offset_;
-    --symbols_left_;
-    if (state_ < (1u << 16)) {
-      state_ = (state_ << 16) | br->PeekFixedBits<16>();
-      br->Advance(16);
-    }
-    return symbol;
-  }
-
-  bool CheckANSFinalState() { return state_ == (ANS_SIGNATURE << 16); }
-
- private:
-  struct ANSSymbolInfo {
-    uint16_t offset_;
-    uint16_t freq_;
-  };
-  size_t symbols_left_ = 0;
-  uint32_t state_ = 0;
-  std::vector<uint8_t> map_;
-  std::vector<ANSSymbolInfo> info_;
-};
-
 bool DecodeHistograms(BitReader* br,
                       const size_t num_contexts,
                       const size_t max_alphabet_size,
@@ -845,6 +790,7 @@ bool DecodeACData(BitReader* const PIK_RESTRICT br,
 }
 
 bool DecodeImage(BitReader* br, int stride,  Image3W* coeffs) {
+  PROFILER_FUNC;
   std::vector<uint8_t> context_map;
   ANSSymbolReader decoder;
   if (!DecodeHistograms(br, CoeffProcessor::num_contexts(), 16,
@@ -860,6 +806,7 @@ bool DecodeImage(BitReader* br, int stride,  Image3W* coeffs) {
 }
 
 bool DecodeAC(BitReader* br, Image3W* coeffs) {
+  PROFILER_FUNC;
   std::vector<uint8_t> context_map;
   ANSSymbolReader decoder;
   if (!DecodeHistograms(br, ACBlockProcessor::num_contexts(), 256,
@@ -397,8 +397,11 @@ class HistogramBuilder {
   std::vector<Histogram> histograms_;
 };
 
-Image3W PredictDC(const Image3W& coeffs);
-void UnpredictDC(Image3W* coeffs);
+// Returns the DC prediction residuals of the blocks of "coeffs", whose DC
+// coefficients are "block_size" apart, i.e. 1 if it only contains the DC.
+Image3W PredictDC(const Image3W& coeffs, size_t block_size = 64);
+// Inverse of PredictDC, in-place on the DC coefficients of "coeffs".
+void UnpredictDC(Image3W* coeffs, size_t block_size = 64);
 
 std::string EncodeImage(const Image3W& img, int stride,
                         PikImageSizeInfo* info);
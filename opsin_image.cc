@@ -15,11 +15,15 @@
 #include "opsin_image.h"
 
 #include <stddef.h>
+#include <string.h>
 #include <array>
 
 #include "approx_cube_root.h"
 #include "compiler_specific.h"
 #include "gamma_correct.h"
+#include "opsin_image_target.h"
+#include "profiler.h"
+#include "simd/dispatch.h"
 
 namespace pik {
 
@@ -36,6 +40,37 @@ void LinearXybTransform(float r, float g, float b, float* PIK_RESTRICT valx,
   *valz = b;
 }
 
+template <typename T>
+void CenteredOpsinDynamicsImageT(const Image3<T>& image, const size_t y0,
+                                 const size_t y1, const float ytob_factor,
+                                 ThreadPool* pool, Image3F* aligned) {
+  PROFILER_FUNC;
+  const size_t xsize = image.xsize();
+  const size_t ysize = y1 - y0;
+  const size_t aligned_xsize = (xsize + 7) / 8 * 8;
+  const size_t aligned_ysize = (ysize + 7) / 8 * 8;
+  EnsureSize(aligned_xsize, aligned_ysize, aligned);
+  RunOnPool(pool, 0, ysize, [&](const int iy, const int thread) {
+    const auto row_out = aligned->Row(iy);
+    dispatch::Run(CenteredOpsinDynamicsPixels(), image.ConstRow(y0 + iy).data(),
+                  xsize, ytob_factor, row_out.data());
+    for (int c = 0; c < 3; ++c) {
+      const float lastval = row_out[c][xsize - 1];
+      for (size_t x = xsize; x < aligned_xsize; ++x) {
+        row_out[c][x] = lastval;
+      }
+    }
+  });
+  for (size_t y = ysize; y < aligned_ysize; ++y) {
+    for (int c = 0; c < 3; ++c) {
+      memcpy(aligned->PlaneRow(c, y), aligned->ConstPlaneRow(c, ysize - 1),
+             aligned_xsize * sizeof(float));
+    }
+  }
+}
+
+}  // namespace
+
 void LinearToXyb(const float rgb[3], float* PIK_RESTRICT valx,
                  float* PIK_RESTRICT valy, float* PIK_RESTRICT valz) {
   float mixed[3];
@@ -46,48 +81,63 @@ void LinearToXyb(const float rgb[3], float* PIK_RESTRICT valx,
   LinearXybTransform(mixed[0], mixed[1], mixed[2], valx, valy, valz);
 }
 
-}  // namespace
-
 void RgbToXyb(uint8_t r, uint8_t g, uint8_t b, float* PIK_RESTRICT valx,
               float* PIK_RESTRICT valy, float* PIK_RESTRICT valz) {
-  // TODO(janwas): replace with polynomial to enable vectorization.
   const float* lut = Srgb8ToLinearTable();
   const float rgb[3] = {lut[r], lut[g], lut[b]};
   LinearToXyb(rgb, valx, valy, valz);
 }
 
-Image3F OpsinDynamicsImage(const Image3B& srgb) {
+Image3F OpsinDynamicsImage(const Image3B& srgb, ThreadPool* pool) {
+  Image3F opsin;
+  OpsinDynamicsImage(srgb, pool, &opsin);
+  return opsin;
+}
+
+Image3F OpsinDynamicsImage(const Image3F& linear, ThreadPool* pool) {
+  Image3F opsin;
+  OpsinDynamicsImage(linear, pool, &opsin);
+  return opsin;
+}
+
+void OpsinDynamicsImage(const Image3B& srgb, ThreadPool* pool,
+                        Image3F* opsin) {
+  PROFILER_FUNC;
   // This is different from butteraugli::OpsinDynamicsImage() in the sense that
   // it does not contain a sensitivity multiplier based on the blurred image.
   const size_t xsize = srgb.xsize();
   const size_t ysize = srgb.ysize();
-  Image3F opsin(xsize, ysize);
-  for (size_t iy = 0; iy < ysize; iy++) {
-    const auto row_in = srgb.ConstRow(iy);
-    auto row_out = opsin.Row(iy);
-    for (size_t ix = 0; ix < xsize; ix++) {
-      RgbToXyb(row_in[0][ix], row_in[1][ix], row_in[2][ix], &row_out[0][ix],
-               &row_out[1][ix], &row_out[2][ix]);
-    }
-  }
-  return opsin;
+  EnsureSize(xsize, ysize, opsin);
+  RunOnPool(pool, 0, ysize, [&](const int iy, const int thread) {
+    dispatch::Run(OpsinDynamicsPixels(), srgb.ConstRow(iy).data(), xsize,
+                  opsin->Row(iy).data());
+  });
 }
 
-Image3F OpsinDynamicsImage(const Image3F& linear) {
+void OpsinDynamicsImage(const Image3F& linear, ThreadPool* pool,
+                        Image3F* opsin) {
+  PROFILER_FUNC;
   // This is different from butteraugli::OpsinDynamicsImage() in the sense that
   // it does not contain a sensitivity multiplier based on the blurred image.
   const size_t xsize = linear.xsize();
   const size_t ysize = linear.ysize();
-  Image3F opsin(xsize, ysize);
-  for (size_t iy = 0; iy < ysize; iy++) {
-    const auto row_in = linear.ConstRow(iy);
-    auto row_out = opsin.Row(iy);
-    for (size_t ix = 0; ix < xsize; ix++) {
-      const float rgb[3] = {row_in[0][ix], row_in[1][ix], row_in[2][ix]};
-      LinearToXyb(rgb, &row_out[0][ix], &row_out[1][ix], &row_out[2][ix]);
-    }
-  }
-  return opsin;
+  EnsureSize(xsize, ysize, opsin);
+  RunOnPool(pool, 0, ysize, [&](const int iy, const int thread) {
+    dispatch::Run(OpsinDynamicsPixels(), linear.ConstRow(iy).data(), xsize,
+                  opsin->Row(iy).data());
+  });
+}
+
+void CenteredOpsinDynamicsImage(const Image3B& srgb, const size_t y0,
+                                const size_t y1, const float ytob_factor,
+                                ThreadPool* pool, Image3F* aligned) {
+  CenteredOpsinDynamicsImageT(srgb, y0, y1, ytob_factor, pool, aligned);
+}
+
+void CenteredOpsinDynamicsImage(const Image3F& linear, const size_t y0,
+                                const size_t y1, const float ytob_factor,
+                                ThreadPool* pool, Image3F* aligned) {
+  CenteredOpsinDynamicsImageT(linear, y0, y1, ytob_factor, pool, aligned);
 }
 
 }  // namespace pik
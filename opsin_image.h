@@ -22,6 +22,7 @@
 #include "compiler_specific.h"
 #include "image.h"
 #include "opsin_params.h"
+#include "thread_pool.h"
 
 namespace pik {
 
@@ -33,9 +34,35 @@ PIK_INLINE void OpsinAbsorbance(const float in[3], float out[3]) {
 }
 
 // Returns the opsin dynamics image corresponding to the given SRGB input image.
-Image3F OpsinDynamicsImage(const Image3B& srgb);
+// Rows are converted in parallel if "pool" is not null.
+Image3F OpsinDynamicsImage(const Image3B& srgb, ThreadPool* pool = nullptr);
 
-Image3F OpsinDynamicsImage(const Image3F& linear);
+Image3F OpsinDynamicsImage(const Image3F& linear, ThreadPool* pool = nullptr);
+
+// Same, but stores the result in "*opsin", whose storage is reused if it
+// already has the size of the input.
+void OpsinDynamicsImage(const Image3B& srgb, ThreadPool* pool, Image3F* opsin);
+void OpsinDynamicsImage(const Image3F& linear, ThreadPool* pool,
+                        Image3F* opsin);
+
+// Encoder front end: stores the opsin dynamics image of pixel rows [y0, y1)
+// of the input, minus kXybCenter and with "ytob_factor" times Y added to B,
+// padded to whole 8x8 blocks by replicating the last column and row, in
+// "*aligned", whose storage is reused if it already has the right size. Same
+// result as AlignImage(OpsinDynamicsImage(rows), 8, aligned) followed by
+// CenterOpsinValues and YToBTransform(ytob_factor), but in a single pass
+// without intermediate images. Rows are converted in parallel if "pool" is
+// not null.
+void CenteredOpsinDynamicsImage(const Image3B& srgb, size_t y0, size_t y1,
+                                float ytob_factor, ThreadPool* pool,
+                                Image3F* aligned);
+void CenteredOpsinDynamicsImage(const Image3F& linear, size_t y0, size_t y1,
+                                float ytob_factor, ThreadPool* pool,
+                                Image3F* aligned);
+
+// Scalar versions of the per-pixel conversion of OpsinDynamicsImage, which
+// produces the same result with SIMD (see opsin_image_target.h).
+void LinearToXyb(const float rgb[3], float* valx, float* valy, float* valz);
 
 void RgbToXyb(uint8_t r, uint8_t g, uint8_t b, float *valx, float *valy,
               float *valz);
@@ -0,0 +1,211 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// WARNING: this translation unit is compiled with different flags. To prevent
+// ODR violations, all functions defined here or in dependent headers must be
+// inlined and/or within namespace SIMD_NAMESPACE.
+
+#include "opsin_image_target.h"
+
+#include "gamma_correct.h"
+#include "opsin_params.h"
+#include "simd/simd.h"
+
+namespace pik {
+namespace SIMD_NAMESPACE {
+namespace {
+
+// Returns "ix" / 3, rounded towards zero like integer division. There is no
+// vector integer division, hence the magnitude is split into 16-bit halves
+// whose quotients are exact in float.
+template <class DI>
+SIMD_INLINE typename DI::V DivideBy3(const DI di, const typename DI::V ix) {
+  const Part<uint32_t, DI::N, SIMD_TARGET> du;
+  const Part<float, DI::N, SIMD_TARGET> df;
+  const auto third = set1(df, 1.0f / 3);
+  // All ones if negative. Unsigned arithmetic because the magnitude of INT_MIN
+  // does not fit in int32_t.
+  const auto sign = cast_to(du, shift_right<31>(ix));
+  const auto magnitude = (cast_to(du, ix) ^ sign) - sign;
+  const auto hi = cast_to(di, shift_right<16>(magnitude));
+  const auto lo = cast_to(di, magnitude & set1(du, 0xFFFFu));
+  // "third" is slightly too large, but by less than half an ulp of both
+  // products, so truncating them yields the integer quotient.
+  const auto quotient_hi = convert_to(di, convert_to(df, hi) * third);
+  const auto remainder_hi = hi - (quotient_hi + quotient_hi + quotient_hi);
+  const auto rest = shift_left<16>(remainder_hi) + lo;
+  const auto quotient_rest = convert_to(di, convert_to(df, rest) * third);
+  const auto quotient =
+      cast_to(du, shift_left<16>(quotient_hi) + quotient_rest);
+  return cast_to(di, (quotient ^ sign) - sign);
+}
+
+// Same as ApproxCubeRoot of approx_cube_root.h.
+template <class D>
+SIMD_INLINE typename D::V ApproxCubeRoot(const D d, const typename D::V y) {
+  const Part<int32_t, D::N, SIMD_TARGET> di;
+  const auto ix = cast_to(di, y);
+  const auto x0 = cast_to(d, set1(di, 0x2a50f200) + DivideBy3(di, ix));
+  const auto one_third = set1(d, 1.0f / 3.0f);
+  const auto two = set1(d, 2.0f);
+  const auto x1 = one_third * (two * x0 + y / (x0 * x0));
+  const auto x2 = one_third * (two * x1 + y / (x1 * x1));
+  return x2;
+}
+
+// Same as LinearToXyb of opsin_image.cc. Multiplications and additions are
+// separate instructions, so that targets with FMA produce the same result.
+template <class D, class V>
+SIMD_INLINE void LinearToXyb(const D d, const V r, const V g, const V b,
+                             V* PIK_RESTRICT valx, V* PIK_RESTRICT valy,
+                             V* PIK_RESTRICT valz) {
+  const float* mix = &kOpsinAbsorbanceMatrix[0];
+  const auto mixed0 = set1(d, mix[0]) * r + set1(d, mix[1]) * g +
+                      set1(d, mix[2]) * b;
+  const auto mixed1 = set1(d, mix[3]) * r + set1(d, mix[4]) * g +
+                      set1(d, mix[5]) * b;
+  const auto mixed2 = set1(d, mix[6]) * r + set1(d, mix[7]) * g +
+                      set1(d, mix[8]) * b;
+  const auto gamma0 = ApproxCubeRoot(d, mixed0);
+  const auto gamma1 = ApproxCubeRoot(d, mixed1);
+  const auto gamma2 = ApproxCubeRoot(d, mixed2);
+  const auto scaled0 = set1(d, kScaleR) * gamma0;
+  const auto scaled1 = set1(d, kScaleG) * gamma1;
+  const auto half = set1(d, 0.5f);
+  *valx = (scaled0 - scaled1) * half;
+  *valy = (scaled0 + scaled1) * half;
+  *valz = gamma2;
+}
+
+// Loads the vectors of linear RGB starting at "x" of the sRGB8 rows.
+template <class D>
+SIMD_INLINE void LoadLinear(const D d,
+                            const uint8_t* const PIK_RESTRICT row[3],
+                            const size_t x, typename D::V* PIK_RESTRICT r,
+                            typename D::V* PIK_RESTRICT g,
+                            typename D::V* PIK_RESTRICT b) {
+  const float* PIK_RESTRICT lut = Srgb8ToLinearTable();
+  // There is no gather on SSE4; the lookups are cheap compared to the rest.
+  SIMD_ALIGN float linear[3][D::N];
+  for (size_t k = 0; k < D::N; ++k) {
+    linear[0][k] = lut[row[0][x + k]];
+    linear[1][k] = lut[row[1][x + k]];
+    linear[2][k] = lut[row[2][x + k]];
+  }
+  *r = load(d, linear[0]);
+  *g = load(d, linear[1]);
+  *b = load(d, linear[2]);
+}
+
+template <class D>
+SIMD_INLINE void LoadLinear(const D d,
+                            const float* const PIK_RESTRICT row[3],
+                            const size_t x, typename D::V* PIK_RESTRICT r,
+                            typename D::V* PIK_RESTRICT g,
+                            typename D::V* PIK_RESTRICT b) {
+  *r = load(d, &row[0][x]);
+  *g = load(d, &row[1][x]);
+  *b = load(d, &row[2][x]);
+}
+
+template <typename T>
+SIMD_INLINE void OpsinDynamics(const T* const PIK_RESTRICT row_in[3],
+                               const size_t xsize,
+                               float* const PIK_RESTRICT row_out[3]) {
+  const Full<float, SIMD_TARGET> d;
+  for (size_t x = 0; x < xsize; x += d.N) {
+    Full<float, SIMD_TARGET>::V r, g, b, valx, valy, valz;
+    LoadLinear(d, row_in, x, &r, &g, &b);
+    LinearToXyb(d, r, g, b, &valx, &valy, &valz);
+    store(valx, d, &row_out[0][x]);
+    store(valy, d, &row_out[1][x]);
+    store(valz, d, &row_out[2][x]);
+  }
+}
+
+// Same as OpsinDynamics followed by CenterOpsinValues and YToBTransform.
+template <typename T>
+SIMD_INLINE void CenteredOpsinDynamics(const T* const PIK_RESTRICT row_in[3],
+                                       const size_t xsize,
+                                       const float ytob_factor,
+                                       float* const PIK_RESTRICT row_out[3]) {
+  const Full<float, SIMD_TARGET> d;
+  const auto center_x = set1(d, kXybCenter[0]);
+  const auto center_y = set1(d, kXybCenter[1]);
+  const auto center_b = set1(d, kXybCenter[2]);
+  const auto factor = set1(d, ytob_factor);
+  for (size_t x = 0; x < xsize; x += d.N) {
+    Full<float, SIMD_TARGET>::V r, g, b, valx, valy, valz;
+    LoadLinear(d, row_in, x, &r, &g, &b);
+    LinearToXyb(d, r, g, b, &valx, &valy, &valz);
+    const auto centered_y = valy - center_y;
+    store(valx - center_x, d, &row_out[0][x]);
+    store(centered_y, d, &row_out[1][x]);
+    store(valz - center_b + factor * centered_y, d, &row_out[2][x]);
+  }
+}
+
+}  // namespace
+}  // namespace SIMD_NAMESPACE
+
+template <>
+void OpsinDynamicsPixels::operator()<SIMD_TARGET>(
+    const uint8_t* const PIK_RESTRICT row_in[3], const size_t xsize,
+    float* const PIK_RESTRICT row_out[3]) {
+  SIMD_NAMESPACE::OpsinDynamics(row_in, xsize, row_out);
+}
+
+template <>
+void OpsinDynamicsPixels::operator()<SIMD_TARGET>(
+    const float* const PIK_RESTRICT row_in[3], const size_t xsize,
+    float* const PIK_RESTRICT row_out[3]) {
+  SIMD_NAMESPACE::OpsinDynamics(row_in, xsize, row_out);
+}
+
+template <>
+void CenteredOpsinDynamicsPixels::operator()<SIMD_TARGET>(
+    const uint8_t* const PIK_RESTRICT row_in[3], const size_t xsize,
+    const float ytob_factor, float* const PIK_RESTRICT row_out[3]) {
+  SIMD_NAMESPACE::CenteredOpsinDynamics(row_in, xsize, ytob_factor, row_out);
+}
+
+template <>
+void CenteredOpsinDynamicsPixels::operator()<SIMD_TARGET>(
+    const float* const PIK_RESTRICT row_in[3], const size_t xsize,
+    const float ytob_factor, float* const PIK_RESTRICT row_out[3]) {
+  SIMD_NAMESPACE::CenteredOpsinDynamics(row_in, xsize, ytob_factor, row_out);
+}
+
+template <>
+void DivideBy3Ints::operator()<SIMD_TARGET>(const int32_t* PIK_RESTRICT from,
+                                            const size_t num,
+                                            int32_t* PIK_RESTRICT to) {
+  using namespace SIMD_NAMESPACE;
+  const Full<int32_t, SIMD_TARGET> di;
+  for (size_t i = 0; i < num; i += di.N) {
+    store(DivideBy3(di, load(di, from + i)), di, to + i);
+  }
+}
+
+template <>
+void ApproxCubeRootFloats::operator()<SIMD_TARGET>(
+    const float* PIK_RESTRICT from, const size_t num, float* PIK_RESTRICT to) {
+  using namespace SIMD_NAMESPACE;
+  const Full<float, SIMD_TARGET> d;
+  for (size_t i = 0; i < num; i += d.N) {
+    store(ApproxCubeRoot(d, load(d, from + i)), d, to + i);
+  }
+}
+
+}  // namespace pik
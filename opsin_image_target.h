@@ -0,0 +1,75 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OPSIN_IMAGE_TARGET_H_
+#define OPSIN_IMAGE_TARGET_H_
+
+// Opsin dynamics kernels compiled once per instruction set (see Makefile) and
+// selected at runtime via dispatch::Run. All of them produce the same result
+// on every instruction set, which is also that of RgbToXyb/LinearToXyb.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compiler_specific.h"
+
+namespace pik {
+
+// Converts "xsize" sRGB or linear RGB pixels of the planes "row_in" to XYB,
+// see OpsinDynamicsImage. Whole vectors are converted, hence the padding of
+// the rows is accessed. Requires that the rows are 32-bytes aligned.
+//
+// Usage: dispatch::Run(OpsinDynamicsPixels(), row_in, xsize, row_out);
+struct OpsinDynamicsPixels {
+  template <class Target>
+  void operator()(const uint8_t* const PIK_RESTRICT row_in[3], size_t xsize,
+                  float* const PIK_RESTRICT row_out[3]);
+  template <class Target>
+  void operator()(const float* const PIK_RESTRICT row_in[3], size_t xsize,
+                  float* const PIK_RESTRICT row_out[3]);
+};
+
+// Same as OpsinDynamicsPixels, then subtracts kXybCenter (see
+// CenterOpsinValues) and adds "ytob_factor" times the centered Y to B (see
+// YToBTransform), so that the encoder needs no separate passes for them.
+struct CenteredOpsinDynamicsPixels {
+  template <class Target>
+  void operator()(const uint8_t* const PIK_RESTRICT row_in[3], size_t xsize,
+                  float ytob_factor, float* const PIK_RESTRICT row_out[3]);
+  template <class Target>
+  void operator()(const float* const PIK_RESTRICT row_in[3], size_t xsize,
+                  float ytob_factor, float* const PIK_RESTRICT row_out[3]);
+};
+
+// The helpers of the above kernels, exposed so that opsin_image_test can
+// compare them with the scalar code. Both convert "num" values, which must be
+// a multiple of the vector size, and require 32-bytes aligned arrays.
+
+// Same as "from"[i] / 3 for all int32_t.
+struct DivideBy3Ints {
+  template <class Target>
+  void operator()(const int32_t* PIK_RESTRICT from, size_t num,
+                  int32_t* PIK_RESTRICT to);
+};
+
+// Same as ApproxCubeRoot of approx_cube_root.h.
+struct ApproxCubeRootFloats {
+  template <class Target>
+  void operator()(const float* PIK_RESTRICT from, size_t num,
+                  float* PIK_RESTRICT to);
+};
+
+}  // namespace pik
+
+#endif  // OPSIN_IMAGE_TARGET_H_
@@ -0,0 +1,170 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks that the kernels of opsin_image_target.cc produce bit-identical
+// results to the scalar code on every instruction set, which the encoder and
+// pik_bench rely on.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <random>
+
+#include "approx_cube_root.h"
+#include "gamma_correct.h"
+#include "opsin_image.h"
+#include "opsin_image_target.h"
+#include "simd/dispatch.h"
+#include "simd/simd.h"
+
+namespace pik {
+namespace {
+
+// Number of values per kernel call; a multiple of all vector sizes.
+constexpr size_t kChunk = 1 << 16;
+
+SIMD_ALIGN int32_t ints[kChunk];
+SIMD_ALIGN int32_t quotients[kChunk];
+SIMD_ALIGN float floats[kChunk];
+SIMD_ALIGN float roots[kChunk];
+SIMD_ALIGN uint8_t bytes[3][kChunk];
+SIMD_ALIGN float linear[3][kChunk];
+SIMD_ALIGN float xyb[3][kChunk];
+
+bool SameBits(const float a, const float b) {
+  return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// Returns the float with the given bit pattern.
+float BitsToFloat(const uint32_t bits) {
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+struct TestTarget {
+  template <class Target>
+  void operator()(int* failures) {
+    const int target = Target::value;
+
+    // DivideBy3Ints, exhaustively.
+    for (uint64_t begin = 0; begin < (1ULL << 32); begin += kChunk) {
+      for (size_t i = 0; i < kChunk; ++i) {
+        ints[i] = static_cast<int32_t>(static_cast<uint32_t>(begin + i));
+      }
+      DivideBy3Ints().operator()<Target>(ints, kChunk, quotients);
+      for (size_t i = 0; i < kChunk; ++i) {
+        if (quotients[i] != ints[i] / 3) {
+          printf("target %x: DivideBy3(%d) = %d, expected %d\n", target,
+                 ints[i], quotients[i], ints[i] / 3);
+          ++*failures;
+          return;
+        }
+      }
+    }
+
+    // ApproxCubeRootFloats for all finite floats.
+    for (uint64_t begin = 0; begin < (1ULL << 32); begin += kChunk) {
+      for (size_t i = 0; i < kChunk; ++i) {
+        floats[i] = BitsToFloat(static_cast<uint32_t>(begin + i));
+        if (!std::isfinite(floats[i])) floats[i] = 0.0f;
+      }
+      ApproxCubeRootFloats().operator()<Target>(floats, kChunk, roots);
+      for (size_t i = 0; i < kChunk; ++i) {
+        if (!SameBits(roots[i], ApproxCubeRoot(floats[i]))) {
+          printf("target %x: ApproxCubeRoot(%.9g) = %.9g, expected %.9g\n",
+                 target, floats[i], roots[i], ApproxCubeRoot(floats[i]));
+          ++*failures;
+          return;
+        }
+      }
+    }
+
+    // OpsinDynamicsPixels for all sRGB8 colors and their linear values.
+    const float* lut = Srgb8ToLinearTable();
+    for (uint32_t begin = 0; begin < (1u << 24); begin += kChunk) {
+      for (size_t i = 0; i < kChunk; ++i) {
+        for (int c = 0; c < 3; ++c) {
+          bytes[c][i] = (begin + i) >> (8 * c);
+          linear[c][i] = lut[bytes[c][i]];
+        }
+      }
+      if (!CheckPixels<Target>(target, bytes, failures) ||
+          !CheckPixels<Target>(target, linear, failures)) {
+        return;
+      }
+    }
+
+    // OpsinDynamicsPixels for linear values that are not in the table.
+    std::mt19937 rng(129);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    for (int rep = 0; rep < 64; ++rep) {
+      for (size_t i = 0; i < kChunk; ++i) {
+        for (int c = 0; c < 3; ++c) {
+          linear[c][i] = dist(rng);
+        }
+      }
+      if (!CheckPixels<Target>(target, linear, failures)) return;
+    }
+  }
+
+  // Returns whether OpsinDynamicsPixels<Target> of "in" equals LinearToXyb.
+  template <class Target, typename T>
+  bool CheckPixels(const int target, T in[3][kChunk], int* failures) {
+    const T* const row_in[3] = {in[0], in[1], in[2]};
+    float* const row_out[3] = {xyb[0], xyb[1], xyb[2]};
+    OpsinDynamicsPixels().operator()<Target>(row_in, kChunk, row_out);
+    for (size_t i = 0; i < kChunk; ++i) {
+      float expected[3];
+      XybOf(in, i, &expected[0], &expected[1], &expected[2]);
+      for (int c = 0; c < 3; ++c) {
+        if (!SameBits(xyb[c][i], expected[c])) {
+          printf("target %x: OpsinDynamicsPixels(%s) pixel %zu channel %d ="
+                 " %.9g, expected %.9g\n", target,
+                 sizeof(T) == 1 ? "sRGB" : "linear", i, c, xyb[c][i],
+                 expected[c]);
+          ++*failures;
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static void XybOf(uint8_t in[3][kChunk], const size_t i, float* valx,
+                    float* valy, float* valz) {
+    RgbToXyb(in[0][i], in[1][i], in[2][i], valx, valy, valz);
+  }
+
+  static void XybOf(float in[3][kChunk], const size_t i, float* valx,
+                    float* valy, float* valz) {
+    const float rgb[3] = {in[0][i], in[1][i], in[2][i]};
+    LinearToXyb(rgb, valx, valy, valz);
+  }
+};
+
+int RunTests() {
+  int failures = 0;
+  const int targets = dispatch::SupportedTargets();
+  dispatch::ForeachTarget(targets, TestTarget(), &failures);
+  if (failures != 0) return 1;
+  printf("Successfully tested instruction sets: 0x%x.\n", targets);
+  return 0;
+}
+
+}  // namespace
+}  // namespace pik
+
+int main() { return pik::RunTests(); }
@@ -17,89 +17,64 @@
 #include <array>
 
 #include "gamma_correct.h"
+#include "opsin_inverse_target.h"
+#include "profiler.h"
+#include "simd/dispatch.h"
 #include "simd/simd.h"
 
 namespace pik {
 
-void CenteredOpsinToSrgb(const Image3F& opsin, Image3B* srgb) {
-  using namespace SIMD_NAMESPACE;
-  const Full<float, SIMD_TARGET> d;
-  const auto lut_scale = set1(d, 16.0f);
-  const uint8_t* PIK_RESTRICT lut_plus = LinearToSrgb8TablePlusQuarter();
-  const uint8_t* PIK_RESTRICT lut_minus = LinearToSrgb8TableMinusQuarter();
-  *srgb = Image3B(opsin.xsize(), opsin.ysize());
-  for (int y = 0; y < srgb->ysize(); ++y) {
-    auto row_in = opsin.Row(y);
-    auto row_out = srgb->Row(y);
-    for (int x = 0; x < srgb->xsize(); x += d.N) {
-      SIMD_ALIGN int buf[3][d.N];
-      const auto valx = load(d, &row_in[0][x]) + set1(d, kXybCenter[0]);
-      const auto valy = load(d, &row_in[1][x]) + set1(d, kXybCenter[1]);
-      const auto valb = load(d, &row_in[2][x]) + set1(d, kXybCenter[2]);
-      Full<float, SIMD_TARGET>::V out_r, out_g, out_b;
-      XybToRgb(d, valx, valy, valb, &out_r, &out_g, &out_b);
-      const Full<int32_t, SIMD_TARGET> di;
-      store(nearest_int(out_r * lut_scale), di, &buf[0][0]);
-      store(nearest_int(out_g * lut_scale), di, &buf[1][0]);
-      store(nearest_int(out_b * lut_scale), di, &buf[2][0]);
-      const int xy = x + y;
-      for (int k = 0; k < d.N; ++k) {
-        const uint8_t* PIK_RESTRICT lut = (xy + k) % 2 ? lut_plus : lut_minus;
-        row_out[0][x + k] = lut[buf[0][k]];
-        row_out[1][x + k] = lut[buf[1][k]];
-        row_out[2][x + k] = lut[buf[2][k]];
-      }
-    }
-  }
+namespace {
+
+template <typename T>
+void CenteredOpsinToSrgbRowT(const Image3F& opsin, const size_t y_in,
+                             Image3<T>* srgb, const size_t y_out) {
+  const auto row_in = opsin.ConstRow(y_in);
+  const auto row_out = srgb->Row(y_out);
+  dispatch::Run(CenteredOpsinToSrgbPixels(), row_in.data(), srgb->xsize(),
+                y_out, row_out.data());
 }
 
-void CenteredOpsinToSrgb(const Image3F& opsin, Image3U* srgb) {
-  using namespace SIMD_NAMESPACE;
-  const Full<float, SIMD_TARGET> d;
-  const auto scale_to_16bit = set1(d, 257.0f);
-  *srgb = Image3U(opsin.xsize(), opsin.ysize());
-  for (int y = 0; y < srgb->ysize(); ++y) {
-    auto row_in = opsin.Row(y);
-    auto row_out = srgb->Row(y);
-    for (int x = 0; x < srgb->xsize(); x += d.N) {
-      const auto valx = load(d, &row_in[0][x]) + set1(d, kXybCenter[0]);
-      const auto valy = load(d, &row_in[1][x]) + set1(d, kXybCenter[1]);
-      const auto valb = load(d, &row_in[2][x]) + set1(d, kXybCenter[2]);
-      Full<float, SIMD_TARGET>::V out_r, out_g, out_b;
-      XybToRgb(d, valx, valy, valb, &out_r, &out_g, &out_b);
-      out_r = LinearToSrgbPoly(d, out_r) * scale_to_16bit;
-      out_g = LinearToSrgbPoly(d, out_g) * scale_to_16bit;
-      out_b = LinearToSrgbPoly(d, out_b) * scale_to_16bit;
-      // Half-vectors of half-width lanes.
-      const Part<uint16_t, d.N, SIMD_TARGET> d16;
-      const auto u16_r = convert_to(d16, nearest_int(out_r));
-      const auto u16_g = convert_to(d16, nearest_int(out_g));
-      const auto u16_b = convert_to(d16, nearest_int(out_b));
-      store(u16_r, d16, &row_out[0][x]);
-      store(u16_g, d16, &row_out[1][x]);
-      store(u16_b, d16, &row_out[2][x]);
-    }
-  }
+template <typename T>
+void CenteredOpsinToSrgbT(const Image3F& opsin, Image3<T>* srgb,
+                          ThreadPool* pool) {
+  PROFILER_FUNC;
+  *srgb = Image3<T>(opsin.xsize(), opsin.ysize());
+  RunOnPool(pool, 0, srgb->ysize(), [&](const int y, const int thread) {
+    CenteredOpsinToSrgbRow(opsin, y, srgb, y);
+  });
 }
 
-void CenteredOpsinToSrgb(const Image3F& opsin, Image3F* srgb) {
-  using namespace SIMD_NAMESPACE;
-  const Full<float, SIMD_TARGET> d;
-  *srgb = Image3F(opsin.xsize(), opsin.ysize());
-  for (int y = 0; y < srgb->ysize(); ++y) {
-    auto row_in = opsin.Row(y);
-    auto row_out = srgb->Row(y);
-    for (int x = 0; x < srgb->xsize(); x += d.N) {
-      const auto valx = load(d, &row_in[0][x]) + set1(d, kXybCenter[0]);
-      const auto valy = load(d, &row_in[1][x]) + set1(d, kXybCenter[1]);
-      const auto valb = load(d, &row_in[2][x]) + set1(d, kXybCenter[2]);
-      Full<float, SIMD_TARGET>::V out_r, out_g, out_b;
-      XybToRgb(d, valx, valy, valb, &out_r, &out_g, &out_b);
-      store(out_r, d, &row_out[0][x]);
-      store(out_g, d, &row_out[1][x]);
-      store(out_b, d, &row_out[2][x]);
-    }
-  }
+}  // namespace
+
+void CenteredOpsinToSrgbRow(const Image3F& opsin, const size_t y_in,
+                            Image3B* srgb, const size_t y_out) {
+  CenteredOpsinToSrgbRowT(opsin, y_in, srgb, y_out);
+}
+
+void CenteredOpsinToSrgbRow(const Image3F& opsin, const size_t y_in,
+                            Image3U* srgb, const size_t y_out) {
+  CenteredOpsinToSrgbRowT(opsin, y_in, srgb, y_out);
+}
+
+void CenteredOpsinToSrgbRow(const Image3F& opsin, const size_t y_in,
+                            Image3F* srgb, const size_t y_out) {
+  CenteredOpsinToSrgbRowT(opsin, y_in, srgb, y_out);
+}
+
+void CenteredOpsinToSrgb(const Image3F& opsin, Image3B* srgb,
+                         ThreadPool* pool) {
+  CenteredOpsinToSrgbT(opsin, srgb, pool);
+}
+
+void CenteredOpsinToSrgb(const Image3F& opsin, Image3U* srgb,
+                         ThreadPool* pool) {
+  CenteredOpsinToSrgbT(opsin, srgb, pool);
+}
+
+void CenteredOpsinToSrgb(const Image3F& opsin, Image3F* srgb,
+                         ThreadPool* pool) {
+  CenteredOpsinToSrgbT(opsin, srgb, pool);
 }
 
 Image3B OpsinDynamicsInverse(const Image3F& opsin) {
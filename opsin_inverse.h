@@ -24,6 +24,7 @@
 #include "image.h"
 #include "opsin_params.h"
 #include "simd/simd.h"
+#include "thread_pool.h"
 
 namespace pik {
 
@@ -85,9 +86,24 @@ PIK_INLINE void XybToRgb(D d, const V x, const V y, const V b,
   *blue = Clamp0To255(d, MixedToBlue(d, r_mix, g_mix, b_mix));
 }
 
-void CenteredOpsinToSrgb(const Image3F& opsin, Image3B* srgb);
-void CenteredOpsinToSrgb(const Image3F& opsin, Image3U* srgb);
-void CenteredOpsinToSrgb(const Image3F& opsin, Image3F* srgb);
+// Converts row "y_in" of "opsin" into row "y_out" of "srgb", which must not be
+// wider than "opsin". Whole vectors are converted, hence the padding of both rows
+// is accessed. The 8-bit output is dithered depending on the parity of
+// x + y_out.
+void CenteredOpsinToSrgbRow(const Image3F& opsin, size_t y_in, Image3B* srgb,
+                            size_t y_out);
+void CenteredOpsinToSrgbRow(const Image3F& opsin, size_t y_in, Image3U* srgb,
+                            size_t y_out);
+void CenteredOpsinToSrgbRow(const Image3F& opsin, size_t y_in, Image3F* srgb,
+                            size_t y_out);
+
+// Rows are converted in parallel if "pool" is not null.
+void CenteredOpsinToSrgb(const Image3F& opsin, Image3B* srgb,
+                         ThreadPool* pool = nullptr);
+void CenteredOpsinToSrgb(const Image3F& opsin, Image3U* srgb,
+                         ThreadPool* pool = nullptr);
+void CenteredOpsinToSrgb(const Image3F& opsin, Image3F* srgb,
+                         ThreadPool* pool = nullptr);
 
 Image3B OpsinDynamicsInverse(const Image3F& opsin);
 Image3F LinearFromOpsin(const Image3F& opsin);
@@ -0,0 +1,102 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// WARNING: this translation unit is compiled with different flags. To prevent
+// ODR violations, all functions defined here or in dependent headers must be
+// inlined and/or within namespace SIMD_NAMESPACE.
+
+#include "opsin_inverse_target.h"
+
+#include "gamma_correct.h"
+#include "opsin_inverse.h"
+#include "simd/simd.h"
+
+namespace pik {
+
+template <>
+void CenteredOpsinToSrgbPixels::operator()<SIMD_TARGET>(
+    const float* const PIK_RESTRICT row_in[3], const size_t xsize,
+    const size_t y, uint8_t* const PIK_RESTRICT row_out[3]) {
+  using namespace SIMD_NAMESPACE;
+  const Full<float, SIMD_TARGET> d;
+  const uint8_t* PIK_RESTRICT lut_plus = LinearToSrgb8TablePlusQuarter();
+  const uint8_t* PIK_RESTRICT lut_minus = LinearToSrgb8TableMinusQuarter();
+  const auto lut_scale = set1(d, 16.0f);
+  for (size_t x = 0; x < xsize; x += d.N) {
+    SIMD_ALIGN int buf[3][d.N];
+    const auto valx = load(d, &row_in[0][x]) + set1(d, kXybCenter[0]);
+    const auto valy = load(d, &row_in[1][x]) + set1(d, kXybCenter[1]);
+    const auto valb = load(d, &row_in[2][x]) + set1(d, kXybCenter[2]);
+    Full<float, SIMD_TARGET>::V out_r, out_g, out_b;
+    XybToRgb(d, valx, valy, valb, &out_r, &out_g, &out_b);
+    const Full<int32_t, SIMD_TARGET> di;
+    store(nearest_int(out_r * lut_scale), di, &buf[0][0]);
+    store(nearest_int(out_g * lut_scale), di, &buf[1][0]);
+    store(nearest_int(out_b * lut_scale), di, &buf[2][0]);
+    const size_t xy = x + y;
+    for (size_t k = 0; k < d.N; ++k) {
+      const uint8_t* PIK_RESTRICT lut = (xy + k) % 2 ? lut_plus : lut_minus;
+      row_out[0][x + k] = lut[buf[0][k]];
+      row_out[1][x + k] = lut[buf[1][k]];
+      row_out[2][x + k] = lut[buf[2][k]];
+    }
+  }
+}
+
+template <>
+void CenteredOpsinToSrgbPixels::operator()<SIMD_TARGET>(
+    const float* const PIK_RESTRICT row_in[3], const size_t xsize,
+    const size_t y, uint16_t* const PIK_RESTRICT row_out[3]) {
+  using namespace SIMD_NAMESPACE;
+  const Full<float, SIMD_TARGET> d;
+  const auto scale_to_16bit = set1(d, 257.0f);
+  for (size_t x = 0; x < xsize; x += d.N) {
+    const auto valx = load(d, &row_in[0][x]) + set1(d, kXybCenter[0]);
+    const auto valy = load(d, &row_in[1][x]) + set1(d, kXybCenter[1]);
+    const auto valb = load(d, &row_in[2][x]) + set1(d, kXybCenter[2]);
+    Full<float, SIMD_TARGET>::V out_r, out_g, out_b;
+    XybToRgb(d, valx, valy, valb, &out_r, &out_g, &out_b);
+    out_r = LinearToSrgbPoly(d, out_r) * scale_to_16bit;
+    out_g = LinearToSrgbPoly(d, out_g) * scale_to_16bit;
+    out_b = LinearToSrgbPoly(d, out_b) * scale_to_16bit;
+    // Half-vectors of half-width lanes.
+    const Part<uint16_t, d.N, SIMD_TARGET> d16;
+    const auto u16_r = convert_to(d16, nearest_int(out_r));
+    const auto u16_g = convert_to(d16, nearest_int(out_g));
+    const auto u16_b = convert_to(d16, nearest_int(out_b));
+    store(u16_r, d16, &row_out[0][x]);
+    store(u16_g, d16, &row_out[1][x]);
+    store(u16_b, d16, &row_out[2][x]);
+  }
+}
+
+template <>
+void CenteredOpsinToSrgbPixels::operator()<SIMD_TARGET>(
+    const float* const PIK_RESTRICT row_in[3], const size_t xsize,
+    const size_t y, float* const PIK_RESTRICT row_out[3]) {
+  using namespace SIMD_NAMESPACE;
+  const Full<float, SIMD_TARGET> d;
+  for (size_t x = 0; x < xsize; x += d.N) {
+    const auto valx = load(d, &row_in[0][x]) + set1(d, kXybCenter[0]);
+    const auto valy = load(d, &row_in[1][x]) + set1(d, kXybCenter[1]);
+    const auto valb = load(d, &row_in[2][x]) + set1(d, kXybCenter[2]);
+    Full<float, SIMD_TARGET>::V out_r, out_g, out_b;
+    XybToRgb(d, valx, valy, valb, &out_r, &out_g, &out_b);
+    store(out_r, d, &row_out[0][x]);
+    store(out_g, d, &row_out[1][x]);
+    store(out_b, d, &row_out[2][x]);
+  }
+}
+
+}  // namespace pik
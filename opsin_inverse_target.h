@@ -0,0 +1,49 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OPSIN_INVERSE_TARGET_H_
+#define OPSIN_INVERSE_TARGET_H_
+
+// Color conversion kernels compiled once per instruction set (see Makefile)
+// and selected at runtime via dispatch::Run. All of them produce the same
+// result on every instruction set.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compiler_specific.h"
+
+namespace pik {
+
+// Converts "xsize" pixels of the centered opsin planes "row_in" to sRGB, see
+// CenteredOpsinToSrgbRow. Whole vectors are converted, hence the padding of
+// the rows is accessed. The 8-bit output is dithered depending on the parity
+// of x + "y". Requires that the rows are 32-bytes aligned.
+//
+// Usage: dispatch::Run(CenteredOpsinToSrgbPixels(), row_in, xsize, y, row_out);
+struct CenteredOpsinToSrgbPixels {
+  template <class Target>
+  void operator()(const float* const PIK_RESTRICT row_in[3], size_t xsize,
+                  size_t y, uint8_t* const PIK_RESTRICT row_out[3]);
+  template <class Target>
+  void operator()(const float* const PIK_RESTRICT row_in[3], size_t xsize,
+                  size_t y, uint16_t* const PIK_RESTRICT row_out[3]);
+  template <class Target>
+  void operator()(const float* const PIK_RESTRICT row_in[3], size_t xsize,
+                  size_t y, float* const PIK_RESTRICT row_out[3]);
+};
+
+}  // namespace pik
+
+#endif  // OPSIN_INVERSE_TARGET_H_
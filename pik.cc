@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <array>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -30,6 +31,7 @@
 #include "bits.h"
 #include "byte_order.h"
 #include "butteraugli_comparator.h"
+#include "cache_aligned.h"
 #include "compiler_specific.h"
 #include "compressed_image.h"
 #include "header.h"
@@ -37,7 +39,10 @@
 #include "opsin_image.h"
 #include "opsin_inverse.h"
 #include "pik_alpha.h"
+#include "profiler.h"
 #include "quantizer.h"
+#include "rate_control.h"
+#include "thread_pool.h"
 
 // If true, prints the quantization maps at each iteration.
 bool FLAGS_dump_quant_state = false;
@@ -72,6 +77,13 @@ uint32_t DecodeU32(const uint8_t* src) {
   return val;
 }
 
+// YToB correlation if it is not searched for.
+const int kDefaultYToB = 120;
+
+// Quantization of fast_mode, relative to AdaptiveQuantizationMap.
+const float kFastQuantDC = 0.76953163840390082;
+const float kFastQuantAC = 1.52005680264295;
+
 inline int Clamp(int minval, int maxval, int val) {
   return std::min(maxval, std::max(minval, val));
 }
@@ -184,18 +196,164 @@ void DumpHeatmaps(const PikInfo* info,
               ba_target, 1.5f * ba_target);
 }
 
+// Rectangle of [x0, x0 + xsize) x [y0, y0 + ysize) blocks.
+struct BlockRect {
+  int x0;
+  int y0;
+  int xsize;
+  int ysize;
+};
+
+// Returns rectangles covering all blocks whose AC quantization differs between
+// "prev" and "cur". Blocks within the same band of kBandHeight block rows are
+// merged into one rectangle unless they are more than kMaxGap blocks apart,
+// because their butteraugli windows would overlap anyway.
+std::vector<BlockRect> ChangedBlocks(const Image<int>& prev,
+                                     const Image<int>& cur) {
+  static const int kBandHeight = 8;
+  static const int kMaxGap = 16;
+  std::vector<BlockRect> rects;
+  for (int band_y0 = 0; band_y0 < cur.ysize(); band_y0 += kBandHeight) {
+    const int band_y1 = std::min<int>(cur.ysize(), band_y0 + kBandHeight);
+    int x0 = -1;
+    int x1 = -1;
+    int y0 = band_y1;
+    int y1 = band_y0;
+    for (int x = 0; x < cur.xsize(); ++x) {
+      bool changed = false;
+      for (int y = band_y0; y < band_y1; ++y) {
+        if (prev.Row(y)[x] != cur.Row(y)[x]) {
+          y0 = std::min(y0, y);
+          y1 = std::max(y1, y + 1);
+          changed = true;
+        }
+      }
+      if (!changed) continue;
+      if (x0 >= 0 && x - x1 > kMaxGap) {
+        rects.push_back({x0, y0, x1 - x0, y1 - y0});
+        x0 = -1;
+      }
+      if (x0 < 0) x0 = x;
+      x1 = x + 1;
+    }
+    if (x0 >= 0) {
+      rects.push_back({x0, y0, x1 - x0, y1 - y0});
+    }
+  }
+  return rects;
+}
+
+// Decodes the image with the current quantizer and compares it to the
+// original. After the first evaluation, only the blocks whose quantization
+// changed since the previous call (plus the halo of blocks and pixels that
+// depend on them) are recomputed, unless that would not be cheaper.
+class ButteraugliEvaluator {
+ public:
+  ButteraugliEvaluator(const Image3F& opsin_orig,
+                       const EncoderSearchState& search, int ytob,
+                       ThreadPool* pool)
+      : comparator_(opsin_orig), search_(search), ytob_(ytob), pool_(pool),
+        xsize_(opsin_orig.xsize()), ysize_(opsin_orig.ysize()) {}
+
+  void Evaluate(const Quantizer& quantizer) {
+    // Reconstructed blocks depend on the quantization of blocks up to this
+    // many blocks away, see EncoderSearchState::ReconOpsinImageCrop.
+    static const int kReconHalo = 2;
+    std::vector<BlockRect> rects;
+    bool full = (srgb_.xsize() == 0 ||
+                 quantizer.global_scale() != global_scale_ ||
+                 quantizer.quant_dc() != quant_dc_);
+    if (!full) {
+      rects = ChangedBlocks(quant_img_ac_, quantizer.quant_img_ac());
+      // Each region requires butteraugli on a window of 2 * DiffmapSupport()
+      // pixels more in each direction, see
+      // ButteraugliComparator::CompareRegion.
+      static const int kWindowHalo =
+          2 * kReconHalo + 2 * ((2 * butteraugli::DiffmapSupport() + 7) / 8);
+      size_t work = 0;
+      for (const BlockRect& r : rects) {
+        work += std::min<int>(r.xsize + kWindowHalo, search_.block_xsize()) *
+                std::min<int>(r.ysize + kWindowHalo, search_.block_ysize());
+      }
+      full = 2 * work > search_.block_xsize() * search_.block_ysize();
+    }
+    if (full) {
+      QuantizedCoeffs qcoeffs = search_.ComputeCoefficients(quantizer);
+      Image3F recon = ReconOpsinImage(qcoeffs, quantizer, pool_);
+      YToBTransform(ytob_ / 128.0f, &recon);
+      CenteredOpsinToSrgb(recon, &srgb_, pool_);
+      comparator_.Compare(srgb_);
+    } else {
+      for (BlockRect& r : rects) {
+        const int x0 = std::max(0, r.x0 - kReconHalo);
+        const int y0 = std::max(0, r.y0 - kReconHalo);
+        const int x1 = std::min<int>(search_.block_xsize(),
+                                     r.x0 + r.xsize + kReconHalo);
+        const int y1 = std::min<int>(search_.block_ysize(),
+                                     r.y0 + r.ysize + kReconHalo);
+        r = {x0, y0, x1 - x0, y1 - y0};
+        Image3F recon = search_.ReconOpsinImageCrop(quantizer, r.x0, r.y0,
+                                                    r.xsize, r.ysize);
+        YToBTransform(ytob_ / 128.0f, &recon);
+        // The crop starts at even pixel coordinates, hence the dithering
+        // pattern of CenteredOpsinToSrgb matches that of the full image.
+        Image3B srgb;
+        CenteredOpsinToSrgb(recon, &srgb, pool_);
+        for (int y = 0; y < srgb.ysize(); ++y) {
+          for (int c = 0; c < 3; ++c) {
+            memcpy(&srgb_.PlaneRow(c, 8 * r.y0 + y)[8 * r.x0],
+                   srgb.ConstPlaneRow(c, y), srgb.xsize());
+          }
+        }
+      }
+      // Only compare after all regions are updated, because the butteraugli
+      // windows of nearby regions overlap.
+      for (const BlockRect& r : rects) {
+        const int x0 = 8 * r.x0;
+        const int y0 = 8 * r.y0;
+        if (x0 >= xsize_ || y0 >= ysize_) continue;
+        comparator_.CompareRegion(srgb_, x0, y0,
+                                  std::min(8 * r.xsize, xsize_ - x0),
+                                  std::min(8 * r.ysize, ysize_ - y0));
+      }
+    }
+    global_scale_ = quantizer.global_scale();
+    quant_dc_ = quantizer.quant_dc();
+    quant_img_ac_ = CopyImage(quantizer.quant_img_ac());
+  }
+
+  const Image3B& srgb() const { return srgb_; }
+  const butteraugli::ImageF& distmap() const { return comparator_.distmap(); }
+  float distance() const { return comparator_.distance(); }
+
+ private:
+  ButteraugliComparator comparator_;
+  const EncoderSearchState& search_;
+  const int ytob_;
+  ThreadPool* pool_;
+  const int xsize_;
+  const int ysize_;
+  // Decoded image and quantization of the previous Evaluate.
+  Image3B srgb_;
+  int global_scale_ = 0;
+  int quant_dc_ = 0;
+  Image<int> quant_img_ac_;
+};
+
 void FindBestQuantization(const Image3F& opsin_orig,
-                          const Image3F& opsin,
+                          const EncoderSearchState& search,
                           float butteraugli_target,
                           int max_butteraugli_iters,
                           int ytob,
+                          ThreadPool* pool,
                           Quantizer* quantizer,
                           PikInfo* aux_out) {
-  ButteraugliComparator comparator(opsin_orig);
+  PROFILER_FUNC;
+  ButteraugliEvaluator evaluator(opsin_orig, search, ytob, pool);
   const float kInitialQuantDC = 1.0625f / butteraugli_target;
   const float kInitialQuantAC = 0.5625f / butteraugli_target;
-  const int block_xsize = opsin.xsize() / 8;
-  const int block_ysize = opsin.ysize() / 8;
+  const int block_xsize = search.block_xsize();
+  const int block_ysize = search.block_ysize();
   ImageF quant_field(block_xsize, block_ysize, kInitialQuantAC);
   ImageF tile_distmap;
   static const int kMaxOuterIters = 3;
@@ -217,13 +375,8 @@ void FindBestQuantization(const Image3F& opsin_orig,
       if (butteraugli_iter >= max_butteraugli_iters) {
         break;
       }
-      QuantizedCoeffs qcoeffs = ComputeCoefficients(opsin, *quantizer);
-      Image3F recon = ReconOpsinImage(qcoeffs, *quantizer);
-      YToBTransform(ytob / 128.0f, &recon);
-      Image3B srgb;
-      CenteredOpsinToSrgb(recon, &srgb);
-      comparator.Compare(srgb);
-      tile_distmap = TileDistMap(comparator.distmap(), 8);
+      evaluator.Evaluate(*quantizer);
+      tile_distmap = TileDistMap(evaluator.distmap(), 8);
       ++butteraugli_iter;
       if (aux_out) {
         DumpHeatmaps(aux_out, opsin_orig.xsize(), opsin_orig.ysize(),
@@ -232,19 +385,19 @@ void FindBestQuantization(const Image3F& opsin_orig,
           char pathname[200];
           snprintf(pathname, 200, "%s%s%05d.png", aux_out->debug_prefix.c_str(),
                    "rgb_out", aux_out->num_butteraugli_iters);
-          WriteImage(ImageFormatPNG(), srgb, pathname);
+          WriteImage(ImageFormatPNG(), evaluator.srgb(), pathname);
         }
         ++aux_out->num_butteraugli_iters;
       }
       if (FLAGS_dump_quant_state) {
         printf("\nButteraugli iter: %d\n", butteraugli_iter);
-        printf("Butteraugli distance: %f\n", comparator.distance());
+        printf("Butteraugli distance: %f\n", evaluator.distance());
         printf("quant_max: %f\n", quant_max);
         quantizer->DumpQuantizationMap();
       }
     }
     bool changed = false;
-    while (!changed && comparator.distance() > butteraugli_target) {
+    while (!changed && evaluator.distance() > butteraugli_target) {
       for (int radius = 1; radius <= 4 && !changed; ++radius) {
         ImageF dist_to_peak_map = DistToPeakMap(
             tile_distmap, butteraugli_target, radius, 0.65);
@@ -281,26 +434,38 @@ void FindBestQuantization(const Image3F& opsin_orig,
 
 struct EvalGlobalYToB {
   size_t operator()(int ytob) const {
-    Image3F copy = CopyImage3(opsin);
-    YToBTransform(-ytob / 128.0f, &copy);
-    QuantizedCoeffs qcoeffs = ComputeCoefficients(copy, quantizer);
-    return EncodeToBitstream(qcoeffs, quantizer, ytob, true, nullptr).size();
+    QuantizedCoeffs qcoeffs =
+        search.ComputeCoefficients(quantizer, -ytob / 128.0f);
+    return EstimateEncodedSize(qcoeffs, quantizer);
   }
-  const Image3F& opsin;
+  // Of the opsin image before YToBTransform.
+  const EncoderSearchState& search;
   const Quantizer& quantizer;
 };
 
+// Coarse-to-fine search for the value in [minval, maxval] that minimizes
+// eval(value). The candidates of each resolution are evaluated in parallel
+// if "pool" is not null, hence eval must be thread-safe.
 template <class Eval>
 int Optimize(const Eval& eval, int minval, int maxval,
-             int best_val, size_t* best_objval) {
+             int best_val, size_t* best_objval, ThreadPool* pool) {
   int start = minval;
   int end = maxval;
   for (int resolution = 16; resolution >= 1; resolution /= 4) {
+    std::vector<int> vals;
     for (int val = start; val <= end; val += resolution) {
-      size_t objval = eval(val);
-      if (objval < *best_objval) {
-        best_val = val;
-        *best_objval = objval;
+      vals.push_back(val);
+    }
+    std::vector<size_t> objvals(vals.size());
+    RunOnPool(pool, 0, vals.size(), [&](const int i, const int thread) {
+      objvals[i] = eval(vals[i]);
+    });
+    // Same order as a sequential search, so that ties are resolved
+    // independently of the number of threads.
+    for (size_t i = 0; i < vals.size(); ++i) {
+      if (objvals[i] < *best_objval) {
+        best_val = vals[i];
+        *best_objval = objvals[i];
       }
     }
     start = std::max(minval, best_val - resolution + 1);
@@ -309,11 +474,12 @@ int Optimize(const Eval& eval, int minval, int maxval,
   return best_val;
 }
 
-int FindBestYToBCorrelation(const Image3F& opsin, const Quantizer& quantizer) {
-  static const int kStartYToB = 120;
-  EvalGlobalYToB eval_global{opsin, quantizer};
-  size_t best_size = eval_global(kStartYToB);
-  return Optimize(eval_global, 0, 255, kStartYToB, &best_size);
+int FindBestYToBCorrelation(const EncoderSearchState& search,
+                            const Quantizer& quantizer, ThreadPool* pool) {
+  PROFILER_FUNC;
+  EvalGlobalYToB eval_global{search, quantizer};
+  size_t best_size = eval_global(kDefaultYToB);
+  return Optimize(eval_global, 0, 255, kDefaultYToB, &best_size, pool);
 }
 
 bool ScaleQuantizationMap(const float quant_dc,
@@ -330,54 +496,159 @@ bool ScaleQuantizationMap(const float quant_dc,
   return changed;
 }
 
-void ScaleToTargetSize(const Image3F& opsin, size_t target_size,
-                       int ytob,
-                       Quantizer* quantizer,
-                       PikInfo* aux_out) {
+// Returns false if even the coarsest quantization exceeds target_size.
+bool ScaleToTargetSize(const EncoderSearchState& search, size_t target_size,
+                       int ytob, bool fast_mode,
+                       Sections* sections,
+                       Quantizer* quantizer) {
+  // Lower bound for the scale of the quantization map.
+  static const float kMinScale = 1.0f / 512;
   float quant_dc;
   ImageF quant_ac;
   quantizer->GetQuantField(&quant_dc, &quant_ac);
-  float scale_bad = 1.0;
-  float scale_good = 1.0;
-  bool found_candidate = false;
-  std::string candidate;
-  for (int i = 0; i < 10; ++i) {
-    ScaleQuantizationMap(quant_dc, quant_ac, scale_good, quantizer);
-    QuantizedCoeffs qcoeffs = ComputeCoefficients(opsin, *quantizer);
-    candidate = EncodeToBitstream(qcoeffs, *quantizer, ytob, false, aux_out);
-    if (candidate.size() <= target_size) {
-      found_candidate = true;
-      break;
-    }
-    scale_bad = scale_good;
-    scale_good *= 0.5;
-  }
-  if (!found_candidate) {
-    // We could not make the compressed size small enough
-    return;
-  }
-  if (scale_good == 1.0) {
-    // We dont want to go below butteraugli distance 1.0
-    return;
-  }
-  for (int i = 0; i < 16; ++i) {
-    float scale = 0.5 * (scale_bad + scale_good);
-    if (!ScaleQuantizationMap(quant_dc, quant_ac, scale, quantizer)) {
-      break;
-    }
-    QuantizedCoeffs qcoeffs = ComputeCoefficients(opsin, *quantizer);
-    candidate = EncodeToBitstream(qcoeffs, *quantizer, ytob, false, aux_out);
-    if (candidate.size() <= target_size) {
-      scale_good = scale;
-    } else {
-      scale_bad = scale;
-    }
+  const auto estimate = [&](const float scale) {
+    ScaleQuantizationMap(quant_dc, quant_ac, scale, quantizer);
+    QuantizedCoeffs qcoeffs = search.ComputeCoefficients(*quantizer);
+    return EstimateEncodedSize(qcoeffs, *quantizer);
+  };
+  const auto encode = [&](const float scale, size_t* estimated_size) {
+    ScaleQuantizationMap(quant_dc, quant_ac, scale, quantizer);
+    QuantizedCoeffs qcoeffs = search.ComputeCoefficients(*quantizer);
+    *estimated_size = EstimateEncodedSize(qcoeffs, *quantizer);
+    const size_t size = EncodeToBitstream(qcoeffs, *quantizer, ytob, fast_mode,
+                                          nullptr,
+                                          sections->tile_groups.get()).size();
+    // Upper bound for the size of the whole file.
+    return size + MaxCompressedHeaderSize() +
+        MaxCompressedSectionsSize(*sections);
+  };
+  float scale;
+  if (!ScaleForTargetSize(estimate, encode, target_size, kMinScale, &scale)) {
+    return false;
   }
-  ScaleQuantizationMap(quant_dc, quant_ac, scale_good, quantizer);
+  ScaleQuantizationMap(quant_dc, quant_ac, scale, quantizer);
+  return true;
 }
 
+// Stores the header, any sections and "compressed_data" in "compressed".
+bool WritePik(const CompressParams& params, const size_t xsize,
+              const size_t ysize, const Sections& sections,
+              const std::string& compressed_data, PaddedBytes* compressed) {
+  Header header;
+  header.xsize = xsize;
+  header.ysize = ysize;
+  if (params.alpha_channel) {
+    header.flags |= Header::kAlpha;
+  }
+  const bool has_sections = HasSections(sections);
+  if (has_sections) {
+    header.flags |= Header::kSections;
+  }
+  const size_t max_sections_size =
+      has_sections ? MaxCompressedSectionsSize(sections) : 0;
+  compressed->resize(MaxCompressedHeaderSize() + max_sections_size +
+                     compressed_data.size());
+  uint8_t* header_end = StoreHeader(header, compressed->data());
+  if (header_end == nullptr) return false;
+  uint8_t* sections_end = header_end;
+  if (has_sections) {
+    SIMD_NAMESPACE::BitSink sink(header_end);
+    sections_end = StoreSections(sections, max_sections_size, &sink);
+    if (sections_end == nullptr) return false;
+  }
+  const size_t header_size = sections_end - compressed->data();
+  compressed->resize(header_size + compressed_data.size());  // no copy!
+  memcpy(compressed->data() + header_size, compressed_data.data(),
+         compressed_data.size());
+  return true;
+}
+
+// Returns whether OpsinToPik searches for the best YToB correlation.
+bool SearchesYToB(const CompressParams& params) {
+  return params.butteraugli_distance >= 0.0 || params.target_bitrate > 0.0;
+}
+
+// Returns whether OpsinToPik uses the opsin image besides "*aligned".
+bool UsesOpsinOrig(const CompressParams& params) {
+  return SearchesYToB(params) ||
+         (params.uniform_quant <= 0.0 && params.fast_mode);
+}
+
+// Returns the YToB factor that the front end applies to "*aligned" before
+// OpsinToPik, i.e. none if the correlation is searched for.
+float FrontEndYToBFactor(const CompressParams& params) {
+  return SearchesYToB(params) ? 0.0f : -kDefaultYToB / 128.0f;
+}
 
+// Compresses the "xsize" x "ysize" image whose opsin image, centered, padded
+// to whole blocks and with YToBTransform(FrontEndYToBFactor(params)) applied,
+// is in "*aligned" (see CenteredOpsinDynamicsImage). "opsin_orig" is the
+// opsin image itself, which is only accessed if UsesOpsinOrig(params).
+// "*aligned" and "*coeffs" are scratch buffers whose storage is reused if they
+// already have the right size.
+bool OpsinToPik(const CompressParams& params, const size_t xsize,
+                const size_t ysize, const Image3F& opsin_orig,
+                ThreadPool* pool, Image3F* aligned, Image3F* coeffs,
+                PaddedBytes* compressed, PikInfo* aux_out) {
+  const size_t block_xsize = (xsize + 7) / 8;
+  const size_t block_ysize = (ysize + 7) / 8;
+  Quantizer quantizer(block_xsize, block_ysize);
+  quantizer.SetQuant(1.0f);
+  int ytob = kDefaultYToB;
+  // Heap-allocated so that the DCT in the constructor is timed separately.
+  std::unique_ptr<EncoderSearchState> search;
+  {
+    const ScopedStageTimer timer(aux_out, kStageDCT);
+    search.reset(new EncoderSearchState(*aligned, pool, coeffs));
+  }
+  if (SearchesYToB(params)) {
+    const ScopedStageTimer timer(aux_out, kStageSearch);
+    ytob = FindBestYToBCorrelation(*search, quantizer, pool);
+    // The transform is linear, hence it commutes with the DCT.
+    search->ApplyYToB(-ytob / 128.0f);
+  }
+  Sections sections;
+  if (params.tile_group_rows > 0) {
+    sections.tile_groups.reset(new TileGroups);
+    sections.tile_groups->block_rows = params.tile_group_rows;
+  }
+  {
+    const ScopedStageTimer timer(aux_out, kStageSearch);
+    if (params.butteraugli_distance >= 0.0) {
+      FindBestQuantization(opsin_orig, *search, params.butteraugli_distance,
+                           params.max_butteraugli_iters, ytob, pool,
+                           &quantizer, aux_out);
+    } else if (params.target_bitrate > 0.0) {
+      FindBestQuantization(opsin_orig, *search, 1.0,
+                           params.max_butteraugli_iters, ytob, pool,
+                           &quantizer, aux_out);
+      size_t target_size = xsize * ysize * params.target_bitrate / 8.0;
+      if (!ScaleToTargetSize(*search, target_size, ytob, params.fast_mode,
+                             &sections, &quantizer)) {
+        return PIK_FAILURE("Target size is too small");
+      }
+    } else if (params.uniform_quant > 0.0) {
+      quantizer.SetQuant(params.uniform_quant);
+    } else if (params.fast_mode) {
+      ImageF qf = AdaptiveQuantizationMap(opsin_orig.plane(1), 8);
+      quantizer.SetQuantField(kFastQuantDC, ScaleImage(kFastQuantAC, qf));
+    }
+  }
+  QuantizedCoeffs qcoeffs;
+  {
+    const ScopedStageTimer timer(aux_out, kStageQuantize);
+    qcoeffs = search->ComputeCoefficients(quantizer);
+  }
+  std::string compressed_data;
+  {
+    const ScopedStageTimer timer(aux_out, kStageEntropyEncode);
+    compressed_data = EncodeToBitstream(qcoeffs, quantizer, ytob,
+                                        params.fast_mode, aux_out,
+                                        sections.tile_groups.get());
+  }
 
+  return WritePik(params, xsize, ysize, sections, compressed_data, compressed);
+}
 
 }  // namespace
 
@@ -402,214 +673,662 @@ bool AlphaToPik(const CompressParams& params, const Image3<T>& image,
 }
 
 template<typename T>
-Image3F OpsinDynamicsImage(const MetaImage<T>& image) {
-  return OpsinDynamicsImage(image.GetColor());
+const Image3<T>& ColorImage(const Image3<T>& image) {
+  return image;
+}
+
+template<typename T>
+const Image3<T>& ColorImage(const MetaImage<T>& image) {
+  return image.GetColor();
 }
 
+// Returns the opsin dynamics image of pixel rows [y0, y1) of "image".
+template<typename T>
+Image3F OpsinDynamicsRows(const Image3<T>& image, const size_t y0,
+                          const size_t y1, ThreadPool* pool) {
+  Image3<T> rows(image.xsize(), y1 - y0);
+  for (size_t y = y0; y < y1; ++y) {
+    for (int c = 0; c < 3; ++c) {
+      memcpy(rows.PlaneRow(c, y - y0), image.ConstPlaneRow(c, y),
+             image.xsize() * sizeof(T));
+    }
+  }
+  return OpsinDynamicsImage(rows, pool);
+}
+
+// Same result as AdaptiveQuantizationMap(OpsinDynamicsImage(image).plane(1),
+// 8), computed from stripes of "block_rows" block rows plus halo.
+template<typename T>
+ImageF AdaptiveQuantizationMapStripes(const Image3<T>& image,
+                                      const int block_rows,
+                                      ThreadPool* pool) {
+  // The map of a block depends on pixels at most 13 rows away (the radius of
+  // the Gaussian plus one for the vertical differences). Stripes start at
+  // block boundaries, hence they are sampled at the same positions.
+  static const int kHalo = 2;
+  const int block_xsize = (image.xsize() + 7) / 8;
+  const int block_ysize = (image.ysize() + 7) / 8;
+  ImageF qf(block_xsize, block_ysize);
+  for (int by0 = 0; by0 < block_ysize; by0 += block_rows) {
+    const int by1 = std::min(block_ysize, by0 + block_rows);
+    const int y0 = std::max(0, by0 - kHalo);
+    const size_t y1 = std::min<size_t>(image.ysize(), 8 * (by1 + kHalo));
+    const Image3F opsin = OpsinDynamicsRows(image, 8 * y0, y1, pool);
+    const ImageF stripe_qf = AdaptiveQuantizationMap(opsin.plane(1), 8);
+    for (int by = by0; by < by1; ++by) {
+      memcpy(qf.Row(by), stripe_qf.Row(by - y0), block_xsize * sizeof(float));
+    }
+  }
+  return qf;
+}
+
+// Same result as OpsinToPik(params, OpsinDynamicsImage(image), ...), but only
+// one tile group of the opsin image and its coefficients exists at a time.
+template<typename T>
+bool PixelsToPikStripes(const CompressParams& params, const Image3<T>& image,
+                        ThreadPool* pool, PaddedBytes* compressed,
+                        PikInfo* aux_out) {
+  if (params.tile_group_rows <= 0) {
+    return PIK_FAILURE("Stripes require tile groups");
+  }
+  if (params.butteraugli_distance >= 0.0 || params.target_bitrate > 0.0) {
+    return PIK_FAILURE("Stripes do not support quantization search");
+  }
+  const size_t xsize = image.xsize();
+  const size_t ysize = image.ysize();
+  Quantizer quantizer((xsize + 7) / 8, (ysize + 7) / 8);
+  quantizer.SetQuant(1.0f);
+  if (params.uniform_quant > 0.0) {
+    quantizer.SetQuant(params.uniform_quant);
+  } else if (params.fast_mode) {
+    const ScopedStageTimer timer(aux_out, kStageSearch);
+    ImageF qf = AdaptiveQuantizationMapStripes(image, params.tile_group_rows,
+                                               pool);
+    quantizer.SetQuantField(kFastQuantDC, ScaleImage(kFastQuantAC, qf));
+  }
+  TileGroupEncoder encoder(quantizer, kDefaultYToB, params.fast_mode,
+                           params.tile_group_rows, pool);
+  while (!encoder.Done()) {
+    int y0, y1;
+    encoder.NextGroupRows(&y0, &y1);
+    Image3F opsin;
+    {
+      const ScopedStageTimer timer(aux_out, kStageOpsin);
+      // Only the last stripe is padded, as in AlignImage of the whole image.
+      CenteredOpsinDynamicsImage(image, 8 * y0,
+                                 std::min<size_t>(ysize, 8 * y1),
+                                 -kDefaultYToB / 128.0f, pool, &opsin);
+    }
+    // Includes the DCT of the tile group.
+    const ScopedStageTimer timer(aux_out, kStageQuantize);
+    encoder.AddNextGroup(opsin, aux_out);
+  }
+  Sections sections;
+  sections.tile_groups.reset(new TileGroups);
+  std::string compressed_data;
+  {
+    const ScopedStageTimer timer(aux_out, kStageEntropyEncode);
+    compressed_data = encoder.Finish(aux_out, sections.tile_groups.get());
+  }
+  return WritePik(params, xsize, ysize, sections, compressed_data, compressed);
+}
+
+PikEncoder::PikEncoder(const CompressParams& params)
+    : params_(params), pool_(std::max(0, params.num_threads - 1)) {}
+
 template<typename Image>
-bool PixelsToPikT(const CompressParams& params, const Image& image,
-                  PaddedBytes* compressed, PikInfo* aux_out) {
+bool PikEncoder::EncodeT(const Image& image, PaddedBytes* compressed,
+                         PikInfo* aux_out) {
   if (image.xsize() == 0 || image.ysize() == 0) {
     return PIK_FAILURE("Empty image");
   }
-  if (!OpsinToPik(params, OpsinDynamicsImage(image), compressed, aux_out)) {
-    return false;
+  const ScopedAllocator scoped_allocator(&allocator_);
+  const size_t bytes_before = allocator_.ResetPeakBytesInUse();
+  const size_t allocations_before = allocator_.NumAllocations();
+  if (params_.stripes) {
+    if (!PixelsToPikStripes(params_, ColorImage(image), &pool_, compressed,
+                            aux_out)) {
+      return false;
+    }
+  } else {
+    {
+      const ScopedStageTimer timer(aux_out, kStageOpsin);
+      if (UsesOpsinOrig(params_)) {
+        OpsinDynamicsImage(ColorImage(image), &pool_, &opsin_);
+      }
+      CenteredOpsinDynamicsImage(ColorImage(image), 0, image.ysize(),
+                                 FrontEndYToBFactor(params_), &pool_,
+                                 &aligned_);
+    }
+    if (!OpsinToPik(params_, image.xsize(), image.ysize(), opsin_, &pool_,
+                    &aligned_, &coeffs_, compressed, aux_out)) {
+      return false;
+    }
   }
-  if (params.alpha_channel) {
-    if (!AlphaToPik(params, image, compressed, aux_out)) {
+  if (params_.alpha_channel) {
+    const ScopedStageTimer timer(aux_out, kStageAlpha);
+    if (!AlphaToPik(params_, image, compressed, aux_out)) {
       return false;
     }
   }
+  if (aux_out != nullptr) {
+    aux_out->peak_memory_bytes = allocator_.PeakBytesInUse() - bytes_before;
+    aux_out->num_allocations =
+        allocator_.NumAllocations() - allocations_before;
+  }
   return true;
 }
 
+bool PikEncoder::Encode(const MetaImageB& image, PaddedBytes* compressed,
+                        PikInfo* aux_out) {
+  return EncodeT(image, compressed, aux_out);
+}
+
+bool PikEncoder::Encode(const Image3B& image, PaddedBytes* compressed,
+                        PikInfo* aux_out) {
+  return EncodeT(image, compressed, aux_out);
+}
+
+bool PikEncoder::Encode(const MetaImageF& linear, PaddedBytes* compressed,
+                        PikInfo* aux_out) {
+  return EncodeT(linear, compressed, aux_out);
+}
+
+bool PikEncoder::Encode(const Image3F& linear, PaddedBytes* compressed,
+                        PikInfo* aux_out) {
+  return EncodeT(linear, compressed, aux_out);
+}
+
+bool PikEncoder::EncodeOpsin(const Image3F& opsin, PaddedBytes* compressed,
+                             PikInfo* aux_out) {
+  if (params_.stripes) {
+    return PIK_FAILURE("Stripes are only supported by PixelsToPik");
+  }
+  if (opsin.xsize() == 0 || opsin.ysize() == 0) {
+    return PIK_FAILURE("Empty image");
+  }
+  const ScopedAllocator scoped_allocator(&allocator_);
+  {
+    const ScopedStageTimer timer(aux_out, kStageOpsin);
+    AlignImage(opsin, 8, &aligned_);
+    CenterOpsinValues(&aligned_);
+    if (!SearchesYToB(params_)) {
+      YToBTransform(FrontEndYToBFactor(params_), &aligned_);
+    }
+  }
+  return OpsinToPik(params_, opsin.xsize(), opsin.ysize(), opsin, &pool_,
+                    &aligned_, &coeffs_, compressed, aux_out);
+}
+
+size_t PikEncoder::RetainedBytes() const {
+  return ImageBytes(opsin_) + ImageBytes(aligned_) + ImageBytes(coeffs_) +
+         allocator_.RetainedBytes();
+}
+
+void PikEncoder::ReleaseBuffers() {
+  opsin_ = Image3F();
+  aligned_ = Image3F();
+  coeffs_ = Image3F();
+  allocator_.ReleaseFreeBlocks();
+}
+
 bool PixelsToPik(const CompressParams& params, const Image3B& image,
                  PaddedBytes* compressed, PikInfo* aux_out) {
-  return PixelsToPikT(params, image, compressed, aux_out);
+  return PikEncoder(params).Encode(image, compressed, aux_out);
 }
 
 bool PixelsToPik(const CompressParams& params, const Image3F& image,
                  PaddedBytes* compressed, PikInfo* aux_out) {
-  return PixelsToPikT(params, image, compressed, aux_out);
+  return PikEncoder(params).Encode(image, compressed, aux_out);
 }
 
 bool PixelsToPik(const CompressParams& params, const MetaImageB& image,
                  PaddedBytes* compressed, PikInfo* aux_out) {
-  return PixelsToPikT(params, image, compressed, aux_out);
+  return PikEncoder(params).Encode(image, compressed, aux_out);
 }
 
 bool PixelsToPik(const CompressParams& params, const MetaImageF& image,
                  PaddedBytes* compressed, PikInfo* aux_out) {
-  return PixelsToPikT(params, image, compressed, aux_out);
+  return PikEncoder(params).Encode(image, compressed, aux_out);
 }
 
 bool OpsinToPik(const CompressParams& params, const Image3F& opsin_orig,
                 PaddedBytes* compressed, PikInfo* aux_out) {
-  if (opsin_orig.xsize() == 0 || opsin_orig.ysize() == 0) {
-    return PIK_FAILURE("Empty image");
-  }
-  const size_t xsize = opsin_orig.xsize();
-  const size_t ysize = opsin_orig.ysize();
-  const size_t block_xsize = (xsize + 7) / 8;
-  const size_t block_ysize = (ysize + 7) / 8;
-  Image3F opsin = AlignImage(opsin_orig, 8);
-  CenterOpsinValues(&opsin);
-  Quantizer quantizer(block_xsize, block_ysize);
-  quantizer.SetQuant(1.0f);
-  int ytob = 120;
-  if (params.butteraugli_distance >= 0.0 || params.target_bitrate > 0.0) {
-    ytob = FindBestYToBCorrelation(opsin, quantizer);
-  }
-  YToBTransform(-ytob / 128.0f, &opsin);
-  if (params.butteraugli_distance >= 0.0) {
-    FindBestQuantization(opsin_orig, opsin, params.butteraugli_distance,
-                         params.max_butteraugli_iters, ytob,
-                         &quantizer, aux_out);
-  } else if (params.target_bitrate > 0.0) {
-    FindBestQuantization(opsin_orig, opsin, 1.0, params.max_butteraugli_iters,
-                         ytob, &quantizer, aux_out);
-    size_t target_size = xsize * ysize * params.target_bitrate / 8.0;
-    ScaleToTargetSize(opsin, target_size, ytob, &quantizer, aux_out);
-  } else if (params.uniform_quant > 0.0) {
-    quantizer.SetQuant(params.uniform_quant);
-  } else if (params.fast_mode) {
-    const float kQuantDC = 0.76953163840390082;
-    const float kQuantAC = 1.52005680264295;
-    ImageF qf = AdaptiveQuantizationMap(opsin_orig.plane(1), 8);
-    quantizer.SetQuantField(kQuantDC, ScaleImage(kQuantAC, qf));
-  }
-  QuantizedCoeffs qcoeffs = ComputeCoefficients(opsin, quantizer);
-  std::string compressed_data = EncodeToBitstream(
-      qcoeffs, quantizer, ytob, params.fast_mode, aux_out);
-
-  Header header;
-  header.xsize = xsize;
-  header.ysize = ysize;
-  if (params.alpha_channel) {
-    header.flags |= Header::kAlpha;
-  }
-  compressed->resize(MaxCompressedHeaderSize() + compressed_data.size());
-  uint8_t* header_end = StoreHeader(header, compressed->data());
-  if (header_end == nullptr) return false;
-  const size_t header_size = header_end - compressed->data();
-  compressed->resize(header_size + compressed_data.size());  // no copy!
-  memcpy(compressed->data() + header_size, compressed_data.data(),
-         compressed_data.size());
-  return true;
+  return PikEncoder(params).EncodeOpsin(opsin_orig, compressed, aux_out);
 }
 
 
-template <typename T>
-bool PikToPixelsT(const DecompressParams& params, const PaddedBytes& compressed,
-                  MetaImage<T>* image, PikInfo* aux_out) {
+namespace {
+
+// Loads the header and sections and checks whether the image size is
+// acceptable. "*byte_pos" is the position of the data after them.
+bool LoadPikHeader(const DecompressParams& params, const PaddedBytes& compressed,
+                   Header* header, Sections* sections, size_t* byte_pos) {
   if (compressed.size() == 0) {
     return PIK_FAILURE("Empty input.");
   }
-  Image3<T> planes;
   const uint8_t* const compressed_end = compressed.data() + compressed.size();
 
-  Header header;
-  const uint8_t* header_end = LoadHeader(compressed.data(), &header);
+  const uint8_t* header_end = LoadHeader(compressed.data(), header);
   if (header_end == nullptr) return false;
   if (header_end > compressed_end) {
     return PIK_FAILURE("Truncated header.");
   }
-  size_t byte_pos = header_end - compressed.data();
+  const uint8_t* sections_end = header_end;
+  if (header->flags & Header::kSections) {
+    sections_end = LoadSections(header_end, compressed_end, sections);
+    if (sections_end == nullptr) return false;
+  }
+  *byte_pos = sections_end - compressed.data();
 
-  if (header.flags & Header::kWebPLossless) {
+  if (header->flags & Header::kWebPLossless) {
     return PIK_FAILURE("Invalid format code");
-  } else {  // Pik
-    if (header.xsize == 0 || header.ysize == 0) {
-      return PIK_FAILURE("Empty image.");
-    }
-    static const uint32_t kMaxWidth = (1 << 25) - 1;
-    if (header.xsize > kMaxWidth) {
-      return PIK_FAILURE("Image too wide.");
-    }
-    uint64_t num_pixels = static_cast<uint64_t>(header.xsize) * header.ysize;
-    if (num_pixels > params.max_num_pixels) {
-      return PIK_FAILURE("Image too big.");
-    }
-    int block_xsize = (header.xsize + 7) / 8;
-    int block_ysize = (header.ysize + 7) / 8;
-    Quantizer quantizer(block_xsize, block_ysize);
-    QuantizedCoeffs qcoeffs;
-    int ytob;
-    size_t bytes_read;
-    if (!DecodeFromBitstream(header_end, compressed.size() - byte_pos,
+  }
+  if (header->xsize == 0 || header->ysize == 0) {
+    return PIK_FAILURE("Empty image.");
+  }
+  static const uint32_t kMaxWidth = (1 << 25) - 1;
+  if (header->xsize > kMaxWidth) {
+    return PIK_FAILURE("Image too wide.");
+  }
+  uint64_t num_pixels = static_cast<uint64_t>(header->xsize) * header->ysize;
+  if (num_pixels > params.max_num_pixels) {
+    return PIK_FAILURE("Image too big.");
+  }
+  return true;
+}
+
+// Stores the pixels of block rows [by0, by1) of the decoded (and possibly
+// downsampled) image in the first recon.block_dim() * (by1 - by0) rows of
+// "srgb", fusing the reconstruction with the YToB and color transforms of each
+// block row while it is in cache.
+template <typename T>
+void ReconToSrgb(const OpsinReconstructor& recon, const int ytob,
+                 const int by0, const int by1, ThreadPool* pool,
+                 Image3<T>* srgb) {
+  const float ytob_factor = ytob / 128.0f;
+  recon.Run(by0, by1, pool, [&](const int by, Image3F* opsin) {
+    PROFILER_ZONE("OpsinToSrgb");
+    YToBTransform(ytob_factor, opsin);
+    const int dim = recon.block_dim();
+    for (int iy = 0; iy < dim; ++iy) {
+      CenteredOpsinToSrgbRow(*opsin, iy, srgb, dim * (by - by0) + iy);
+    }
+  });
+}
+
+// Decodes the preview for DecompressParams::downsampling = 8 from the DC
+// coefficients after "*byte_pos", which is advanced past them.
+template <typename T>
+bool DecodeDCPreview(const PaddedBytes& compressed, const Header& header,
+                     ThreadPool* pool, size_t* byte_pos, Image3<T>* planes,
+                     PikInfo* aux_out) {
+  Quantizer quantizer((header.xsize + 7) / 8, (header.ysize + 7) / 8);
+  Image3W dc;
+  int ytob;
+  size_t bytes_read;
+  {
+    const ScopedStageTimer timer(aux_out, kStageEntropyDecode);
+    if (!DecodeDCFromBitstream(compressed.data() + *byte_pos,
+                               compressed.size() - *byte_pos,
+                               header.xsize, header.ysize,
+                               &ytob, &quantizer, &dc, &bytes_read)) {
+      return PIK_FAILURE("Pik decoding failed.");
+    }
+  }
+  *byte_pos += bytes_read;
+  const ScopedStageTimer timer(aux_out, kStageReconstruct);
+  Image3F opsin = ReconOpsinDCImage(dc, quantizer);
+  YToBTransform(ytob / 128.0f, &opsin);
+  CenteredOpsinToSrgb(opsin, planes, pool);
+  return true;
+}
+
+}  // namespace
+
+PikDecoder::PikDecoder(const DecompressParams& params)
+    : params_(params), pool_(std::max(0, params.num_threads - 1)) {}
+
+template <typename T>
+bool PikDecoder::DecodeT(const PaddedBytes& compressed, MetaImage<T>* image,
+                         PikInfo* aux_out) {
+  const ScopedAllocator scoped_allocator(&allocator_);
+  const size_t bytes_before = allocator_.ResetPeakBytesInUse();
+  const size_t allocations_before = allocator_.NumAllocations();
+  Header header;
+  Sections sections;
+  size_t byte_pos;
+  if (!LoadPikHeader(params_, compressed, &header, &sections, &byte_pos)) {
+    return false;
+  }
+  const int downsampling = params_.downsampling;
+  if (downsampling != 1 && downsampling != 2 && downsampling != 4 &&
+      downsampling != 8) {
+    return PIK_FAILURE("Unsupported downsampling.");
+  }
+  if (downsampling != 1 && (header.flags & Header::kAlpha)) {
+    return PIK_FAILURE("Downsampled decoding does not support alpha.");
+  }
+  // Requested rectangle, by default the whole image.
+  size_t x0 = 0;
+  size_t y0 = 0;
+  size_t xsize = header.xsize;
+  size_t ysize = header.ysize;
+  if (params_.crop_xsize != 0 && params_.crop_ysize != 0) {
+    if (downsampling == 8) {
+      return PIK_FAILURE("Cropping is not supported for DC-only decoding.");
+    }
+    if (params_.crop_x0 >= header.xsize ||
+        params_.crop_xsize > header.xsize - params_.crop_x0 ||
+        params_.crop_y0 >= header.ysize ||
+        params_.crop_ysize > header.ysize - params_.crop_y0) {
+      return PIK_FAILURE("Crop rectangle outside of the image.");
+    }
+    x0 = params_.crop_x0;
+    y0 = params_.crop_y0;
+    xsize = params_.crop_xsize;
+    ysize = params_.crop_ysize;
+  }
+  // The image may still have the (differently sized) alpha of another image.
+  *image = MetaImage<T>();
+  if (downsampling == 8) {
+    Image3<T> planes;
+    if (!DecodeDCPreview(compressed, header, &pool_, &byte_pos, &planes,
+                         aux_out)) {
+      return false;
+    }
+    image->SetColor(std::move(planes));
+    if (aux_out != nullptr) {
+      aux_out->decoded_size = byte_pos;
+      aux_out->peak_memory_bytes = allocator_.PeakBytesInUse() - bytes_before;
+      aux_out->num_allocations =
+          allocator_.NumAllocations() - allocations_before;
+    }
+    return true;
+  }
+  int block_xsize = (header.xsize + 7) / 8;
+  int block_ysize = (header.ysize + 7) / 8;
+  // Blocks covering the rectangle.
+  const int bx0 = x0 / 8;
+  const int by0 = y0 / 8;
+  const int bx1 = (x0 + xsize + 7) / 8;
+  const int by1 = (y0 + ysize + 7) / 8;
+  // Blocks whose coefficients the rectangle depends on.
+  static const int kHalo = OpsinReconstructor::kHalo;
+  const int hx0 = std::max(0, bx0 - kHalo);
+  const int hy0 = std::max(0, by0 - kHalo);
+  const int hx1 = std::min(block_xsize, bx1 + kHalo);
+  const int hy1 = std::min(block_ysize, by1 + kHalo);
+  Quantizer quantizer(block_xsize, block_ysize);
+  int ytob;
+  size_t bytes_read;
+  {
+    const ScopedStageTimer timer(aux_out, kStageEntropyDecode);
+    if (!DecodeFromBitstream(compressed.data() + byte_pos,
+                             compressed.size() - byte_pos,
                              header.xsize, header.ysize,
-                             &ytob, &quantizer, &qcoeffs, &bytes_read)) {
+                             sections.tile_groups.get(), &pool_,
+                             &ytob, &quantizer, &qcoeffs_, &bytes_read,
+                             hy0, hy1)) {
       return PIK_FAILURE("Pik decoding failed.");
     }
-    byte_pos += bytes_read;
-    Image3F opsin = ReconOpsinImage(qcoeffs, quantizer);
-    YToBTransform(ytob / 128.0f, &opsin);
-    CenteredOpsinToSrgb(opsin, &planes);
-    planes.ShrinkTo(header.xsize, header.ysize);
+  }
+  byte_pos += bytes_read;
+  {
+    const ScopedStageTimer timer(aux_out, kStageReconstruct);
+    QuantizedCoeffs cropped;
+    const bool crop = hx1 - hx0 != block_xsize || hy1 - hy0 != block_ysize;
+    if (crop) {
+      cropped = CopyBlocks(qcoeffs_, hx0, hy0, hx1 - hx0, hy1 - hy0);
+    }
+    const QuantizedCoeffs& qcoeffs = crop ? cropped : qcoeffs_;
+    const Quantizer crop_quantizer =
+        quantizer.Crop(hx0, hy0, hx1 - hx0, hy1 - hy0);
+    const OpsinReconstructor recon(qcoeffs, crop_quantizer, downsampling);
+    const int dim = recon.block_dim();
+    // Block rows [by0, by1) of the blocks [hx0, hx1). The pixel offsets of the
+    // blocks are even, hence the dithering is the same as for the whole image.
+    Image3<T> planes((hx1 - hx0) * dim, (by1 - by0) * dim);
+    ReconToSrgb(recon, ytob, by0 - hy0, by1 - hy0, &pool_, &planes);
+    const size_t out_x0 = x0 / downsampling;
+    const size_t out_y0 = y0 / downsampling;
+    const size_t out_xsize =
+        (x0 + xsize + downsampling - 1) / downsampling - out_x0;
+    const size_t out_ysize =
+        (y0 + ysize + downsampling - 1) / downsampling - out_y0;
+    if (out_x0 == hx0 * dim && out_y0 == by0 * dim) {
+      planes.ShrinkTo(out_xsize, out_ysize);
+    } else {
+      planes = CopyRect(planes, out_x0 - hx0 * dim, out_y0 - by0 * dim,
+                        out_xsize, out_ysize);
+    }
     image->SetColor(std::move(planes));
+  }
 
-    if (header.flags & Header::kAlpha) {
-      image->AddAlpha();
-      size_t bytes_read;
-      if (!PikToAlpha(params, byte_pos, compressed, &bytes_read,
-                      &image->GetAlpha())) {
-        return false;
-      }
-      byte_pos += bytes_read;
+  if (header.flags & Header::kAlpha) {
+    // Only without downsampling.
+    const ScopedStageTimer timer(aux_out, kStageAlpha);
+    Image<T> alpha(header.xsize, header.ysize);
+    size_t bytes_read;
+    if (!PikToAlpha(params_, byte_pos, compressed, &bytes_read, &alpha)) {
+      return false;
+    }
+    byte_pos += bytes_read;
+    if (xsize != header.xsize || ysize != header.ysize) {
+      alpha = CopyRect(alpha, x0, y0, xsize, ysize);
     }
+    image->SetAlpha(std::move(alpha));
   }
-  if (params.check_decompressed_size && byte_pos != compressed.size()) {
+  if (params_.check_decompressed_size && byte_pos != compressed.size()) {
     return PIK_FAILURE("Pik compressed data size mismatch.");
   }
   if (aux_out != nullptr) {
     aux_out->decoded_size = byte_pos;
+    aux_out->peak_memory_bytes = allocator_.PeakBytesInUse() - bytes_before;
+    aux_out->num_allocations =
+        allocator_.NumAllocations() - allocations_before;
   }
   return true;
 }
 
-bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
-                 MetaImageB* image, PikInfo* aux_out) {
-  return PikToPixelsT(params, compressed, image, aux_out);
+template <typename T>
+bool PikDecoder::DecodeT(const PaddedBytes& compressed, Image3<T>* image,
+                         PikInfo* aux_out) {
+  MetaImage<T> temp;
+  if (!DecodeT(compressed, &temp, aux_out)) {
+    return false;
+  }
+  if (temp.HasAlpha()) {
+    return PIK_FAILURE("Unable to output alpha channel");
+  }
+  *image = std::move(temp.GetColor());
+  return true;
 }
 
-bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
-                 MetaImageU* image, PikInfo* aux_out) {
-  return PikToPixelsT(params, compressed, image, aux_out);
+bool PikDecoder::Decode(const PaddedBytes& compressed, MetaImageB* image,
+                        PikInfo* aux_out) {
+  return DecodeT(compressed, image, aux_out);
 }
 
-bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
-                 MetaImageF* image, PikInfo* aux_out) {
-  return PikToPixelsT(params, compressed, image, aux_out);
+bool PikDecoder::Decode(const PaddedBytes& compressed, Image3B* image,
+                        PikInfo* aux_out) {
+  return DecodeT(compressed, image, aux_out);
 }
 
-template<typename T>
-bool PikToPixelsT(const DecompressParams& params, const PaddedBytes& compressed,
-                 Image3<T>* image, PikInfo* aux_out) {
-  MetaImage<T> temp;
-  if (!PikToPixelsT(params, compressed, &temp, aux_out)) {
+bool PikDecoder::Decode(const PaddedBytes& compressed, MetaImageU* image,
+                        PikInfo* aux_out) {
+  return DecodeT(compressed, image, aux_out);
+}
+
+bool PikDecoder::Decode(const PaddedBytes& compressed, Image3U* image,
+                        PikInfo* aux_out) {
+  return DecodeT(compressed, image, aux_out);
+}
+
+bool PikDecoder::Decode(const PaddedBytes& compressed, MetaImageF* image,
+                        PikInfo* aux_out) {
+  return DecodeT(compressed, image, aux_out);
+}
+
+bool PikDecoder::Decode(const PaddedBytes& compressed, Image3F* image,
+                        PikInfo* aux_out) {
+  return DecodeT(compressed, image, aux_out);
+}
+
+template <typename T>
+bool PikDecoder::DecodeRowsT(const PaddedBytes& compressed,
+                             const PixelRowsCallback<T>& callback,
+                             PikInfo* aux_out) {
+  // Block rows converted and passed to the callback at a time.
+  static const int kStripeBlockRows = 8;
+  const ScopedAllocator scoped_allocator(&allocator_);
+  const size_t bytes_before = allocator_.ResetPeakBytesInUse();
+  const size_t allocations_before = allocator_.NumAllocations();
+  Header header;
+  Sections sections;
+  size_t byte_pos;
+  if (!LoadPikHeader(params_, compressed, &header, &sections, &byte_pos)) {
     return false;
   }
-  if (temp.HasAlpha()) {
+  if (header.flags & Header::kAlpha) {
     return PIK_FAILURE("Unable to output alpha channel");
   }
-  *image = std::move(temp.GetColor());
+  const int downsampling = params_.downsampling;
+  if (downsampling != 1 && downsampling != 2 && downsampling != 4) {
+    return PIK_FAILURE("Unsupported downsampling.");
+  }
+  if (params_.crop_xsize != 0 && params_.crop_ysize != 0) {
+    return PIK_FAILURE("Cropping is not supported by PikToPixelRows.");
+  }
+  int block_xsize = (header.xsize + 7) / 8;
+  int block_ysize = (header.ysize + 7) / 8;
+  Quantizer quantizer(block_xsize, block_ysize);
+  int ytob;
+  size_t bytes_read;
+  {
+    const ScopedStageTimer timer(aux_out, kStageEntropyDecode);
+    if (!DecodeFromBitstream(compressed.data() + byte_pos,
+                             compressed.size() - byte_pos,
+                             header.xsize, header.ysize,
+                             sections.tile_groups.get(), &pool_,
+                             &ytob, &quantizer, &qcoeffs_, &bytes_read)) {
+      return PIK_FAILURE("Pik decoding failed.");
+    }
+  }
+  byte_pos += bytes_read;
+  // Checked before any rows are passed to the callback.
+  if (params_.check_decompressed_size && byte_pos != compressed.size()) {
+    return PIK_FAILURE("Pik compressed data size mismatch.");
+  }
+  // Heap-allocated so that the time spent in the callback is not counted.
+  std::unique_ptr<const OpsinReconstructor> recon;
+  {
+    const ScopedStageTimer timer(aux_out, kStageReconstruct);
+    recon.reset(new OpsinReconstructor(qcoeffs_, quantizer, downsampling));
+  }
+  const int dim = recon->block_dim();
+  const size_t xsize = (header.xsize + downsampling - 1) / downsampling;
+  const size_t ysize = (header.ysize + downsampling - 1) / downsampling;
+  for (int by0 = 0; by0 < block_ysize; by0 += kStripeBlockRows) {
+    const int bysize = std::min(kStripeBlockRows, block_ysize - by0);
+    // Stripes start at even rows, hence the dithering pattern is the same as
+    // for the whole image.
+    Image3<T> rows(block_xsize * dim, bysize * dim);
+    {
+      const ScopedStageTimer timer(aux_out, kStageReconstruct);
+      ReconToSrgb(*recon, ytob, by0, by0 + bysize, &pool_, &rows);
+    }
+    const size_t y0 = dim * by0;
+    rows.ShrinkTo(xsize, std::min<size_t>(rows.ysize(), ysize - y0));
+    if (!callback(ysize, y0, rows)) {
+      return PIK_FAILURE("Decoding aborted by the callback.");
+    }
+  }
+  if (aux_out != nullptr) {
+    aux_out->decoded_size = byte_pos;
+    aux_out->peak_memory_bytes = allocator_.PeakBytesInUse() - bytes_before;
+    aux_out->num_allocations =
+        allocator_.NumAllocations() - allocations_before;
+  }
   return true;
 }
 
-bool PikToPixels(const DecompressParams& params,
-                 const PaddedBytes& compressed,
+bool PikDecoder::DecodeRows(const PaddedBytes& compressed,
+                            const PixelRowsCallback<uint8_t>& callback,
+                            PikInfo* aux_out) {
+  return DecodeRowsT(compressed, callback, aux_out);
+}
+
+bool PikDecoder::DecodeRows(const PaddedBytes& compressed,
+                            const PixelRowsCallback<uint16_t>& callback,
+                            PikInfo* aux_out) {
+  return DecodeRowsT(compressed, callback, aux_out);
+}
+
+bool PikDecoder::DecodeRows(const PaddedBytes& compressed,
+                            const PixelRowsCallback<float>& callback,
+                            PikInfo* aux_out) {
+  return DecodeRowsT(compressed, callback, aux_out);
+}
+
+size_t PikDecoder::RetainedBytes() const {
+  return ImageBytes(qcoeffs_) + allocator_.RetainedBytes();
+}
+
+void PikDecoder::ReleaseBuffers() {
+  qcoeffs_ = Image3W();
+  allocator_.ReleaseFreeBlocks();
+}
+
+bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
+                 MetaImageB* image, PikInfo* aux_out) {
+  return PikDecoder(params).Decode(compressed, image, aux_out);
+}
+
+bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
                  Image3B* image, PikInfo* aux_out) {
-  return PikToPixelsT(params, compressed, image, aux_out);
+  return PikDecoder(params).Decode(compressed, image, aux_out);
+}
+
+bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
+                 MetaImageU* image, PikInfo* aux_out) {
+  return PikDecoder(params).Decode(compressed, image, aux_out);
 }
-bool PikToPixels(const DecompressParams& params,
-                 const PaddedBytes& compressed,
+
+bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
                  Image3U* image, PikInfo* aux_out) {
-  return PikToPixelsT(params, compressed, image, aux_out);
+  return PikDecoder(params).Decode(compressed, image, aux_out);
+}
+
+bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
+                 MetaImageF* image, PikInfo* aux_out) {
+  return PikDecoder(params).Decode(compressed, image, aux_out);
 }
-bool PikToPixels(const DecompressParams& params,
-                 const PaddedBytes& compressed,
+
+bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
                  Image3F* image, PikInfo* aux_out) {
-  return PikToPixelsT(params, compressed, image, aux_out);
+  return PikDecoder(params).Decode(compressed, image, aux_out);
+}
+
+bool PikToPixelRows(const DecompressParams& params,
+                    const PaddedBytes& compressed,
+                    const PixelRowsCallback<uint8_t>& callback,
+                    PikInfo* aux_out) {
+  return PikDecoder(params).DecodeRows(compressed, callback, aux_out);
+}
+
+bool PikToPixelRows(const DecompressParams& params,
+                    const PaddedBytes& compressed,
+                    const PixelRowsCallback<uint16_t>& callback,
+                    PikInfo* aux_out) {
+  return PikDecoder(params).DecodeRows(compressed, callback, aux_out);
+}
+
+bool PikToPixelRows(const DecompressParams& params,
+                    const PaddedBytes& compressed,
+                    const PixelRowsCallback<float>& callback,
+                    PikInfo* aux_out) {
+  return PikDecoder(params).DecodeRows(compressed, callback, aux_out);
 }
 
 }  // namespace pik
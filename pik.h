@@ -15,13 +15,18 @@
 #ifndef PIK_H_
 #define PIK_H_
 
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
 #include <string>
 
+#include "cache_aligned.h"
 #include "image.h"
 #include "pik_info.h"
 #include "status.h"
 #include "padded_bytes.h"
 #include "pik_params.h"
+#include "thread_pool.h"
 
 namespace pik {
 
@@ -59,6 +64,138 @@ bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
                  MetaImageF* image, PikInfo* aux_out);
 bool PikToPixels(const DecompressParams& params, const PaddedBytes& compressed,
                  Image3F* image, PikInfo* aux_out);
+
+// Receives the decoded rows [y0, y0 + rows.ysize()) of an image with
+// rows.xsize() columns and "ysize" rows. Returning false aborts decoding.
+template <typename T>
+using PixelRowsCallback =
+    std::function<bool(size_t ysize, size_t y0, const Image3<T>& rows)>;
+
+// Streaming variants of PikToPixels for 8-bit, 16-bit and linear sRGB output:
+// the image is reconstructed in stripes of a few block rows, which are passed
+// to "callback" in top to bottom order as soon as they are finished. Only the
+// quantized coefficients and one stripe exist at a time. Images with alpha
+// are not supported.
+bool PikToPixelRows(const DecompressParams& params,
+                    const PaddedBytes& compressed,
+                    const PixelRowsCallback<uint8_t>& callback,
+                    PikInfo* aux_out);
+bool PikToPixelRows(const DecompressParams& params,
+                    const PaddedBytes& compressed,
+                    const PixelRowsCallback<uint16_t>& callback,
+                    PikInfo* aux_out);
+bool PikToPixelRows(const DecompressParams& params,
+                    const PaddedBytes& compressed,
+                    const PixelRowsCallback<float>& callback,
+                    PikInfo* aux_out);
+
+// Encoder whose state persists across calls, for encoding many images: the
+// thread pool and the largest per-image buffers are kept and reused for
+// subsequent images of the same size, and all other buffers are allocated
+// from a PoolAllocator that recycles them. Not thread-safe.
+class PikEncoder {
+ public:
+  explicit PikEncoder(const CompressParams& params);
+
+  // Same as the PixelsToPik with the same image argument.
+  bool Encode(const MetaImageB& image, PaddedBytes* compressed,
+              PikInfo* aux_out);
+  bool Encode(const Image3B& image, PaddedBytes* compressed, PikInfo* aux_out);
+  bool Encode(const MetaImageF& linear, PaddedBytes* compressed,
+              PikInfo* aux_out);
+  bool Encode(const Image3F& linear, PaddedBytes* compressed,
+              PikInfo* aux_out);
+
+  // Same as OpsinToPik.
+  bool EncodeOpsin(const Image3F& opsin, PaddedBytes* compressed,
+                   PikInfo* aux_out);
+
+  // Returns the number of bytes of the buffers kept for the next call,
+  // including the free memory of the allocator.
+  size_t RetainedBytes() const;
+
+  // Frees the buffers, e.g. after an unusually large image.
+  void ReleaseBuffers();
+
+  // For allocation statistics.
+  const PoolAllocator& allocator() const { return allocator_; }
+
+ private:
+  template <class Image>
+  bool EncodeT(const Image& image, PaddedBytes* compressed, PikInfo* aux_out);
+
+  const CompressParams params_;
+  ThreadPool pool_;
+  // Declared before the buffers, which are thus freed before it.
+  PoolAllocator allocator_;
+  // Opsin dynamics image of the input, only computed if the encoder uses it
+  // besides "aligned_".
+  Image3F opsin_;
+  // Centered opsin image padded to whole blocks, see
+  // CenteredOpsinDynamicsImage.
+  Image3F aligned_;
+  // DCT coefficients of the padded image.
+  Image3F coeffs_;
+};
+
+// Decoder whose state persists across calls, for decoding many images: the
+// thread pool and the quantized coefficients are kept and reused for
+// subsequent images of the same size, and all other buffers are allocated
+// from a PoolAllocator that recycles them. Not thread-safe.
+class PikDecoder {
+ public:
+  explicit PikDecoder(const DecompressParams& params);
+
+  // Same as the PikToPixels with the same image argument.
+  bool Decode(const PaddedBytes& compressed, MetaImageB* image,
+              PikInfo* aux_out);
+  bool Decode(const PaddedBytes& compressed, Image3B* image, PikInfo* aux_out);
+  bool Decode(const PaddedBytes& compressed, MetaImageU* image,
+              PikInfo* aux_out);
+  bool Decode(const PaddedBytes& compressed, Image3U* image, PikInfo* aux_out);
+  bool Decode(const PaddedBytes& compressed, MetaImageF* image,
+              PikInfo* aux_out);
+  bool Decode(const PaddedBytes& compressed, Image3F* image, PikInfo* aux_out);
+
+  // Same as the PikToPixelRows with the same callback argument.
+  bool DecodeRows(const PaddedBytes& compressed,
+                  const PixelRowsCallback<uint8_t>& callback,
+                  PikInfo* aux_out);
+  bool DecodeRows(const PaddedBytes& compressed,
+                  const PixelRowsCallback<uint16_t>& callback,
+                  PikInfo* aux_out);
+  bool DecodeRows(const PaddedBytes& compressed,
+                  const PixelRowsCallback<float>& callback, PikInfo* aux_out);
+
+  // Returns the number of bytes of the buffers kept for the next call,
+  // including the free memory of the allocator.
+  size_t RetainedBytes() const;
+
+  // Frees the buffers, e.g. after an unusually large image.
+  void ReleaseBuffers();
+
+  // For allocation statistics.
+  const PoolAllocator& allocator() const { return allocator_; }
+
+ private:
+  template <typename T>
+  bool DecodeT(const PaddedBytes& compressed, MetaImage<T>* image,
+               PikInfo* aux_out);
+  template <typename T>
+  bool DecodeT(const PaddedBytes& compressed, Image3<T>* image,
+               PikInfo* aux_out);
+  template <typename T>
+  bool DecodeRowsT(const PaddedBytes& compressed,
+                   const PixelRowsCallback<T>& callback, PikInfo* aux_out);
+
+  const DecompressParams params_;
+  ThreadPool pool_;
+  // Declared before the buffers, which are thus freed before it.
+  PoolAllocator allocator_;
+  // Quantized coefficients of the whole image.
+  Image3W qcoeffs_;
+};
+
 }  // namespace pik
 
 #endif  // PIK_H_
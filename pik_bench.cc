@@ -0,0 +1,846 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks of the hot kernels in isolation, on synthetic images.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ans_decode.h"
+#include "ans_encode.h"
+#include "arch_specific.h"
+#include "bit_reader.h"
+#include "butteraugli/butteraugli.h"
+#include "compressed_image.h"
+#include "convolve_target.h"
+#include "dc_predictor.h"
+#include "dct.h"
+#include "dct_target.h"
+#include "dct_util.h"
+#include "gauss_blur.h"
+#include "huffman_decode.h"
+#include "huffman_encode.h"
+#include "image.h"
+#include "opsin_image.h"
+#include "opsin_image_target.h"
+#include "opsin_inverse.h"
+#include "opsin_inverse_target.h"
+#include "padded_bytes.h"
+#include "pik.h"
+#include "pik_params.h"
+#include "quantizer.h"
+#include "quantizer_target.h"
+#include "robust_statistics.h"
+#include "simd/dispatch.h"
+#include "status.h"
+#include "tsc_timer.h"
+#include "write_bits.h"
+
+namespace pik {
+namespace {
+
+// Size of the alphabet of the entropy coder benchmarks, same as for the DC.
+static const int kAlphabetSize = 16;
+
+struct BenchParams {
+  size_t xsize = 512;
+  size_t ysize = 512;
+  int num_reps = 15;
+  // Only kernels whose name contains this are run, unless it is null.
+  const char* filter = nullptr;
+  // Instruction set of the kernels called via dispatch::Run.
+  int dispatched_target = SIMD_NONE;
+};
+
+const char* TargetName(const int target) {
+  switch (target) {
+    case SIMD_AVX2:
+      return "AVX2";
+    case SIMD_SSE4:
+      return "SSE4";
+    case SIMD_ARM8:
+      return "ARM8";
+    case SIMD_NONE:
+      return "NONE";
+  }
+  return "?";
+}
+
+// Returns whether "--filter" excludes the kernel "name".
+bool IsFilteredOut(const BenchParams& params, const char* name) {
+  return params.filter != nullptr && strstr(name, params.filter) == nullptr;
+}
+
+// Calls "func" once to warm up, then "num_reps" times, and prints the median
+// and median absolute deviation of the throughput, where each call processes
+// "units" (millions of pixels or bytes, see "unit_name"). "target" is the
+// instruction set for which "func" was compiled. Returns the median
+// throughput, or zero if "name" is filtered out.
+template <class Func>
+double Measure(const BenchParams& params, const char* name, const double units,
+             const char* unit_name, const Func& func,
+             const int target = SIMD_TARGET::value) {
+  if (IsFilteredOut(params, name)) return 0.0;
+  func();
+  const double ticks_per_second = InvariantTicksPerSecond();
+  std::vector<double> throughputs;
+  throughputs.reserve(params.num_reps);
+  for (int rep = 0; rep < params.num_reps; ++rep) {
+    const uint64_t t0 = Start<uint64_t>();
+    func();
+    const uint64_t ticks = Stop<uint64_t>() - t0;
+    throughputs.push_back(units * ticks_per_second / std::max<uint64_t>(
+                                                         ticks, 1));
+  }
+  const double median = Median(&throughputs);
+  const double mad = MedianAbsoluteDeviation(throughputs, median);
+  printf("%-32s %-4s %10.2f %s/s +- %5.2f%%\n", name, TargetName(target),
+         median, unit_name, 100.0 * mad / median);
+  return median;
+}
+
+// Returns a linear RGB image with values in [0, 255]: smooth gradients,
+// texture and noise, similar to a photo in its spectrum.
+Image3F SyntheticLinearImage(const size_t xsize, const size_t ysize,
+                             std::mt19937* rng) {
+  std::normal_distribution<float> noise(0.0f, 4.0f);
+  Image3F image(xsize, ysize);
+  for (int c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < ysize; ++y) {
+      float* const PIK_RESTRICT row = image.PlaneRow(c, y);
+      for (size_t x = 0; x < xsize; ++x) {
+        const float gradient = 40.0f + 120.0f * (x + (c + 1) * y) /
+                                           (xsize + (c + 1) * ysize);
+        const float texture =
+            30.0f * std::sin(x * 0.05f * (c + 1)) * std::cos(y * 0.11f);
+        row[x] = std::min(255.0f, std::max(0.0f, gradient + texture +
+                                                     noise(*rng)));
+      }
+    }
+  }
+  return image;
+}
+
+// Returns symbols whose distribution resembles that of the DC residuals.
+std::vector<int> SyntheticSymbols(const size_t num_symbols,
+                                  std::mt19937* rng) {
+  std::geometric_distribution<int> distribution(0.35);
+  std::vector<int> symbols(num_symbols);
+  for (int& symbol : symbols) {
+    symbol = std::min(distribution(*rng), kAlphabetSize - 1);
+  }
+  return symbols;
+}
+
+std::vector<int> Histogram(const std::vector<int>& symbols) {
+  std::vector<int> histogram(kAlphabetSize);
+  for (const int symbol : symbols) {
+    ++histogram[symbol];
+  }
+  return histogram;
+}
+
+// Encodes "symbols" with one ANSCoder per block of kANSBufferSize and stores
+// each block's 16-bit outputs in "*words", in order of decoding, preceded by
+// the two halves of the final state.
+void EncodeANSBlocks(const std::vector<ANSEncSymbolInfo>& table,
+                     const std::vector<int>& symbols,
+                     std::vector<uint32_t>* words) {
+  words->clear();
+  std::vector<uint32_t> out;
+  out.reserve(kANSBufferSize);
+  for (size_t start = 0; start < symbols.size(); start += kANSBufferSize) {
+    const size_t end = std::min<size_t>(start + kANSBufferSize,
+                                        symbols.size());
+    ANSCoder ans;
+    out.clear();
+    for (size_t i = end; i-- > start;) {
+      uint8_t nbits = 0;
+      const uint32_t bits = ans.PutSymbol(table[symbols[i]], &nbits);
+      if (nbits == 16) out.push_back(bits);
+    }
+    const uint32_t state = ans.GetState();
+    words->push_back(state >> 16);
+    words->push_back(state & 0xffff);
+    words->insert(words->end(), out.rbegin(), out.rend());
+  }
+}
+
+// Returns the histogram followed by the output of EncodeANSBlocks, in the
+// format read by ANSSymbolReader.
+std::vector<uint8_t> EncodeANS(const std::vector<int>& symbols) {
+  std::vector<uint8_t> storage(4 * symbols.size() + 1024);
+  size_t storage_ix = 0;
+  std::vector<int> histogram = Histogram(symbols);
+  std::vector<ANSEncSymbolInfo> table(kAlphabetSize);
+  BuildAndStoreANSEncodingData(histogram.data(), kAlphabetSize, table.data(),
+                               &storage_ix, storage.data());
+  WriteBits(((storage_ix + 7) & ~7) - storage_ix, 0, &storage_ix,
+            storage.data());
+  std::vector<uint32_t> words;
+  EncodeANSBlocks(table, symbols, &words);
+  for (const uint32_t word : words) {
+    WriteBits(16, word, &storage_ix, storage.data());
+  }
+  // BitReader requires a multiple of four bytes.
+  storage.resize(((storage_ix + 31) & ~31) / 8);
+  return storage;
+}
+
+std::vector<uint8_t> EncodeHuffman(const std::vector<int>& symbols) {
+  std::vector<uint8_t> storage(4 * symbols.size() + 1024);
+  size_t storage_ix = 0;
+  const std::vector<int> counts = Histogram(symbols);
+  std::vector<uint32_t> histogram(counts.begin(), counts.end());
+  std::vector<uint8_t> depths(kAlphabetSize);
+  std::vector<uint16_t> bits(kAlphabetSize);
+  BuildAndStoreHuffmanTree(histogram.data(), kAlphabetSize, depths.data(),
+                           bits.data(), &storage_ix, storage.data());
+  for (const int symbol : symbols) {
+    WriteBits(depths[symbol], bits[symbol], &storage_ix, storage.data());
+  }
+  storage.resize(((storage_ix + 31) & ~31) / 8);
+  return storage;
+}
+
+std::vector<butteraugli::ImageF> ButteraugliPlanes(const Image3F& image) {
+  std::vector<butteraugli::ImageF> planes =
+      butteraugli::CreatePlanes<float>(image.xsize(), image.ysize(), 3);
+  for (int c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < image.ysize(); ++y) {
+      memcpy(planes[c].Row(y), image.ConstPlaneRow(c, y),
+             image.xsize() * sizeof(float));
+    }
+  }
+  return planes;
+}
+
+template <typename T>
+Image<T> CopyOf(const Image<T>& image) {
+  return CopyImage(image);
+}
+
+template <typename T>
+Image3<T> CopyOf(const Image3<T>& image) {
+  return CopyImage3(image);
+}
+
+// Returns the instruction set chosen by dispatch::Run.
+struct DispatchedTarget {
+  template <class Target>
+  int operator()() {
+    return Target::value;
+  }
+};
+
+// Measures the dispatched kernel "name" for each instruction set passed to
+// dispatch::ForeachTarget, and checks that they all produce the same output.
+// Kernel::Run<Target>(out) calls the kernel for the whole image.
+template <class Kernel, class ImageT>
+class BenchTargets {
+ public:
+  BenchTargets(const BenchParams& params, const char* name,
+               const double units, const char* unit_name, const Kernel& kernel,
+               ImageT* out)
+      : params_(params),
+        name_(name),
+        units_(units),
+        unit_name_(unit_name),
+        kernel_(kernel),
+        out_(out) {}
+
+  template <class Target>
+  void operator()() {
+    if (IsFilteredOut(params_, name_)) return;
+    const auto run = [this]() { kernel_.template Run<Target>(out_); };
+    run();
+    if (reference_.xsize() == 0) {
+      reference_ = CopyOf(*out_);
+    } else {
+      PIK_CHECK(SamePixels(reference_, *out_));
+    }
+    Measure(params_, name_, units_, unit_name_, run, Target::value);
+  }
+
+ private:
+  const BenchParams& params_;
+  const char* name_;
+  const double units_;
+  const char* unit_name_;
+  const Kernel& kernel_;
+  ImageT* out_;
+  ImageT reference_;
+};
+
+template <class Kernel, class ImageT>
+void ForeachTarget(const BenchParams& params, const char* name,
+                   const double units, const char* unit_name,
+                   const Kernel& kernel, ImageT* out) {
+  dispatch::ForeachTarget(
+      dispatch::SupportedTargets(),
+      BenchTargets<Kernel, ImageT>(params, name, units, unit_name, kernel,
+                                   out));
+}
+
+// One row of "blocks" per row of 8x8 blocks of each plane of "opsin".
+struct DCTBlocksKernel {
+  template <class Target>
+  void Run(ImageF* blocks) const {
+    const size_t bys = opsin.ysize() / 8;
+    for (int c = 0; c < 3; ++c) {
+      for (size_t by = 0; by < bys; ++by) {
+        TransposedScaledDCTBlocks().operator()<Target>(
+            opsin.ConstPlaneRow(c, by * 8), opsin.xsize() / 8,
+            opsin.plane(c).PixelsPerRow(), 1.0f / 64, blocks->Row(c * bys + by));
+      }
+    }
+  }
+
+  const Image3F& opsin;
+};
+
+struct IDCTBlocksKernel {
+  template <class Target>
+  void Run(ImageF* pixels) const {
+    for (size_t y = 0; y < blocks.ysize(); ++y) {
+      TransposedScaledIDCTBlocks().operator()<Target>(
+          blocks.ConstRow(y), blocks.xsize() / 64, pixels->PixelsPerRow(),
+          pixels->Row(y * 8));
+    }
+  }
+
+  const ImageF& blocks;
+};
+
+struct OpsinToSrgbKernel {
+  template <class Target>
+  void Run(Image3B* srgb) const {
+    for (size_t y = 0; y < centered.ysize(); ++y) {
+      CenteredOpsinToSrgbPixels().operator()<Target>(
+          centered.ConstRow(y).data(), centered.xsize(), y,
+          srgb->Row(y).data());
+    }
+  }
+
+  const Image3F& centered;
+};
+
+struct ConvolveKernel {
+  template <class Target>
+  void Run(ImageF* transposed) const {
+    for (size_t y = 0; y < in.ysize(); ++y) {
+      ConvolveRowTransposed().operator()<Target>(
+          in.ConstRow(y), transposed->ysize(), kernel.data(), kernel.size(),
+          1.0f, transposed->PixelsPerRow(), transposed->Row(0) + y);
+    }
+  }
+
+  const ImageF& in;
+  const std::vector<float>& kernel;
+};
+
+// Multipliers of QuantizeBlocksKernel and DequantizeBlocksKernel, similar in
+// range to those of Quantizer.
+struct QuantTables {
+  QuantTables(const size_t block_xsize) : quant_ac(block_xsize) {
+    for (int k = 0; k < 64; ++k) {
+      muls[k] = 0.25f + 0.05f * k;
+      qm[k] = 1.0f / (64.0f * muls[k]);
+    }
+    for (size_t bx = 0; bx < block_xsize; ++bx) {
+      quant_ac[bx] = 1 + bx % 7;
+    }
+  }
+
+  SIMD_ALIGN float qm[64];
+  SIMD_ALIGN float muls[64];
+  std::vector<int> quant_ac;
+};
+
+// One row of "qcoeffs" per row of "coeffs".
+struct QuantizeBlocksKernel {
+  template <class Target>
+  void Run(ImageW* qcoeffs) const {
+    for (size_t y = 0; y < coeffs.ysize(); ++y) {
+      QuantizeBlocks().operator()<Target>(
+          coeffs.ConstRow(y), coeffs.xsize() / 64, tables.qm,
+          tables.quant_ac.data(), 0.5f, 0.75f, 0.6f, qcoeffs->Row(y));
+    }
+  }
+
+  const ImageF& coeffs;
+  const QuantTables& tables;
+};
+
+struct DequantizeBlocksKernel {
+  template <class Target>
+  void Run(ImageF* coeffs) const {
+    for (size_t y = 0; y < qcoeffs.ysize(); ++y) {
+      DequantizeBlocks().operator()<Target>(
+          qcoeffs.ConstRow(y), qcoeffs.xsize() / 64, tables.muls,
+          tables.quant_ac.data(), 2.0f, 1.5f, coeffs->Row(y));
+    }
+  }
+
+  const ImageW& qcoeffs;
+  const QuantTables& tables;
+};
+
+void BenchDCT(const BenchParams& params, const Image3F& opsin) {
+  const double mpixels = 3 * opsin.xsize() * opsin.ysize() * 1E-6;
+  // One row of blocks per row, as in TransposedScaledDCT.
+  const size_t blocks_xsize = opsin.xsize() / 8 * 64;
+  ImageF blocks(blocks_xsize, 3 * opsin.ysize() / 8);
+  for (int c = 0; c < 3; ++c) {
+    for (size_t by = 0; by < opsin.ysize() / 8; ++by) {
+      float* const PIK_RESTRICT row = blocks.Row(c * opsin.ysize() / 8 + by);
+      for (size_t x = 0; x < blocks_xsize; ++x) {
+        row[x] = opsin.ConstPlaneRow(c, by * 8 + (x % 64) / 8)[x / 64 * 8 +
+                                                                 x % 8];
+      }
+    }
+  }
+  ImageF out(blocks.xsize(), blocks.ysize());
+  const auto transform = [&blocks, &out](void (*func)(float*)) {
+    alignas(32) float block[64];
+    for (size_t y = 0; y < blocks.ysize(); ++y) {
+      const float* const PIK_RESTRICT row_in = blocks.ConstRow(y);
+      float* const PIK_RESTRICT row_out = out.Row(y);
+      for (size_t x = 0; x < blocks.xsize(); x += 64) {
+        memcpy(block, row_in + x, sizeof(block));
+        func(block);
+        memcpy(row_out + x, block, sizeof(block));
+      }
+    }
+  };
+  Measure(params, "ComputeTransposedScaledBlockDCT", mpixels, "MP", [&]() {
+    transform(&ComputeTransposedScaledBlockDCTFloat);
+  });
+  Measure(params, "ComputeTransposedScaledBlockIDCT", mpixels, "MP", [&]() {
+    transform(&ComputeTransposedScaledBlockIDCTFloat);
+  });
+  const double mblocks = mpixels / 64;
+  ImageF dct_blocks(blocks.xsize(), blocks.ysize());
+  ForeachTarget(params, "TransposedScaledDCTBlocks", mblocks, "Mblocks",
+                DCTBlocksKernel{opsin}, &dct_blocks);
+  ImageF idct_pixels(blocks.xsize() / 8, blocks.ysize() * 8);
+  ForeachTarget(params, "TransposedScaledIDCTBlocks", mblocks, "Mblocks",
+                IDCTBlocksKernel{blocks}, &idct_pixels);
+  Image3F coeffs;
+  Measure(params, "TransposedScaledDCT", mpixels, "MP", [&]() {
+    TransposedScaledDCT(opsin, nullptr, &coeffs);
+  }, params.dispatched_target);
+}
+
+void BenchQuantize(const BenchParams& params, const Image3F& opsin) {
+  const double mpixels = 3 * opsin.xsize() * opsin.ysize() * 1E-6;
+  Image3F centered = CopyImage3(opsin);
+  CenterOpsinValues(&centered);
+  const Image3F coeffs = TransposedScaledDCT(centered);
+  Quantizer quantizer(opsin.xsize() / 8, opsin.ysize() / 8);
+  quantizer.SetQuant(1.0f);
+  Image3W qcoeffs;
+  Measure(params, "QuantizeCoeffs", mpixels, "MP", [&]() {
+    qcoeffs = QuantizeCoeffs(coeffs, quantizer);
+  }, params.dispatched_target);
+  Image3F dequantized;
+  Measure(params, "DequantizeCoeffs", mpixels, "MP", [&]() {
+    dequantized = DequantizeCoeffs(qcoeffs, quantizer);
+  }, params.dispatched_target);
+  // The planes one below the other, and coefficients scaled to a range
+  // similar to the Quantizer's input.
+  ImageF blocks(coeffs.xsize(), 3 * coeffs.ysize());
+  for (int c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < coeffs.ysize(); ++y) {
+      const float* PIK_RESTRICT row_in = coeffs.ConstPlaneRow(c, y);
+      float* PIK_RESTRICT row_out = blocks.Row(c * coeffs.ysize() + y);
+      for (size_t x = 0; x < coeffs.xsize(); ++x) {
+        row_out[x] = row_in[x] * 1000.0f;
+      }
+    }
+  }
+  const QuantTables tables(blocks.xsize() / 64);
+  ImageW qblocks(blocks.xsize(), blocks.ysize());
+  ForeachTarget(params, "QuantizeBlocks", mpixels, "MP",
+                QuantizeBlocksKernel{blocks, tables}, &qblocks);
+  ImageF dqblocks(blocks.xsize(), blocks.ysize());
+  ForeachTarget(params, "DequantizeBlocks", mpixels, "MP",
+                DequantizeBlocksKernel{qblocks, tables}, &dqblocks);
+  Image3B srgb;
+  Measure(params, "CenteredOpsinToSrgb", mpixels / 3, "MP", [&]() {
+    CenteredOpsinToSrgb(centered, &srgb);
+  }, params.dispatched_target);
+  ForeachTarget(params, "CenteredOpsinToSrgbPixels", mpixels / 3, "MP",
+                OpsinToSrgbKernel{centered}, &srgb);
+}
+
+// Compares evaluating the YToB candidates of the coarsest step of
+// FindBestYToBCorrelation via EstimateEncodedSize with encoding them via
+// EncodeToBitstream. Both require the quantized coefficients, which are thus
+// computed beforehand.
+void BenchYToBSearch(const BenchParams& params, const Image3F& opsin) {
+  const char* estimate_name = "EstimateEncodedSize(YToB)";
+  const char* encode_name = "EncodeToBitstream(YToB)";
+  if (IsFilteredOut(params, estimate_name) &&
+      IsFilteredOut(params, encode_name)) {
+    return;
+  }
+  Image3F centered = CopyImage3(opsin);
+  CenterOpsinValues(&centered);
+  const EncoderSearchState search(centered);
+  Quantizer quantizer(opsin.xsize() / 8, opsin.ysize() / 8);
+  quantizer.SetQuant(1.0f);
+  std::vector<int> ytobs;
+  std::vector<QuantizedCoeffs> candidates;
+  for (int ytob = 0; ytob <= 255; ytob += 16) {
+    ytobs.push_back(ytob);
+    candidates.push_back(search.ComputeCoefficients(quantizer, -ytob / 128.0f));
+  }
+  // Of all candidates, hence the throughputs are per candidate.
+  const double mpixels = candidates.size() * opsin.xsize() * opsin.ysize() *
+                         1E-6;
+  std::vector<size_t> sizes(candidates.size());
+  const double estimate_mps = Measure(params, estimate_name, mpixels, "MP",
+                                      [&]() {
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      sizes[i] = EstimateEncodedSize(candidates[i], quantizer);
+    }
+  });
+  const double encode_mps = Measure(params, encode_name, mpixels, "MP", [&]() {
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      sizes[i] = EncodeToBitstream(candidates[i], quantizer, ytobs[i],
+                                   /*fast_mode=*/false, nullptr).size();
+    }
+  });
+  if (estimate_mps != 0.0 && encode_mps != 0.0) {
+    printf("%-32s      %10.2f ms/MP per candidate\n", "YToB time saved",
+           1E3 / encode_mps - 1E3 / estimate_mps);
+  }
+}
+
+void BenchEntropy(const BenchParams& params, std::mt19937* rng) {
+  const std::vector<int> symbols =
+      SyntheticSymbols(params.xsize * params.ysize, rng);
+
+  const std::vector<uint8_t> ans = EncodeANS(symbols);
+  const double ans_mbytes = ans.size() * 1E-6;
+  std::vector<int> histogram = Histogram(symbols);
+  std::vector<ANSEncSymbolInfo> table(kAlphabetSize);
+  BuildAndStoreANSEncodingData(histogram.data(), kAlphabetSize, table.data(),
+                               nullptr, nullptr);
+  std::vector<uint32_t> words;
+  Measure(params, "ANSCoder", ans_mbytes, "MB", [&]() {
+    EncodeANSBlocks(table, symbols, &words);
+  });
+  Measure(params, "ANSSymbolReader::ReadSymbol", ans_mbytes, "MB", [&]() {
+    BitReader br(ans.data(), ans.size());
+    ANSSymbolReader decoder;
+    PIK_CHECK(decoder.DecodeHistograms(1, kAlphabetSize, nullptr, 0, &br));
+    br.JumpToByteBoundary();
+    for (size_t i = 0; i < symbols.size(); ++i) {
+      br.FillBitBuffer();
+      PIK_CHECK(decoder.ReadSymbol(0, &br) == symbols[i]);
+    }
+    PIK_CHECK(decoder.CheckANSFinalState());
+  });
+
+  const std::vector<uint8_t> huffman = EncodeHuffman(symbols);
+  Measure(params, "HuffmanDecoder::ReadSymbol", huffman.size() * 1E-6, "MB",
+          [&]() {
+    BitReader br(huffman.data(), huffman.size());
+    HuffmanDecodingData code;
+    PIK_CHECK(code.ReadFromBitStream(&br));
+    HuffmanDecoder decoder;
+    for (size_t i = 0; i < symbols.size(); ++i) {
+      PIK_CHECK(decoder.ReadSymbol(code, &br) == symbols[i]);
+    }
+  });
+}
+
+void BenchDC(const BenchParams& params, const Image3F& opsin) {
+  const double mpixels = opsin.xsize() * opsin.ysize() * 1E-6;
+  // Quantized luminance, as a DC image of the benchmark size.
+  Image<DC> dc(opsin.xsize(), opsin.ysize());
+  for (size_t y = 0; y < opsin.ysize(); ++y) {
+    const float* const PIK_RESTRICT row_in = opsin.ConstPlaneRow(1, y);
+    DC* const PIK_RESTRICT row_out = dc.Row(y);
+    for (size_t x = 0; x < opsin.xsize(); ++x) {
+      row_out[x] = static_cast<DC>(row_in[x] * 1024.0f);
+    }
+  }
+  Image<DC> residuals(dc.xsize(), dc.ysize());
+  Measure(params, "ShrinkY", mpixels, "MP", [&]() {
+    ShrinkY(dc, &residuals);
+  });
+  // Also if ShrinkY was filtered out.
+  ShrinkY(dc, &residuals);
+  Image<DC> expanded(dc.xsize(), dc.ysize());
+  Measure(params, "ExpandY", mpixels, "MP", [&]() {
+    ExpandY(residuals, &expanded);
+  });
+  ExpandY(residuals, &expanded);
+  PIK_CHECK(SamePixels(dc, expanded));
+
+  // Same kernel as Compute2x2ACFromDC.
+  const std::vector<float> kernel = {0.027630534f, 0.133676439f, 0.027630534f};
+  Image3F convolved;
+  Measure(params, "ConvolveXSampleAndTranspose", 3 * mpixels, "MP", [&]() {
+    convolved = ConvolveXSampleAndTranspose(opsin, kernel, 1);
+  });
+
+  // Similar to the largest blur of butteraugli's SeparateFrequencies.
+  std::vector<float> blur_kernel(33);
+  for (int i = 0; i < blur_kernel.size(); ++i) {
+    blur_kernel[i] = std::exp(-(i - 16) * (i - 16) / (2 * 7.4f * 7.4f));
+  }
+  ImageF transposed(opsin.ysize(), opsin.xsize() - blur_kernel.size() + 1);
+  ForeachTarget(params, "ConvolveRowTransposed", mpixels, "MP",
+                ConvolveKernel{opsin.plane(0), blur_kernel}, &transposed);
+}
+
+// Returns the per-pixel scalar conversion that OpsinDynamicsImage vectorizes.
+Image3F ScalarOpsinDynamicsImage(const Image3F& linear) {
+  Image3F opsin(linear.xsize(), linear.ysize());
+  for (size_t y = 0; y < linear.ysize(); ++y) {
+    const auto row_in = linear.ConstRow(y);
+    auto row_out = opsin.Row(y);
+    for (size_t x = 0; x < linear.xsize(); ++x) {
+      const float rgb[3] = {row_in[0][x], row_in[1][x], row_in[2][x]};
+      LinearToXyb(rgb, &row_out[0][x], &row_out[1][x], &row_out[2][x]);
+    }
+  }
+  return opsin;
+}
+
+Image3F ScalarOpsinDynamicsImage(const Image3B& srgb) {
+  Image3F opsin(srgb.xsize(), srgb.ysize());
+  for (size_t y = 0; y < srgb.ysize(); ++y) {
+    const auto row_in = srgb.ConstRow(y);
+    auto row_out = opsin.Row(y);
+    for (size_t x = 0; x < srgb.xsize(); ++x) {
+      RgbToXyb(row_in[0][x], row_in[1][x], row_in[2][x], &row_out[0][x],
+               &row_out[1][x], &row_out[2][x]);
+    }
+  }
+  return opsin;
+}
+
+template <class ImageT>
+struct OpsinDynamicsKernel {
+  template <class Target>
+  void Run(Image3F* opsin) const {
+    for (size_t y = 0; y < image.ysize(); ++y) {
+      OpsinDynamicsPixels().operator()<Target>(
+          image.ConstRow(y).data(), image.xsize(), opsin->Row(y).data());
+    }
+  }
+
+  const ImageT& image;
+};
+
+void BenchOpsin(const BenchParams& params, const Image3F& linear,
+                const Image3B& srgb) {
+  const double mpixels = linear.xsize() * linear.ysize() * 1E-6;
+  Image3F opsin;
+  Measure(params, "OpsinDynamicsImage(linear)", mpixels, "MP", [&]() {
+    OpsinDynamicsImage(linear, nullptr, &opsin);
+  }, params.dispatched_target);
+  Image3F scalar;
+  Measure(params, "ScalarOpsinDynamicsImage(linear)", mpixels, "MP", [&]() {
+    scalar = ScalarOpsinDynamicsImage(linear);
+  });
+  // Vector and scalar conversions are identical, also for all targets below.
+  OpsinDynamicsImage(linear, nullptr, &opsin);
+  PIK_CHECK(SamePixels(ScalarOpsinDynamicsImage(linear), opsin));
+  ForeachTarget(params, "OpsinDynamicsPixels(linear)", mpixels, "MP",
+                OpsinDynamicsKernel<Image3F>{linear}, &opsin);
+
+  Measure(params, "OpsinDynamicsImage(sRGB)", mpixels, "MP", [&]() {
+    OpsinDynamicsImage(srgb, nullptr, &opsin);
+  }, params.dispatched_target);
+  Measure(params, "ScalarOpsinDynamicsImage(sRGB)", mpixels, "MP", [&]() {
+    scalar = ScalarOpsinDynamicsImage(srgb);
+  });
+  OpsinDynamicsImage(srgb, nullptr, &opsin);
+  PIK_CHECK(SamePixels(ScalarOpsinDynamicsImage(srgb), opsin));
+  ForeachTarget(params, "OpsinDynamicsPixels(sRGB)", mpixels, "MP",
+                OpsinDynamicsKernel<Image3B>{srgb}, &opsin);
+
+  // Encoder front end, fused versus separate passes.
+  const float ytob_factor = -120 / 128.0f;
+  Image3F aligned;
+  const auto fused = [&]() {
+    CenteredOpsinDynamicsImage(srgb, 0, srgb.ysize(), ytob_factor, nullptr,
+                               &aligned);
+  };
+  Image3F separate;
+  const auto separate_passes = [&]() {
+    OpsinDynamicsImage(srgb, nullptr, &opsin);
+    AlignImage(opsin, 8, &separate);
+    CenterOpsinValues(&separate);
+    YToBTransform(ytob_factor, &separate);
+  };
+  fused();
+  separate_passes();
+  PIK_CHECK(SamePixels(separate, aligned));
+  Measure(params, "CenteredOpsinDynamicsImage(sRGB)", mpixels, "MP", fused,
+          params.dispatched_target);
+  Measure(params, "OpsinImage+Align+Center+YToB", mpixels, "MP",
+          separate_passes, params.dispatched_target);
+}
+
+void BenchButteraugli(const BenchParams& params, const Image3F& linear,
+                      std::mt19937* rng) {
+  const double mpixels = linear.xsize() * linear.ysize() * 1E-6;
+  const std::vector<butteraugli::ImageF> rgb0 = ButteraugliPlanes(linear);
+  std::vector<butteraugli::ImageF> rgb1 = ButteraugliPlanes(linear);
+  std::normal_distribution<float> noise(0.0f, 2.0f);
+  for (int c = 0; c < 3; ++c) {
+    for (size_t y = 0; y < linear.ysize(); ++y) {
+      float* const PIK_RESTRICT row = rgb1[c].Row(y);
+      for (size_t x = 0; x < linear.xsize(); ++x) {
+        row[x] = std::min(255.0f, std::max(0.0f, row[x] + noise(*rng)));
+      }
+    }
+  }
+  const butteraugli::ButteraugliComparator comparator(rgb0);
+  butteraugli::ImageF diffmap;
+  Measure(params, "ButteraugliComparator::Diffmap", mpixels, "MP", [&]() {
+    comparator.Diffmap(rgb1, diffmap);
+  });
+}
+
+// Decodes a tiled image with PikToPixelRows and PikToPixels. The streaming
+// decoder runs first, so that its result cannot depend on stale coefficients
+// of a previous decode, and must match PikToPixels exactly.
+void BenchDecode(const BenchParams& params, const Image3B& srgb) {
+  const char* rows_name = "PikToPixelRows(tiled)";
+  const char* pixels_name = "PikToPixels(tiled)";
+  if (IsFilteredOut(params, rows_name) && IsFilteredOut(params, pixels_name)) {
+    return;
+  }
+  const double mpixels = srgb.xsize() * srgb.ysize() * 1E-6;
+  CompressParams cparams;
+  cparams.fast_mode = true;
+  cparams.tile_group_rows = 8;
+  PaddedBytes compressed;
+  PIK_CHECK(PixelsToPik(cparams, srgb, &compressed, nullptr));
+
+  const DecompressParams dparams;
+  Image3B rows(srgb.xsize(), srgb.ysize());
+  const PixelRowsCallback<uint8_t> callback =
+      [&rows](const size_t ysize, const size_t y0, const Image3B& stripe) {
+        for (int c = 0; c < 3; ++c) {
+          for (size_t y = 0; y < stripe.ysize(); ++y) {
+            memcpy(rows.PlaneRow(c, y0 + y), stripe.ConstPlaneRow(c, y),
+                   stripe.xsize());
+          }
+        }
+        return true;
+      };
+  PIK_CHECK(PikToPixelRows(dparams, compressed, callback, nullptr));
+  Image3B pixels;
+  PIK_CHECK(PikToPixels(dparams, compressed, &pixels, nullptr));
+  PIK_CHECK(SamePixels(pixels, rows));
+
+  Measure(params, rows_name, mpixels, "MP", [&]() {
+    PikToPixelRows(dparams, compressed, callback, nullptr);
+  });
+  Measure(params, pixels_name, mpixels, "MP", [&]() {
+    PikToPixels(dparams, compressed, &pixels, nullptr);
+  });
+}
+
+int Run(BenchParams params) {
+  std::mt19937 rng(12345);
+  const Image3F linear = SyntheticLinearImage(params.xsize, params.ysize, &rng);
+  Image3B srgb(params.xsize, params.ysize);
+  const Image3F opsin = OpsinDynamicsImage(linear);
+  CenteredOpsinToSrgb(opsin, &srgb);
+
+  const int supported = dispatch::SupportedTargets();
+  params.dispatched_target = dispatch::Run(DispatchedTarget());
+  printf("%zux%zu, %d reps, %.3f GHz; kernels compiled for %s, dispatched to"
+         " %s, CPU supports:", params.xsize, params.ysize, params.num_reps,
+         InvariantTicksPerSecond() * 1E-9, TargetName(SIMD_TARGET::value),
+         TargetName(params.dispatched_target));
+  for (const int target : {SIMD_AVX2, SIMD_SSE4, SIMD_ARM8}) {
+    if (supported & target) printf(" %s", TargetName(target));
+  }
+  printf("\n");
+
+  BenchDCT(params, opsin);
+  BenchQuantize(params, opsin);
+  BenchYToBSearch(params, opsin);
+  BenchEntropy(params, &rng);
+  BenchDC(params, opsin);
+  BenchOpsin(params, linear, srgb);
+  BenchButteraugli(params, linear, &rng);
+  BenchDecode(params, srgb);
+  return 0;
+}
+
+}  // namespace
+}  // namespace pik
+
+void PrintArgHelp(int argc, char** argv) {
+  fprintf(stderr,
+      "Usage: %s [--xsize <N>] [--ysize <N>] [--reps <N>] [--filter <name>]\n"
+      " --xsize, --ysize: Size of the synthetic image in pixels, rounded up"
+      " to a multiple of 8, default 512.\n"
+      " --reps: Number of measurements per kernel, default 15.\n"
+      " --filter: Only runs the kernels whose name contains this string.\n"
+      " --help: Show this help.\n",
+      argv[0]);
+}
+
+void ExitWithArgError(int argc, char** argv) {
+  PrintArgHelp(argc, argv);
+  std::exit(1);
+}
+
+int main(int argc, char** argv) {
+  pik::BenchParams params;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--help") {
+      PrintArgHelp(argc, argv);
+      return 0;
+    }
+    if (i + 1 >= argc) ExitWithArgError(argc, argv);
+    const char* value = argv[++i];
+    if (arg == "--xsize" || arg == "--ysize" || arg == "--reps") {
+      const long number = strtol(value, nullptr, 10);
+      if (number < 1) {
+        fprintf(stderr, "Invalid value '%s' for %s.\n", value, arg.c_str());
+        return 1;
+      }
+      if (arg == "--xsize") params.xsize = (number + 7) & ~7;
+      if (arg == "--ysize") params.ysize = (number + 7) & ~7;
+      if (arg == "--reps") params.num_reps = number;
+    } else if (arg == "--filter") {
+      params.filter = value;
+    } else {
+      ExitWithArgError(argc, argv);
+    }
+  }
+  return pik::Run(params);
+}
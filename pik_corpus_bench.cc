@@ -0,0 +1,599 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Encodes and decodes every PNG of a directory at several distances, writes
+// the size, quality, speed and memory of each as JSON and compares them with
+// a previous (baseline) JSON. Unlike scripts around cpik/dpik, the timings
+// exclude process startup and image I/O.
+
+#include <dirent.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "arch_specific.h"
+#include "butteraugli_distance.h"
+#include "image.h"
+#include "image_io.h"
+#include "padded_bytes.h"
+#include "pik.h"
+#include "pik_info.h"
+#include "robust_statistics.h"
+#include "tsc_timer.h"
+
+namespace pik {
+namespace {
+
+struct CorpusParams {
+  std::string dir;
+  // Butteraugli distances, or "fast" for fast mode.
+  std::vector<std::string> modes = {"1.0"};
+  int num_threads = 1;
+  // Single runs vary by 10-20%, hence the medians of several.
+  int encode_reps = 5;
+  int decode_reps = 5;
+  const char* json_out = nullptr;
+  const char* baseline = nullptr;
+  // Relative changes beyond these are reported as regressions. Speed changes
+  // must also exceed the sum of the median absolute deviations (MAD) of the
+  // baseline and current speed.
+  double size_threshold = 0.01;
+  double speed_threshold = 0.10;
+};
+
+// Result of one image at one distance (mode).
+struct Record {
+  std::string image;
+  std::string mode;
+  size_t xsize = 0;
+  size_t ysize = 0;
+  size_t bytes = 0;
+  double bpp = 0.0;
+  double butteraugli = 0.0;
+  double encode_mps = 0.0;
+  double decode_mps = 0.0;
+  // Median absolute deviation of the speeds.
+  double encode_mps_mad = 0.0;
+  double decode_mps_mad = 0.0;
+  size_t encode_peak_bytes = 0;
+  size_t decode_peak_bytes = 0;
+};
+
+std::vector<std::string> PngFiles(const std::string& dir) {
+  std::vector<std::string> names;
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr) return names;
+  while (const dirent* entry = readdir(d)) {
+    const std::string name = entry->d_name;
+    if (name.size() > 4 && (name.compare(name.size() - 4, 4, ".png") == 0 ||
+                            name.compare(name.size() - 4, 4, ".PNG") == 0)) {
+      names.push_back(name);
+    }
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+// Returns the median over "num_reps" calls of the seconds taken by "func",
+// or zero if any call returns false. "mad" receives their median absolute
+// deviation.
+template <class Func>
+double MedianSeconds(const int num_reps, const Func& func, double* mad) {
+  std::vector<double> seconds;
+  for (int rep = 0; rep < num_reps; ++rep) {
+    const uint64_t t0 = Start<uint64_t>();
+    if (!func()) return 0.0;
+    const uint64_t ticks = Stop<uint64_t>() - t0;
+    seconds.push_back(ticks / InvariantTicksPerSecond());
+  }
+  const double median = Median(&seconds);
+  *mad = MedianAbsoluteDeviation(seconds, median);
+  return median;
+}
+
+bool RunImage(const CorpusParams& params, const std::string& name,
+              const std::string& mode, const Image3B& image, Record* record) {
+  CompressParams cparams;
+  cparams.num_threads = params.num_threads;
+  if (mode == "fast") {
+    cparams.fast_mode = true;
+  } else {
+    cparams.butteraugli_distance = strtod(mode.c_str(), nullptr);
+  }
+  PaddedBytes compressed;
+  PikInfo encode_info;
+  double encode_mad = 0.0;
+  const double encode_seconds = MedianSeconds(params.encode_reps, [&]() {
+    return PixelsToPik(cparams, image, &compressed, &encode_info);
+  }, &encode_mad);
+  if (encode_seconds == 0.0) {
+    fprintf(stderr, "Failed to compress %s at %s.\n", name.c_str(),
+            mode.c_str());
+    return false;
+  }
+
+  DecompressParams dparams;
+  dparams.num_threads = params.num_threads;
+  Image3B decoded;
+  PikInfo decode_info;
+  double decode_mad = 0.0;
+  const double decode_seconds = MedianSeconds(params.decode_reps, [&]() {
+    return PikToPixels(dparams, compressed, &decoded, &decode_info);
+  }, &decode_mad);
+  if (decode_seconds == 0.0) {
+    fprintf(stderr, "Failed to decompress %s at %s.\n", name.c_str(),
+            mode.c_str());
+    return false;
+  }
+
+  const double mpixels = image.xsize() * image.ysize() * 1E-6;
+  record->image = name;
+  record->mode = mode;
+  record->xsize = image.xsize();
+  record->ysize = image.ysize();
+  record->bytes = compressed.size();
+  record->bpp = compressed.size() * 8.0 / (image.xsize() * image.ysize());
+  record->butteraugli = ButteraugliDistance(image, decoded, nullptr);
+  record->encode_mps = mpixels / encode_seconds;
+  record->decode_mps = mpixels / decode_seconds;
+  // Relative deviations of seconds and speed are equal to first order.
+  record->encode_mps_mad = record->encode_mps * encode_mad / encode_seconds;
+  record->decode_mps_mad = record->decode_mps * decode_mad / decode_seconds;
+  record->encode_peak_bytes = encode_info.peak_memory_bytes;
+  record->decode_peak_bytes = decode_info.peak_memory_bytes;
+  return true;
+}
+
+std::string JsonString(const std::string& s) {
+  std::string out = "\"";
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+bool WriteJson(const std::vector<Record>& records, const char* pathname) {
+  FILE* f = fopen(pathname, "w");
+  if (f == nullptr) {
+    fprintf(stderr, "Failed to open %s.\n", pathname);
+    return false;
+  }
+  fprintf(f, "{\n  \"records\": [\n");
+  for (size_t i = 0; i < records.size(); ++i) {
+    const Record& r = records[i];
+    fprintf(f,
+            "    {\"image\": %s, \"mode\": %s, \"xsize\": %zu, "
+            "\"ysize\": %zu, \"bytes\": %zu, \"bpp\": %.6f, "
+            "\"butteraugli\": %.6f, \"encode_mps\": %.6g, "
+            "\"decode_mps\": %.6g, \"encode_mps_mad\": %.6g, "
+            "\"decode_mps_mad\": %.6g, \"encode_peak_bytes\": %zu, "
+            "\"decode_peak_bytes\": %zu}%s\n",
+            JsonString(r.image).c_str(), JsonString(r.mode).c_str(), r.xsize,
+            r.ysize, r.bytes, r.bpp, r.butteraugli, r.encode_mps,
+            r.decode_mps, r.encode_mps_mad, r.decode_mps_mad,
+            r.encode_peak_bytes, r.decode_peak_bytes,
+            i + 1 == records.size() ? "" : ",");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+  return true;
+}
+
+// Parser for the output of WriteJson, i.e. an object whose "records" member
+// is an array of objects with string and number members. Other members are
+// skipped.
+class JsonReader {
+ public:
+  explicit JsonReader(const std::string& text)
+      : pos_(text.c_str()), end_(text.c_str() + text.size()) {}
+
+  bool ReadRecords(std::vector<Record>* records) {
+    if (!Expect('{')) return false;
+    while (!Peek('}')) {
+      std::string key;
+      if (!ReadString(&key) || !Expect(':')) return false;
+      if (key == "records") {
+        if (!Expect('[')) return false;
+        while (!Peek(']')) {
+          records->emplace_back();
+          if (!ReadRecord(&records->back())) return false;
+          if (!Peek(']') && !Expect(',')) return false;
+        }
+        if (!Expect(']')) return false;
+      } else if (!SkipValue()) {
+        return false;
+      }
+      if (!Peek('}') && !Expect(',')) return false;
+    }
+    return Expect('}');
+  }
+
+ private:
+  void SkipSpace() {
+    while (pos_ < end_ && strchr(" \t\r\n", *pos_) != nullptr) ++pos_;
+  }
+
+  bool Peek(const char c) {
+    SkipSpace();
+    return pos_ < end_ && *pos_ == c;
+  }
+
+  bool Expect(const char c) {
+    if (!Peek(c)) {
+      fprintf(stderr, "JSON: expected '%c'.\n", c);
+      return false;
+    }
+    ++pos_;
+    return true;
+  }
+
+  bool ReadString(std::string* s) {
+    if (!Expect('"')) return false;
+    s->clear();
+    while (pos_ < end_ && *pos_ != '"') {
+      if (*pos_ == '\\' && pos_ + 1 < end_) {
+        ++pos_;
+        if (*pos_ == 'u' && pos_ + 4 < end_) {
+          *s += static_cast<char>(strtol(std::string(pos_ + 1, 4).c_str(),
+                                         nullptr, 16));
+          pos_ += 4;
+        } else {
+          *s += *pos_;
+        }
+      } else {
+        *s += *pos_;
+      }
+      ++pos_;
+    }
+    return Expect('"');
+  }
+
+  bool ReadNumber(double* value) {
+    SkipSpace();
+    char* number_end;
+    *value = strtod(pos_, &number_end);
+    if (number_end == pos_) {
+      fprintf(stderr, "JSON: expected a number.\n");
+      return false;
+    }
+    pos_ = number_end;
+    return true;
+  }
+
+  bool SkipValue() {
+    if (Peek('"')) {
+      std::string ignored;
+      return ReadString(&ignored);
+    }
+    if (Peek('{') || Peek('[')) {
+      const char close = *pos_ == '{' ? '}' : ']';
+      ++pos_;
+      while (!Peek(close)) {
+        if (close == '}') {
+          std::string ignored;
+          if (!ReadString(&ignored) || !Expect(':')) return false;
+        }
+        if (!SkipValue()) return false;
+        if (!Peek(close) && !Expect(',')) return false;
+      }
+      return Expect(close);
+    }
+    double ignored;
+    return ReadNumber(&ignored);
+  }
+
+  bool ReadRecord(Record* r) {
+    const std::map<std::string, std::string*> strings = {
+        {"image", &r->image}, {"mode", &r->mode}};
+    const std::map<std::string, double*> doubles = {
+        {"bpp", &r->bpp},
+        {"butteraugli", &r->butteraugli},
+        {"encode_mps", &r->encode_mps},
+        {"decode_mps", &r->decode_mps},
+        {"encode_mps_mad", &r->encode_mps_mad},
+        {"decode_mps_mad", &r->decode_mps_mad}};
+    const std::map<std::string, size_t*> sizes = {
+        {"xsize", &r->xsize},
+        {"ysize", &r->ysize},
+        {"bytes", &r->bytes},
+        {"encode_peak_bytes", &r->encode_peak_bytes},
+        {"decode_peak_bytes", &r->decode_peak_bytes}};
+    if (!Expect('{')) return false;
+    while (!Peek('}')) {
+      std::string key;
+      if (!ReadString(&key) || !Expect(':')) return false;
+      double value;
+      if (strings.count(key)) {
+        if (!ReadString(strings.at(key))) return false;
+      } else if (doubles.count(key)) {
+        if (!ReadNumber(doubles.at(key))) return false;
+      } else if (sizes.count(key)) {
+        if (!ReadNumber(&value)) return false;
+        *sizes.at(key) = static_cast<size_t>(value);
+      } else if (!SkipValue()) {
+        return false;
+      }
+      if (!Peek('}') && !Expect(',')) return false;
+    }
+    return Expect('}');
+  }
+
+  const char* pos_;
+  const char* const end_;
+};
+
+bool ReadJson(const char* pathname, std::vector<Record>* records) {
+  FILE* f = fopen(pathname, "rb");
+  if (f == nullptr) {
+    fprintf(stderr, "Failed to open %s.\n", pathname);
+    return false;
+  }
+  std::string text;
+  char buf[4096];
+  size_t bytes_read;
+  while ((bytes_read = fread(buf, 1, sizeof(buf), f)) > 0) {
+    text.append(buf, bytes_read);
+  }
+  fclose(f);
+  if (!JsonReader(text).ReadRecords(records)) {
+    fprintf(stderr, "Failed to parse %s.\n", pathname);
+    return false;
+  }
+  return true;
+}
+
+// Sums over records, for comparing whole corpora.
+struct Totals {
+  void Add(const Record& r) {
+    const double mpixels = r.xsize * r.ysize * 1E-6;
+    this->mpixels += mpixels;
+    bytes += r.bytes;
+    butteraugli += r.butteraugli;
+    encode_seconds += mpixels / r.encode_mps;
+    decode_seconds += mpixels / r.decode_mps;
+    encode_mad_seconds += mpixels / r.encode_mps * r.encode_mps_mad /
+                          r.encode_mps;
+    decode_mad_seconds += mpixels / r.decode_mps * r.decode_mps_mad /
+                          r.decode_mps;
+    ++num_records;
+  }
+
+  double EncodeMps() const { return mpixels / encode_seconds; }
+  double DecodeMps() const { return mpixels / decode_seconds; }
+  // Upper bounds on the MAD of the speeds, assuming the deviations add up.
+  double EncodeMpsMad() const {
+    return EncodeMps() * encode_mad_seconds / encode_seconds;
+  }
+  double DecodeMpsMad() const {
+    return DecodeMps() * decode_mad_seconds / decode_seconds;
+  }
+
+  double mpixels = 0.0;
+  size_t bytes = 0;
+  double butteraugli = 0.0;
+  double encode_seconds = 0.0;
+  double decode_seconds = 0.0;
+  double encode_mad_seconds = 0.0;
+  double decode_mad_seconds = 0.0;
+  size_t num_records = 0;
+};
+
+void PrintTotals(const char* label, const Totals& t) {
+  printf("%-32s %8.4f bpp  butteraugli %6.3f  encode %8.3f MP/s  "
+         "decode %8.3f MP/s\n", label, t.bytes * 8E-6 / t.mpixels,
+         t.butteraugli / t.num_records, t.EncodeMps(), t.DecodeMps());
+}
+
+// Prints and returns the number of regressions of "current" relative to
+// "baseline": larger sizes or lower speeds, per record and for the records
+// present in both. Speed changes within the measurement noise (MAD) are not
+// regressions; baselines without MAD only use the threshold.
+int CompareWithBaseline(const CorpusParams& params,
+                        const std::vector<Record>& current,
+                        const std::vector<Record>& baseline) {
+  std::map<std::pair<std::string, std::string>, const Record*> base_by_key;
+  for (const Record& r : baseline) {
+    base_by_key[std::make_pair(r.image, r.mode)] = &r;
+  }
+  int num_regressions = 0;
+  const auto check = [&params, &num_regressions](
+      const std::string& what, const char* metric, const double base,
+      const double cur, const bool larger_is_worse, const double threshold,
+      const double noise) {
+    const double change = base == 0.0 ? 0.0 : cur / base - 1.0;
+    const double worse = larger_is_worse ? change : -change;
+    if (worse > threshold && std::abs(cur - base) > noise) {
+      printf("REGRESSION %s %s: %.4f -> %.4f (%+.1f%%)\n", what.c_str(),
+             metric, base, cur, 100.0 * change);
+      ++num_regressions;
+    }
+  };
+  Totals base_totals, cur_totals;
+  for (const Record& r : current) {
+    const auto it = base_by_key.find(std::make_pair(r.image, r.mode));
+    if (it == base_by_key.end()) continue;
+    const Record& b = *it->second;
+    base_totals.Add(b);
+    cur_totals.Add(r);
+    const std::string what = r.image + " @" + r.mode;
+    check(what, "bytes", b.bytes, r.bytes, true, params.size_threshold, 0.0);
+    check(what, "encode MP/s", b.encode_mps, r.encode_mps, false,
+          params.speed_threshold, b.encode_mps_mad + r.encode_mps_mad);
+    check(what, "decode MP/s", b.decode_mps, r.decode_mps, false,
+          params.speed_threshold, b.decode_mps_mad + r.decode_mps_mad);
+  }
+  if (cur_totals.num_records == 0) {
+    printf("No records in common with the baseline.\n");
+    return 0;
+  }
+  PrintTotals("Baseline (common records)", base_totals);
+  PrintTotals("Current (common records)", cur_totals);
+  check("total", "bytes", base_totals.bytes, cur_totals.bytes, true,
+        params.size_threshold, 0.0);
+  check("total", "encode MP/s", base_totals.EncodeMps(),
+        cur_totals.EncodeMps(), false, params.speed_threshold,
+        base_totals.EncodeMpsMad() + cur_totals.EncodeMpsMad());
+  check("total", "decode MP/s", base_totals.DecodeMps(),
+        cur_totals.DecodeMps(), false, params.speed_threshold,
+        base_totals.DecodeMpsMad() + cur_totals.DecodeMpsMad());
+  printf("%d regression(s) relative to the baseline.\n", num_regressions);
+  return num_regressions;
+}
+
+int Run(const CorpusParams& params) {
+  const std::vector<std::string> names = PngFiles(params.dir);
+  if (names.empty()) {
+    fprintf(stderr, "No PNG files in %s.\n", params.dir.c_str());
+    return 1;
+  }
+  std::vector<Record> records;
+  Totals totals;
+  for (const std::string& name : names) {
+    Image3B image;
+    if (!ReadImage(ImageFormatPNG(), params.dir + "/" + name, &image)) {
+      fprintf(stderr, "Failed to read %s.\n", name.c_str());
+      return 1;
+    }
+    for (const std::string& mode : params.modes) {
+      Record record;
+      if (!RunImage(params, name, mode, image, &record)) return 1;
+      printf("%-24s %5s %5zux%-5zu %8.4f bpp  butteraugli %6.3f  "
+             "encode %8.3f MP/s  decode %8.3f MP/s  peak %zu/%zu KB\n",
+             name.c_str(), mode.c_str(), record.xsize, record.ysize,
+             record.bpp, record.butteraugli, record.encode_mps,
+             record.decode_mps, record.encode_peak_bytes >> 10,
+             record.decode_peak_bytes >> 10);
+      totals.Add(record);
+      records.push_back(record);
+    }
+  }
+  PrintTotals("Total", totals);
+
+  if (params.json_out != nullptr && !WriteJson(records, params.json_out)) {
+    return 1;
+  }
+  if (params.baseline != nullptr) {
+    std::vector<Record> baseline;
+    if (!ReadJson(params.baseline, &baseline)) return 1;
+    if (CompareWithBaseline(params, records, baseline) != 0) return 2;
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace pik
+
+void PrintArgHelp(int argc, char** argv) {
+  fprintf(stderr,
+      "Usage: %s dir [--distances <d,d,...>] [--num_threads <N>]"
+      " [--encode_reps <N>] [--decode_reps <N>] [--json out.json]"
+      " [--baseline in.json] [--size_threshold <f>]"
+      " [--speed_threshold <f>]\n"
+      " dir: Directory whose PNG files are compressed.\n"
+      " --distances: Butteraugli distances, or \"fast\" for fast mode,"
+      " default 1.0.\n"
+      " --num_threads: Number of threads to use, default 1.\n"
+      " --encode_reps, --decode_reps: The reported speed is the median of"
+      " this many runs, default 5.\n"
+      " --json: Writes the results to this file.\n"
+      " --baseline: Compares the results with this output of --json. The"
+      " exit code is 2 if there are regressions.\n"
+      " --size_threshold, --speed_threshold: Relative size increases and"
+      " speed decreases that are regressions, default 0.01 and 0.1. Speed"
+      " changes within the sum of the median absolute deviations of both"
+      " runs are ignored.\n"
+      " --help: Show this help.\n",
+      argv[0]);
+}
+
+void ExitWithArgError(int argc, char** argv) {
+  PrintArgHelp(argc, argv);
+  std::exit(1);
+}
+
+int main(int argc, char** argv) {
+  pik::CorpusParams params;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--help") {
+      PrintArgHelp(argc, argv);
+      return 0;
+    }
+    if (arg[0] != '-') {
+      if (!params.dir.empty()) ExitWithArgError(argc, argv);
+      params.dir = arg;
+      continue;
+    }
+    if (i + 1 >= argc) ExitWithArgError(argc, argv);
+    const char* value = argv[++i];
+    if (arg == "--distances") {
+      params.modes.clear();
+      std::string list = value;
+      size_t begin = 0;
+      while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) end = list.size();
+        const std::string mode = list.substr(begin, end - begin);
+        const double distance = strtod(mode.c_str(), nullptr);
+        if (mode != "fast" && !(0.5 <= distance && distance <= 3.0)) {
+          fprintf(stderr, "Invalid/out of range distance '%s', try 0.5 to"
+                  " 3 or fast.\n", mode.c_str());
+          return 1;
+        }
+        params.modes.push_back(mode);
+        begin = end + 1;
+      }
+    } else if (arg == "--num_threads" || arg == "--encode_reps" ||
+               arg == "--decode_reps") {
+      const int number = strtol(value, nullptr, 10);
+      if (number < 1) {
+        fprintf(stderr, "Invalid value '%s' for %s.\n", value, arg.c_str());
+        return 1;
+      }
+      if (arg == "--num_threads") params.num_threads = number;
+      if (arg == "--encode_reps") params.encode_reps = number;
+      if (arg == "--decode_reps") params.decode_reps = number;
+    } else if (arg == "--json") {
+      params.json_out = value;
+    } else if (arg == "--baseline") {
+      params.baseline = value;
+    } else if (arg == "--size_threshold") {
+      params.size_threshold = strtod(value, nullptr);
+    } else if (arg == "--speed_threshold") {
+      params.speed_threshold = strtod(value, nullptr);
+    } else {
+      ExitWithArgError(argc, argv);
+    }
+  }
+  if (params.dir.empty()) ExitWithArgError(argc, argv);
+  return pik::Run(params);
+}
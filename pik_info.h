@@ -15,10 +15,16 @@
 #ifndef PIK_INFO_H_
 #define PIK_INFO_H_
 
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
 #include <cstddef>
 #include <string>
 #include <vector>
 
+#include "arch_specific.h"
+#include "tsc_timer.h"
+
 namespace pik {
 
 struct PikImageSizeInfo {
@@ -49,14 +55,53 @@ static const char* kImageLayers[] = {
   "quant", "DC", "AC",
 };
 
+// Stages of the encoder and decoder whose time is measured.
+enum PikStage {
+  kStageOpsin,           // Conversion to centered opsin dynamics.
+  kStageDCT,             // Forward DCT.
+  kStageSearch,          // Search for the quantization and YToB factor.
+  kStageQuantize,        // Quantization, including the prediction.
+  kStageEntropyEncode,   // Entropy coding of the quantized coefficients.
+  kStageEntropyDecode,   // Entropy decoding of the quantized coefficients.
+  kStageReconstruct,     // Dequantization, IDCT and conversion to sRGB.
+  kStageAlpha,           // Encoding or decoding of the alpha channel.
+  kNumStages
+};
+static const char* kStageNames[] = {
+  "opsin", "DCT", "search", "quantize", "entropy encode", "entropy decode",
+  "reconstruct", "alpha",
+};
+
+struct PikStageTime {
+  void Assimilate(const PikStageTime& victim) {
+    ticks += victim.ticks;
+    num_calls += victim.num_calls;
+  }
+  void Print(size_t num_inputs) const {
+    // The invariant TSC counts cycles at the nominal clock rate.
+    const double seconds = ticks / InvariantTicksPerSecond();
+    printf("%10.3f ms %10.3f Mcycles %8.1f calls\n", seconds * 1E3 / num_inputs,
+           ticks * 1E-6 / num_inputs, num_calls * 1.0 / num_inputs);
+  }
+  // Elapsed wall-clock time in ticks of the Start/Stop timer, see
+  // InvariantTicksPerSecond.
+  uint64_t ticks = 0;
+  size_t num_calls = 0;
+};
+
 // Metadata and statistics gathered during compression or decompression.
 struct PikInfo {
-  PikInfo() : layers(kNumImageLayers) {}
+  PikInfo() : layers(kNumImageLayers), stages(kNumStages) {}
   void Assimilate(const PikInfo& victim) {
     for (int i = 0; i < layers.size(); ++i) {
       layers[i].Assimilate(victim.layers[i]);
     }
+    for (int i = 0; i < stages.size(); ++i) {
+      stages[i].Assimilate(victim.stages[i]);
+    }
     num_butteraugli_iters += victim.num_butteraugli_iters;
+    peak_memory_bytes = std::max(peak_memory_bytes, victim.peak_memory_bytes);
+    num_allocations += victim.num_allocations;
   }
   PikImageSizeInfo TotalImageSize() const {
     PikImageSizeInfo total;
@@ -76,17 +121,56 @@ struct PikInfo {
     }
     printf("Total image size           ");
     TotalImageSize().Print(num_inputs);
+    for (int i = 0; i < stages.size(); ++i) {
+      if (stages[i].num_calls == 0) continue;
+      printf("Stage %-15s", kStageNames[i]);
+      stages[i].Print(num_inputs);
+    }
+    printf("Peak memory: %zu bytes, %.1f allocations\n", peak_memory_bytes,
+           num_allocations * 1.0 / num_inputs);
   }
 
 
   std::vector<PikImageSizeInfo> layers;
+  // Indexed by PikStage; summed over all calls (e.g. tile groups).
+  std::vector<PikStageTime> stages;
   int num_butteraugli_iters = 0;
   size_t decoded_size = 0;
+  // Maximum number of bytes of images and other buffers allocated at any time
+  // during PixelsToPik or PikToPixels, excluding the input and buffers
+  // allocated before the call, see PoolAllocator::PeakBytesInUse of the
+  // encoder or decoder.
+  size_t peak_memory_bytes = 0;
+  // Number of such buffers allocated during the call, see
+  // PoolAllocator::NumAllocations.
+  size_t num_allocations = 0;
   // If not empty, additional debugging information (e.g. debug images) is
   // saved in files with this prefix.
   std::string debug_prefix;
 };
 
+// Adds the wall-clock time from construction to destruction to a stage of
+// "info", unless it is null.
+class ScopedStageTimer {
+ public:
+  ScopedStageTimer(PikInfo* info, const PikStage stage)
+      : info_(info), stage_(stage),
+        start_(info == nullptr ? 0 : Start<uint64_t>()) {}
+  ScopedStageTimer(const ScopedStageTimer&) = delete;
+  ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+  ~ScopedStageTimer() {
+    if (info_ == nullptr) return;
+    PikStageTime& time = info_->stages[stage_];
+    time.ticks += Stop<uint64_t>() - start_;
+    ++time.num_calls;
+  }
+
+ private:
+  PikInfo* const info_;
+  const PikStage stage_;
+  const uint64_t start_;
+};
+
 }  // namespace pik
 
 #endif  // PIK_INFO_H_
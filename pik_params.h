@@ -25,6 +25,22 @@ struct CompressParams {
 
   bool alpha_channel = false;
 
+  // Maximum number of threads used for encoding (including the calling
+  // thread). The output does not depend on this value.
+  int num_threads = 1;
+
+  // If positive, the AC coefficients are stored in groups of this many block
+  // rows that can be decoded in parallel (at the cost of slightly larger
+  // files). Zero means a single AC stream.
+  int tile_group_rows = 0;
+
+  // If true, the image is converted and encoded one tile group at a time, so
+  // that the encoder memory is proportional to tile_group_rows instead of the
+  // image height. The output is the same as without this option. Requires
+  // tile_group_rows > 0 and a mode without quantization search, i.e.
+  // fast_mode, uniform_quant or neither distance nor bitrate targets. Only
+  // supported by PixelsToPik.
+  bool stripes = false;
 };
 
 struct DecompressParams {
@@ -32,6 +48,30 @@ struct DecompressParams {
   // If true, checks at the end of decoding that all of the compressed data
   // was consumed by the decoder.
   bool check_decompressed_size = true;
+
+  // Maximum number of threads used for decoding (including the calling
+  // thread).
+  int num_threads = 1;
+
+  // Returns an image of ceil(xsize / downsampling) x ceil(ysize /
+  // downsampling) pixels. 2 and 4 reconstruct each block with a reduced IDCT
+  // of its low frequency coefficients. 8 only decodes the DC coefficients,
+  // without decoding or transforming the AC coefficients (not supported by
+  // PikToPixelRows). Images with alpha can only be decoded with 1.
+  int downsampling = 1;
+
+  // If crop_xsize and crop_ysize are nonzero, only the rectangle [crop_x0,
+  // crop_x0 + crop_xsize) x [crop_y0, crop_y0 + crop_ysize) of the image,
+  // which must lie within the image, is reconstructed and returned (with
+  // coordinates divided by "downsampling", rounding outwards). The pixels are
+  // the same as in the corresponding part of the whole decoded image. Only
+  // the blocks near the rectangle are reconstructed, and if the image has
+  // tile groups, only the AC coefficients of groups near the rectangle are
+  // decoded. Not supported with downsampling = 8 or by PikToPixelRows.
+  size_t crop_x0 = 0;
+  size_t crop_y0 = 0;
+  size_t crop_xsize = 0;
+  size_t crop_ysize = 0;
 };
 }  // namespace pik
 
@@ -172,7 +172,7 @@ class Results {
  public:
   Results() {
     // Zero-initialize first accumulator to avoid a check for num_zones_ == 0.
-    memset(zones_, 0, sizeof(Accumulator));
+    memset(static_cast<void*>(zones_), 0, sizeof(Accumulator));
   }
 
   // Used for computing overhead when this thread encounters its first Zone.
@@ -477,7 +477,10 @@ class ThreadSpecific {
       }
       // This buffering halves observer overhead and decreases the overall
       // runtime by about 3%.
-      CacheAligned::StreamCacheLine(buffer_, packets_ + num_packets_);
+      // Packet is POD, hence it can be copied as its underlying uint64_t.
+      CacheAligned::StreamCacheLine(
+          reinterpret_cast<const uint64_t*>(buffer_),
+          reinterpret_cast<uint64_t*>(packets_ + num_packets_));
       num_packets_ += kBufferCapacity;
       buffer_size_ = 0;
     }
@@ -593,19 +596,19 @@ class Zone {
 // Creates a zone starting from here until the end of the current scope.
 // Timestamps will be recorded when entering and exiting the zone.
 // "name" must be a string literal, which is ensured by merging with "".
-#define PROFILER_ZONE(name) \
-  PIK_COMPILER_FENCE;       \
-  const Zone zone("" name); \
+#define PROFILER_ZONE(name)      \
+  PIK_COMPILER_FENCE;            \
+  const pik::Zone zone("" name); \
   PIK_COMPILER_FENCE
 
 // Creates a zone for an entire function (when placed at its beginning).
 // Shorter/more convenient than ZONE.
-#define PROFILER_FUNC        \
-  PIK_COMPILER_FENCE;        \
-  const Zone zone(__func__); \
+#define PROFILER_FUNC             \
+  PIK_COMPILER_FENCE;             \
+  const pik::Zone zone(__func__); \
   PIK_COMPILER_FENCE
 
-#define PROFILER_PRINT_RESULTS Zone::PrintResults
+#define PROFILER_PRINT_RESULTS pik::Zone::PrintResults
 
 inline void ThreadSpecific::ComputeOverhead() {
   // Delay after capturing timestamps before/after the actual zone runs. Even
@@ -15,6 +15,7 @@
 #include "quantizer.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <algorithm>
 #include <vector>
 
@@ -23,6 +24,9 @@
 #include "compiler_specific.h"
 #include "dct.h"
 #include "opsin_codec.h"
+#include "profiler.h"
+#include "quantizer_target.h"
+#include "simd/dispatch.h"
 
 namespace pik {
 
@@ -262,6 +266,21 @@ const float* DequantMatrix() {
   return kDequantMatrix;
 }
 
+const float* NewQuantMatrix() {
+  const float* const PIK_RESTRICT kDequantMatrix = DequantMatrix();
+  float* table = static_cast<float*>(
+      CacheAligned::Allocate(192 * sizeof(float)));
+  for (int i = 0; i < 192; ++i) {
+    table[i] = 1.0f / (64.0f * kDequantMatrix[i]);
+  }
+  return table;
+}
+
+const float* QuantMatrix() {
+  static const float* const kQuantMatrix = NewQuantMatrix();
+  return kQuantMatrix;
+}
+
 int ClampVal(int val) {
   return std::min(kQuantMax, std::max(1, val));
 }
@@ -272,7 +291,8 @@ Quantizer::Quantizer(int quant_xsize, int quant_ysize) :
     global_scale_(kGlobalScaleDenom / kDefaultQuant),
     quant_dc_(kDefaultQuant),
     quant_img_ac_(quant_xsize_, quant_ysize_, kDefaultQuant),
-    scale_(quant_xsize_ * 64, quant_ysize_),
+    quant_matrix_(QuantMatrix()),
+    dequant_matrix_(DequantMatrix()),
     initialized_(false) {
 }
 
@@ -314,29 +334,9 @@ bool Quantizer::SetQuantField(const float quant_dc, const ImageF& qf) {
     changed = true;
   }
   if (changed) {
-    const float* const PIK_RESTRICT kDequantMatrix = DequantMatrix();
-    std::vector<float> quant_matrix(192);
-    for (int i = 0; i < quant_matrix.size(); ++i) {
-      quant_matrix[i] = 1.0f / (64.0f * kDequantMatrix[i]);
-    }
     const float qdc = scale * quant_dc_;
-    const float scale64 = scale * 64.0f;
-    const float qdc64 = qdc * 64.0f;
-    for (int y = 0; y < quant_ysize_; ++y) {
-      auto row_q = quant_img_ac_.Row(y);
-      auto row_scale = scale_.Row(y);
-      for (int x = 0; x < quant_xsize_; ++x) {
-        const int offset = x * 64;
-        const float qac64 = scale64 * row_q[x];
-        for (int c = 0; c < 3; ++c) {
-          const float* const PIK_RESTRICT qm = &quant_matrix[c * 64];
-          for (int k = 0; k < 64; ++k) {
-            row_scale[c][offset + k] = qac64 * qm[k];
-          }
-          row_scale[c][offset] = qdc64 * qm[0];
-        }
-      }
-    }
+    scale64_ = scale * 64.0f;
+    qdc64_ = qdc * 64.0f;
     inv_global_scale_ = 1.0f / scale;
     inv_quant_dc_ = 1.0f / qdc;
     initialized_ = true;
@@ -344,6 +344,24 @@ bool Quantizer::SetQuantField(const float quant_dc, const ImageF& qf) {
   return changed;
 }
 
+Quantizer Quantizer::Crop(int x0, int y0, int xsize, int ysize) const {
+  PIK_CHECK(0 <= x0 && x0 + xsize <= quant_xsize_);
+  PIK_CHECK(0 <= y0 && y0 + ysize <= quant_ysize_);
+  Quantizer out(xsize, ysize);
+  out.global_scale_ = global_scale_;
+  out.quant_dc_ = quant_dc_;
+  out.inv_global_scale_ = inv_global_scale_;
+  out.inv_quant_dc_ = inv_quant_dc_;
+  out.scale64_ = scale64_;
+  out.qdc64_ = qdc64_;
+  for (int y = 0; y < ysize; ++y) {
+    memcpy(out.quant_img_ac_.Row(y), &quant_img_ac_.Row(y0 + y)[x0],
+           xsize * sizeof(int));
+  }
+  out.initialized_ = initialized_;
+  return out;
+}
+
 void Quantizer::GetQuantField(float* quant_dc, ImageF* qf) {
   const float scale = global_scale_ * 1.0f / kGlobalScaleDenom;
   *quant_dc = scale * quant_dc_;
@@ -375,6 +393,9 @@ bool Quantizer::Decode(BitReader* br) {
   }
   inv_global_scale_ = kGlobalScaleDenom * 1.0 / global_scale_;
   inv_quant_dc_ = inv_global_scale_ / quant_dc_;
+  const float scale = global_scale_ * 1.0f / kGlobalScaleDenom;
+  scale64_ = scale * 64.0f;
+  qdc64_ = scale * quant_dc_ * 64.0f;
   initialized_ = true;
   return true;
 }
@@ -391,47 +412,58 @@ void Quantizer::DumpQuantizationMap() const {
   }
 }
 
-Image3W QuantizeCoeffs(const Image3F& in, const Quantizer& quantizer) {
+void Quantizer::QuantizeBlocks(const int quant_x, const int quant_y,
+                               const int c, const size_t num_blocks,
+                               const float* PIK_RESTRICT blocks_in,
+                               int16_t* PIK_RESTRICT blocks_out) const {
+  // The multipliers are computed on the fly rather than stored per block,
+  // which would take more memory than the coefficients themselves.
+  static const float kZeroBias[3] = { 0.65f, 0.6f, 0.7f };
+  dispatch::Run(pik::QuantizeBlocks(), blocks_in, num_blocks,
+                &quant_matrix_[c * 64], &quant_img_ac_.Row(quant_y)[quant_x],
+                scale64_, qdc64_, kZeroBias[c], blocks_out);
+}
+
+void Quantizer::DequantizeBlocks(const int quant_x, const int quant_y,
+                                 const int c, const size_t num_blocks,
+                                 const int16_t* PIK_RESTRICT blocks_in,
+                                 float* PIK_RESTRICT blocks_out) const {
+  dispatch::Run(pik::DequantizeBlocks(), blocks_in, num_blocks,
+                &dequant_matrix_[c * 64], &quant_img_ac_.Row(quant_y)[quant_x],
+                inv_global_scale_, inv_quant_dc_, blocks_out);
+}
+
+Image3W QuantizeCoeffs(const Image3F& in, const Quantizer& quantizer,
+                       ThreadPool* pool) {
+  PROFILER_FUNC;
   const int block_xsize = in.xsize() / 64;
   const int block_ysize = in.ysize();
   Image3W out(block_xsize * 64, block_ysize);
-  for (int block_y = 0; block_y < block_ysize; ++block_y) {
+  RunOnPool(pool, 0, block_ysize, [&](const int block_y, const int thread) {
     auto row_in = in.Row(block_y);
     auto row_out = out.Row(block_y);
-    for (int block_x = 0; block_x < block_xsize; ++block_x) {
-      const int offset = block_x * 64;
-      for (int c = 0; c < 3; ++c) {
-        quantizer.QuantizeBlock(block_x, block_y, c,
-                                &row_in[c][offset], &row_out[c][offset]);
-      }
+    for (int c = 0; c < 3; ++c) {
+      quantizer.QuantizeBlocks(0, block_y, c, block_xsize, row_in[c],
+                               row_out[c]);
     }
-  }
+  });
   return out;
 }
 
-Image3F DequantizeCoeffs(const Image3W& in, const Quantizer& quantizer) {
+Image3F DequantizeCoeffs(const Image3W& in, const Quantizer& quantizer,
+                         ThreadPool* pool) {
+  PROFILER_FUNC;
   const int block_xsize = in.xsize() / 64;
   const int block_ysize = in.ysize();
   Image3F out(block_xsize * 64, block_ysize);
-  const float inv_quant_dc = quantizer.inv_quant_dc();
-  const float* PIK_RESTRICT kDequantMatrix = DequantMatrix();
-  for (int by = 0; by < block_ysize; ++by) {
+  RunOnPool(pool, 0, block_ysize, [&](const int by, const int thread) {
     auto row_in = in.Row(by);
     auto row_out = out.Row(by);
-    for (int bx = 0; bx < block_xsize; ++bx) {
-      const int offset = bx * 64;
-      const float inv_quant_ac = quantizer.inv_quant_ac(bx, by);
-      for (int c = 0; c < 3; ++c) {
-        const int16_t* const PIK_RESTRICT block_in = &row_in[c][offset];
-        const float* const PIK_RESTRICT muls = &kDequantMatrix[c * 64];
-        float* const PIK_RESTRICT block_out = &row_out[c][offset];
-        for (int k = 0; k < 64; ++k) {
-          block_out[k] = block_in[k] * (muls[k] * inv_quant_ac);
-        }
-        block_out[0] = block_in[0] * (muls[0] * inv_quant_dc);
-      }
+    for (int c = 0; c < 3; ++c) {
+      quantizer.DequantizeBlocks(0, by, c, block_xsize, row_in[c],
+                                 row_out[c]);
     }
-  }
+  });
   return out;
 }
 
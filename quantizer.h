@@ -27,6 +27,7 @@
 #include "compiler_specific.h"
 #include "image.h"
 #include "pik_info.h"
+#include "thread_pool.h"
 
 namespace pik {
 
@@ -41,22 +42,54 @@ class Quantizer {
     SetQuantField(quant, ImageF(quant_xsize_, quant_ysize_, quant));
   }
 
+  // Returns a quantizer for the blocks [x0, x0 + xsize) x [y0, y0 + ysize)
+  // with the same global scale and DC quantization, such that quantizing a
+  // crop of the coefficients gives the same result as cropping the output.
+  Quantizer Crop(int x0, int y0, int xsize, int ysize) const;
+
+  // Raw (integer) quantization parameters; blocks whose quant_img_ac() value
+  // differs between two quantizers with the same global_scale() and
+  // quant_dc() are the only ones quantized differently.
+  int global_scale() const { return global_scale_; }
+  int quant_dc() const { return quant_dc_; }
+  const Image<int>& quant_img_ac() const { return quant_img_ac_; }
+
   float inv_quant_dc() const { return inv_quant_dc_; }
   float inv_quant_ac(int quant_x, int quant_y) const {
     return inv_global_scale_ / quant_img_ac_.Row(quant_y)[quant_x];
   }
 
+  // Quantizes the "num_blocks" horizontally adjacent blocks of channel "c"
+  // starting at block (quant_x, quant_y), i.e. 64 * num_blocks coefficients.
+  // The SIMD implementation is selected at runtime, see quantizer_target.h.
+  // Requires that "blocks_in" and "blocks_out" are 32-bytes aligned.
+  void QuantizeBlocks(int quant_x, int quant_y, int c, size_t num_blocks,
+                      const float* PIK_RESTRICT blocks_in,
+                      int16_t* PIK_RESTRICT blocks_out) const;
+
   void QuantizeBlock(int quant_x, int quant_y, int c,
                      const float* PIK_RESTRICT block_in,
                      int16_t* PIK_RESTRICT block_out) const {
-    const float* const PIK_RESTRICT scale =
-        &scale_.Row(quant_y)[c][quant_x * 64];
-    for (int k = 0; k < 64; ++k) {
-      const float val = block_in[k] * scale[k];
-      static const float kZeroBias[3] = { 0.65f, 0.6f, 0.7f };
-      const float thres = kZeroBias[c];
-      block_out[k] = (k > 0 && std::abs(val) < thres) ? 0 : std::round(val);
-    }
+    QuantizeBlocks(quant_x, quant_y, c, 1, block_in, block_out);
+  }
+
+  // Same result as the corresponding blocks of DequantizeCoeffs.
+  void DequantizeBlocks(int quant_x, int quant_y, int c, size_t num_blocks,
+                        const int16_t* PIK_RESTRICT blocks_in,
+                        float* PIK_RESTRICT blocks_out) const;
+
+  void DequantizeBlock(int quant_x, int quant_y, int c,
+                       const int16_t* PIK_RESTRICT block_in,
+                       float* PIK_RESTRICT block_out) const {
+    DequantizeBlocks(quant_x, quant_y, c, 1, block_in, block_out);
+  }
+
+  // Returns coefficient "k" of DequantizeBlock.
+  float DequantizeCoeff(int quant_x, int quant_y, int c, int k,
+                        int16_t coeff) const {
+    const float inv_quant = k == 0 ? inv_quant_dc_ :
+        inv_quant_ac(quant_x, quant_y);
+    return coeff * (dequant_matrix_[c * 64 + k] * inv_quant);
   }
 
   std::string Encode(PikImageSizeInfo* info) const;
@@ -74,13 +107,20 @@ class Quantizer {
   Image<int> quant_img_ac_;
   float inv_global_scale_;
   float inv_quant_dc_;
-  // Scaled quantization multipliers, one for each channel.
-  Image3F scale_;
+  // Quantization multipliers are quant_matrix_[c * 64 + k] times scale64_
+  // times the quant_img_ac_ value of the block (qdc64_ for the DC).
+  const float* quant_matrix_;
+  const float* dequant_matrix_;
+  float scale64_;
+  float qdc64_;
   bool initialized_ = false;
 };
 
-Image3W QuantizeCoeffs(const Image3F& in, const Quantizer& quantizer);
-Image3F DequantizeCoeffs(const Image3W& in, const Quantizer& quantizer);
+// Block rows are processed in parallel if "pool" is not null.
+Image3W QuantizeCoeffs(const Image3F& in, const Quantizer& quantizer,
+                       ThreadPool* pool = nullptr);
+Image3F DequantizeCoeffs(const Image3W& in, const Quantizer& quantizer,
+                         ThreadPool* pool = nullptr);
 
 }  // namespace pik
 
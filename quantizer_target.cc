@@ -0,0 +1,80 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// WARNING: this translation unit is compiled with different flags. To prevent
+// ODR violations, all functions defined here or in dependent headers must be
+// inlined and/or within namespace SIMD_NAMESPACE.
+
+#include "quantizer_target.h"
+
+#include <cmath>
+
+#include "simd/simd.h"
+
+namespace pik {
+
+template <>
+void QuantizeBlocks::operator()<SIMD_TARGET>(
+    const float* PIK_RESTRICT from, const size_t num_blocks,
+    const float* PIK_RESTRICT qm, const int* PIK_RESTRICT quant_ac,
+    const float scale64, const float qdc64, const float zero_bias,
+    int16_t* PIK_RESTRICT to) {
+  using namespace SIMD_NAMESPACE;
+  const Full<float, SIMD_TARGET> d;
+  const Full<int32_t, SIMD_TARGET> di;
+  // Half-vectors of half-width lanes.
+  const Part<int16_t, d.N, SIMD_TARGET> d16;
+  const auto sign_mask = set1(d, -0.0f);
+  const auto half = set1(d, 0.5f);
+  const auto thres = set1(d, zero_bias);
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const float* PIK_RESTRICT block_in = from + i * 64;
+    int16_t* PIK_RESTRICT block_out = to + i * 64;
+    const auto qac64 = set1(d, scale64 * quant_ac[i]);
+    for (size_t k = 0; k < 64; k += d.N) {
+      const auto val = load(d, block_in + k) * (qac64 * load(d, qm + k));
+      // Adding 0.5 with the sign of "val" and truncating is std::round for
+      // magnitudes of at least 0.5: rounding the sum cannot reach the next
+      // integer. Smaller magnitudes are below the zero bias.
+      const auto rounded = convert_to(di, val + (half | (val & sign_mask)));
+      const auto is_zero = cast_to(di, andnot(sign_mask, val) < thres);
+      store(convert_to(d16, andnot(is_zero, rounded)), d16, block_out + k);
+    }
+    block_out[0] = std::round(block_in[0] * (qdc64 * qm[0]));
+  }
+}
+
+template <>
+void DequantizeBlocks::operator()<SIMD_TARGET>(
+    const int16_t* PIK_RESTRICT from, const size_t num_blocks,
+    const float* PIK_RESTRICT muls, const int* PIK_RESTRICT quant_ac,
+    const float inv_global_scale, const float inv_quant_dc,
+    float* PIK_RESTRICT to) {
+  using namespace SIMD_NAMESPACE;
+  const Full<float, SIMD_TARGET> d;
+  const Full<int32_t, SIMD_TARGET> di;
+  const Part<int16_t, d.N, SIMD_TARGET> d16;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const int16_t* PIK_RESTRICT block_in = from + i * 64;
+    float* PIK_RESTRICT block_out = to + i * 64;
+    const auto inv_ac = set1(d, inv_global_scale / quant_ac[i]);
+    for (size_t k = 0; k < 64; k += d.N) {
+      const auto coeffs = convert_to(d, convert_to(di, load(d16, block_in + k)));
+      store(coeffs * (load(d, muls + k) * inv_ac), d, block_out + k);
+    }
+    block_out[0] = block_in[0] * (muls[0] * inv_quant_dc);
+  }
+}
+
+}  // namespace pik
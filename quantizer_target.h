@@ -0,0 +1,60 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef QUANTIZER_TARGET_H_
+#define QUANTIZER_TARGET_H_
+
+// Quantization kernels compiled once per instruction set (see Makefile) and
+// selected at runtime via dispatch::Run. All of them produce the same result
+// on every instruction set, which is also that of the scalar formulas in
+// Quantizer::QuantizeBlocks/DequantizeBlocks.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compiler_specific.h"
+
+namespace pik {
+
+// Quantizes "num_blocks" consecutive blocks of 64 coefficients starting at
+// "from" and writes them to "to". The multiplier of coefficient k of block i
+// is "qm"[k] times "scale64" times "quant_ac"[i], or "qdc64" times "qm"[0] for
+// the DC. AC coefficients whose magnitude after multiplication is less than
+// "zero_bias" (which must exceed 0.5) become zero, all others are rounded to
+// the nearest integer with ties away from zero. Requires that "from" and "to"
+// are 32-bytes aligned and the results fit in int16_t.
+struct QuantizeBlocks {
+  template <class Target>
+  void operator()(const float* PIK_RESTRICT from, size_t num_blocks,
+                  const float* PIK_RESTRICT qm, const int* PIK_RESTRICT quant_ac,
+                  float scale64, float qdc64, float zero_bias,
+                  int16_t* PIK_RESTRICT to);
+};
+
+// Dequantizes "num_blocks" consecutive blocks of 64 coefficients starting at
+// "from" and writes them to "to". Coefficient k of block i is multiplied by
+// "muls"[k] times "inv_global_scale" / "quant_ac"[i], or by "muls"[0] times
+// "inv_quant_dc" for the DC. Requires that "from" and "to" are 32-bytes
+// aligned.
+struct DequantizeBlocks {
+  template <class Target>
+  void operator()(const int16_t* PIK_RESTRICT from, size_t num_blocks,
+                  const float* PIK_RESTRICT muls,
+                  const int* PIK_RESTRICT quant_ac, float inv_global_scale,
+                  float inv_quant_dc, float* PIK_RESTRICT to);
+};
+
+}  // namespace pik
+
+#endif  // QUANTIZER_TARGET_H_
@@ -0,0 +1,134 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "rate_control.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace pik {
+
+namespace {
+
+// A scale is accepted once its size is at least this fraction of the target.
+constexpr double kTolerance = 0.96;
+// The model aims at this fraction of the target, so that its errors rarely
+// cause the size to exceed the target.
+constexpr double kAim = 0.985;
+// Maximum number of calls to "encode" at scales predicted by the model.
+constexpr int kMaxModelEncodes = 4;
+// Maximum number of estimates per prediction, and the relative error of the
+// estimate at which the prediction stops early.
+constexpr int kMaxEstimates = 3;
+constexpr double kEstimateTolerance = 0.02;
+
+// Locally fits log(size) = a + b * log(scale) through the two most recent
+// (scale, estimated size) points, i.e. the secant method in log-log space.
+class RateModel {
+ public:
+  void Add(const float scale, const size_t size) {
+    if (std::log(scale) == log_scale_[1]) {
+      log_size_[1] = std::log(size);
+      return;
+    }
+    log_scale_[0] = log_scale_[1];
+    log_size_[0] = log_size_[1];
+    log_scale_[1] = std::log(scale);
+    log_size_[1] = std::log(size);
+  }
+
+  // Returns the scale in (lower, upper) whose estimated size is "size".
+  float ScaleForSize(const double size, const float lower,
+                     const float upper) const {
+    const double b = (log_size_[1] - log_size_[0]) /
+                     (log_scale_[1] - log_scale_[0]);
+    float scale = upper;
+    // Finer quantization must increase the size, otherwise bisect.
+    if (std::isfinite(b) && b > 0.0) {
+      scale = std::exp(log_scale_[1] + (std::log(size) - log_size_[1]) / b);
+    }
+    if (!(scale < upper && scale > lower)) {
+      scale = std::sqrt(lower * upper);
+    }
+    return scale;
+  }
+
+ private:
+  double log_scale_[2] = {0.0, 0.0};
+  double log_size_[2] = {0.0, 0.0};
+};
+
+}  // namespace
+
+bool ScaleForTargetSize(const EstimateSizeFunc& estimate,
+                        const EncodeSizeFunc& encode, const size_t target_size,
+                        const float min_scale, float* scale) {
+  size_t estimate_s;
+  size_t size = encode(1.0f, &estimate_s);
+  if (size <= target_size) {
+    *scale = 1.0f;
+    return true;
+  }
+
+  RateModel model;
+  model.Add(0.5f, estimate(0.5f));
+  model.Add(1.0f, estimate_s);
+  // Largest scale known to fit (zero if none yet), and smallest scale known
+  // to exceed the target.
+  float good = 0.0f;
+  float bad = 1.0f;
+  for (int i = 0; i < kMaxModelEncodes && bad > min_scale; ++i) {
+    // Actual sizes differ from the estimates by a factor that varies slowly
+    // with the scale; use the one observed at the latest encode.
+    const double estimate_goal =
+        kAim * target_size * estimate_s / static_cast<double>(size);
+    const float lower = std::max(good, min_scale);
+    float s = std::max(model.ScaleForSize(estimate_goal, lower, bad),
+                       min_scale);
+    for (int j = 0; j < kMaxEstimates; ++j) {
+      const size_t estimated = estimate(s);
+      model.Add(s, estimated);
+      if (std::abs(estimated / estimate_goal - 1.0) < kEstimateTolerance) {
+        break;
+      }
+      s = std::max(model.ScaleForSize(estimate_goal, lower, bad), min_scale);
+    }
+
+    size = encode(s, &estimate_s);
+    model.Add(s, estimate_s);
+    if (size <= target_size) {
+      good = s;
+      if (size >= kTolerance * target_size) break;
+    } else {
+      bad = s;
+    }
+  }
+
+  if (good == 0.0f) {
+    // The model did not find any scale that fits; halve until one does.
+    for (float s = bad * 0.5f; bad > min_scale; s *= 0.5f) {
+      s = std::max(s, min_scale);
+      if (encode(s, &estimate_s) <= target_size) {
+        good = s;
+        break;
+      }
+      bad = s;
+    }
+    if (good == 0.0f) return false;
+  }
+  *scale = good;
+  return true;
+}
+
+}  // namespace pik
@@ -0,0 +1,45 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RATE_CONTROL_H_
+#define RATE_CONTROL_H_
+
+// Chooses the quantization scale for a target compressed size.
+
+#include <stddef.h>
+#include <functional>
+
+namespace pik {
+
+// Returns a cheap (e.g. histogram-based) estimate of the compressed size after
+// quantizing with "scale".
+using EstimateSizeFunc = std::function<size_t(float scale)>;
+
+// Returns the actual compressed size after quantizing with "scale", and stores
+// the estimate for the same quantization in "*estimate".
+using EncodeSizeFunc = std::function<size_t(float scale, size_t* estimate)>;
+
+// Finds a scale in [min_scale, 1] for which "encode" returns at most
+// "target_size", close to the largest such scale (larger scales mean finer
+// quantization). The rate model is a power law fitted to the estimates and
+// corrected by the ratio of actual to estimated size, so this usually calls
+// "encode" only two or three times. Returns false if even min_scale exceeds
+// the target.
+bool ScaleForTargetSize(const EstimateSizeFunc& estimate,
+                        const EncodeSizeFunc& encode, size_t target_size,
+                        float min_scale, float* scale);
+
+}  // namespace pik
+
+#endif  // RATE_CONTROL_H_
@@ -629,9 +629,13 @@ SIMD_INLINE scalar<int32_t> convert_to(Scalar<int32_t>, const scalar<float> v) {
 
 // Approximation of round-to-nearest for numbers representable as int32_t.
 SIMD_INLINE scalar<int32_t> nearest_int(const scalar<float> v) {
-  const float f = v.raw;
-  const float bias = f < 0.0f ? -0.5f : 0.5f;
-  return scalar<int32_t>(f + bias);
+  // Double avoids rounding f + bias up, e.g. for 0.49999997f.
+  const double f = v.raw;
+  const double bias = f < 0.0 ? -0.5 : 0.5;
+  int32_t rounded = static_cast<int32_t>(f + bias);
+  // Ties to even, as x86 does in the default rounding mode.
+  if (rounded - f == bias && (rounded & 1)) rounded -= f < 0.0 ? -1 : 1;
+  return scalar<int32_t>(rounded);
 }
 
 // ================================================== SWIZZLE
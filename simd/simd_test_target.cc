@@ -1187,6 +1187,13 @@ struct TestIntFromFloat {
     // Below negative
     ASSERT_VEC_EQ(d, iota(d, -24), convert_to(d, iota(df, -24.001f)));
     ASSERT_VEC_EQ(d, iota(d, -24), nearest_int(iota(df, -24.001f)));
+
+    // Ties round to even
+    ASSERT_VEC_EQ(d, set1(d, 2), nearest_int(set1(df, 2.5f)));
+    ASSERT_VEC_EQ(d, set1(d, -4), nearest_int(set1(df, -3.5f)));
+
+    // Just below a tie
+    ASSERT_VEC_EQ(d, set1(d, 0), nearest_int(set1(df, 0.49999997f)));
   }
 };
 
@@ -0,0 +1,96 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thread_pool.h"
+
+#include "cache_aligned.h"
+
+namespace pik {
+
+thread_local bool ThreadPool::in_task_ = false;
+
+ThreadPool::ThreadPool(const int num_worker_threads) {
+  workers_.reserve(num_worker_threads);
+  for (int i = 0; i < num_worker_threads; ++i) {
+    // Thread 0 is the caller of Run.
+    workers_.emplace_back(&ThreadPool::WorkerMain, this, i + 1);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  work_ready_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::RunImpl(const int begin, const int end, const Closure closure,
+                         const void* opaque) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closure_ = closure;
+    opaque_ = opaque;
+    allocator_ = CacheAligned::CurrentAllocator();
+    end_ = end;
+    next_task_.store(begin);
+    num_busy_workers_ = workers_.size();
+    ++generation_;
+  }
+  work_ready_.notify_all();
+
+  RunTasks(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_done_.wait(lock, [this] { return num_busy_workers_ == 0; });
+}
+
+void ThreadPool::RunTasks(const int thread) {
+  const ScopedAllocator scoped_allocator(allocator_);
+  in_task_ = true;
+  for (;;) {
+    const int task = next_task_.fetch_add(1);
+    if (task >= end_) break;
+    closure_(opaque_, task, thread);
+  }
+  in_task_ = false;
+}
+
+void ThreadPool::WorkerMain(const int thread) {
+  uint64_t seen_generation = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_ready_.wait(lock, [this, seen_generation] {
+        return shutdown_ || generation_ != seen_generation;
+      });
+      if (shutdown_) return;
+      seen_generation = generation_;
+    }
+
+    RunTasks(thread);
+
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      last = --num_busy_workers_ == 0;
+    }
+    if (last) work_done_.notify_one();
+  }
+}
+
+}  // namespace pik
@@ -0,0 +1,116 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>  // NOLINT
+#include <mutex>               // NOLINT
+#include <thread>              // NOLINT
+#include <vector>
+
+namespace pik {
+
+class CacheAlignedAllocator;
+
+// Fixed set of worker threads that execute data-parallel loops. Tasks are
+// handed out one at a time via an atomic counter, so threads that finish early
+// take over the remaining tasks (dynamic load balancing without per-thread
+// queues). The calling thread participates, hence a pool without workers
+// simply runs all tasks on the caller.
+//
+// Run() must not be called concurrently. Calls from within a task (of any
+// pool) run all tasks sequentially on the calling thread, which allows nesting
+// parallel loops without deadlocking. Tasks allocate with the caller's
+// CacheAligned allocator (see ScopedAllocator).
+class ThreadPool {
+ public:
+  // Starts "num_worker_threads" threads in addition to the caller.
+  explicit ThreadPool(int num_worker_threads);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Waits for the workers to exit.
+  ~ThreadPool();
+
+  // Upper bound (exclusive) for the "thread" argument passed to tasks, e.g.
+  // for indexing per-thread scratch buffers.
+  int NumThreads() const { return static_cast<int>(workers_.size()) + 1; }
+
+  // Calls func(task, thread) for every task in [begin, end), possibly
+  // concurrently, and returns after all calls have finished. The order in
+  // which tasks run is unspecified, so tasks must write disjoint outputs.
+  template <class Func>
+  void Run(const int begin, const int end, const Func& func) {
+    if (workers_.empty() || end - begin <= 1 || in_task_) {
+      for (int task = begin; task < end; ++task) {
+        func(task, 0);
+      }
+      return;
+    }
+    RunImpl(begin, end, &CallClosure<Func>, &func);
+  }
+
+ private:
+  using Closure = void (*)(const void* opaque, int task, int thread);
+
+  template <class Func>
+  static void CallClosure(const void* opaque, int task, int thread) {
+    (*static_cast<const Func*>(opaque))(task, thread);
+  }
+
+  void RunImpl(int begin, int end, Closure closure, const void* opaque);
+  void RunTasks(int thread);
+  void WorkerMain(int thread);
+
+  // Whether the current thread is running a task.
+  static thread_local bool in_task_;
+
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable work_done_;
+  // Incremented by each Run; workers wait for a value they have not seen.
+  uint64_t generation_ = 0;
+  int num_busy_workers_ = 0;
+  bool shutdown_ = false;
+
+  // Current loop, written under mutex_ before generation_ is incremented.
+  Closure closure_ = nullptr;
+  const void* opaque_ = nullptr;
+  CacheAlignedAllocator* allocator_ = nullptr;
+  int end_ = 0;
+  std::atomic<int> next_task_{0};
+};
+
+// Calls func(task, thread) for all tasks in [begin, end) on "pool", or
+// sequentially on the current thread (with thread = 0) if pool is null.
+template <class Func>
+void RunOnPool(ThreadPool* pool, const int begin, const int end,
+               const Func& func) {
+  if (pool == nullptr) {
+    for (int task = begin; task < end; ++task) {
+      func(task, 0);
+    }
+  } else {
+    pool->Run(begin, end, func);
+  }
+}
+
+}  // namespace pik
+
+#endif  // THREAD_POOL_H_
@@ -0,0 +1,127 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TSC_TIMER_H_
+#define TSC_TIMER_H_
+
+// High-resolution (~10 ns) timestamps, using fences to prevent reordering and
+// ensure exactly the desired regions are measured.
+
+#include <stdint.h>
+#include <chrono>  // NOLINT
+
+#include "arch_specific.h"
+#include "compiler_specific.h"
+
+#if PIK_ARCH_X64 && PIK_COMPILER_MSVC
+#include <emmintrin.h>  // _mm_lfence
+#include <intrin.h>
+#endif
+
+namespace pik {
+
+// Usage:
+//   const uint64_t t0 = Start<uint64_t>();
+//   ... (code to measure)
+//   const uint64_t ticks = Stop<uint64_t>() - t0;
+// Divide by InvariantTicksPerSecond() to convert to seconds.
+//
+// On x86, Start uses RDTSC preceded by LFENCE, so that earlier instructions
+// finish before the timestamp is taken, and Stop uses RDTSCP, which waits for
+// the measured instructions, followed by LFENCE so that later instructions do
+// not begin before it. On PPC, both read the time base register. Elsewhere,
+// they fall back to std::chrono nanoseconds.
+template <typename T>
+inline T Start();
+
+template <typename T>
+inline T Stop();
+
+template <>
+inline uint64_t Start<uint64_t>() {
+  uint64_t t;
+#if PIK_ARCH_PPC
+  asm volatile("mfspr %0, %1" : "=r"(t) : "i"(268));
+#elif PIK_ARCH_X64 && PIK_COMPILER_MSVC
+  _mm_lfence();
+  PIK_COMPILER_FENCE;
+  t = __rdtsc();
+  _mm_lfence();
+  PIK_COMPILER_FENCE;
+#elif PIK_ARCH_X64 && (PIK_COMPILER_CLANG || PIK_COMPILER_GCC)
+  asm volatile(
+      "lfence\n\t"
+      "rdtsc\n\t"
+      "shl $32, %%rdx\n\t"
+      "or %%rdx, %0\n\t"
+      "lfence"
+      : "=a"(t)
+      :
+      // "memory" avoids reordering. rdx = TSC >> 32.
+      // "cc" = flags modified by SHL.
+      : "rdx", "memory", "cc");
+#else
+  t = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+#endif
+  return t;
+}
+
+template <>
+inline uint64_t Stop<uint64_t>() {
+  uint64_t t;
+#if PIK_ARCH_PPC
+  asm volatile("mfspr %0, %1" : "=r"(t) : "i"(268));
+#elif PIK_ARCH_X64 && PIK_COMPILER_MSVC
+  PIK_COMPILER_FENCE;
+  unsigned aux;
+  t = __rdtscp(&aux);
+  _mm_lfence();
+  PIK_COMPILER_FENCE;
+#elif PIK_ARCH_X64 && (PIK_COMPILER_CLANG || PIK_COMPILER_GCC)
+  // Use inline asm because __rdtscp generates code to store TSC_AUX (ecx).
+  asm volatile(
+      "rdtscp\n\t"
+      "shl $32, %%rdx\n\t"
+      "or %%rdx, %0\n\t"
+      "lfence"
+      : "=a"(t)
+      :
+      // "memory" avoids reordering. rcx = TSC_AUX. rdx = TSC >> 32.
+      // "cc" = flags modified by SHL.
+      : "rcx", "rdx", "memory", "cc");
+#else
+  t = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+#endif
+  return t;
+}
+
+// Returns a 32-bit timestamp with about 4 GHz resolution, which wraps around
+// after about one second; only suitable for measuring short regions.
+template <>
+inline uint32_t Start<uint32_t>() {
+  return static_cast<uint32_t>(Start<uint64_t>());
+}
+
+template <>
+inline uint32_t Stop<uint32_t>() {
+  return static_cast<uint32_t>(Stop<uint64_t>());
+}
+
+}  // namespace pik
+
+#endif  // TSC_TIMER_H_